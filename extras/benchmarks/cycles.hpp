@@ -0,0 +1,122 @@
+/*
+   Cycle counter and sample statistics for host benchmarks
+
+   Copyright (c) 2020 Simon D. Levy
+
+   This file is part of Hackflight.
+
+   Hackflight is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   Hackflight is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+   You should have received a copy of the GNU General Public License
+   along with Hackflight.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <vector>
+#include <algorithm>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#else
+#include <time.h>
+#endif
+
+namespace hf {
+
+    class Cycles {
+
+        public:
+
+#if defined(__x86_64__) || defined(__i386__)
+            static const char * units(void) { return "cycles"; }
+
+            static uint64_t now(void)
+            {
+                return __rdtsc();
+            }
+#else
+            static const char * units(void) { return "ns"; }
+
+            static uint64_t now(void)
+            {
+                struct timespec ts;
+                clock_gettime(CLOCK_MONOTONIC, &ts);
+                return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+            }
+#endif
+
+    }; // class Cycles
+
+    class CycleStats {
+
+        private:
+
+            std::vector<uint32_t> _samples;
+
+            uint32_t percentile(uint8_t pct) const
+            {
+                size_t k = _samples.size() * pct / 100;
+                return _samples[k < _samples.size() ? k : _samples.size()-1];
+            }
+
+        public:
+
+            void add(uint64_t cycles)
+            {
+                _samples.push_back(cycles > UINT32_MAX ? UINT32_MAX : (uint32_t)cycles);
+            }
+
+            size_t count(void) const
+            {
+                return _samples.size();
+            }
+
+            void clear(void)
+            {
+                _samples.clear();
+            }
+
+            // Sorts the samples in place
+            uint32_t median(void)
+            {
+                if (_samples.empty()) return 0;
+
+                std::sort(_samples.begin(), _samples.end());
+
+                return percentile(50);
+            }
+
+            static void printHeader(const char * label)
+            {
+                printf("  %-16s %9s %9s %9s %9s %9s\n", label, "count", "mean", "p50", "p99", "max");
+            }
+
+            // Sorts the samples in place
+            void print(const char * name)
+            {
+                if (_samples.empty()) return;
+
+                std::sort(_samples.begin(), _samples.end());
+
+                double sum = 0;
+                for (size_t k=0; k<_samples.size(); ++k) {
+                    sum += _samples[k];
+                }
+
+                printf("  %-16s %9zu %9.1f %9u %9u %9u\n", name, _samples.size(), sum / _samples.size(),
+                        percentile(50), percentile(99), _samples.back());
+            }
+
+    }; // class CycleStats
+
+} // namespace hf
@@ -0,0 +1,444 @@
+/*
+   Compares the cost of the state estimator's optical-flow covariance updates on the same
+   sequence of flow samples, done three ways: with the upper-triangle
+   SymmetricMatrix and sparse measurement rows that the EKF uses, with dense
+   Matrix<R,C> products, and with the 10x10 Matrix class that came before
+
+   Each flow sample is what StateEstimator::fuseFlow() does to the covariance:
+   two scalar measurement updates, for the X and Y pixel counts, followed by
+   the rotation of the attitude covariances in finalize().
+
+   Usage: ekfupdate [SAMPLES]
+
+   Copyright (c) 2020 Simon D. Levy
+
+   This file is part of Hackflight.
+
+   Hackflight is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   Hackflight is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+   You should have received a copy of the GNU General Public License
+   along with Hackflight.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <cmath>
+
+#include "cycles.hpp"
+#include "linalg.hpp"
+
+// Same state layout as StateEstimator
+enum {
+    STATE_X,
+    STATE_Y,
+    STATE_Z,
+    STATE_PX,
+    STATE_PY,
+    STATE_PZ,
+    STATE_D0,
+    STATE_D1,
+    STATE_D2,
+    STATE_DIM
+};
+
+static const float MAX_COVARIANCE = 100.f;
+static const float MIN_COVARIANCE = 1e-6f;
+static const float STDDEV         = 0.25f;
+static const float PROCESS_NOISE  = 1e-3f;
+
+// The runtime-dimensioned class, as it was before Matrix<R,C>
+class LegacyMatrix {
+
+    private:
+
+        static const uint8_t MAXSIZE = 10;
+
+        uint8_t _rows = 0;
+        uint8_t _cols = 0;
+
+        float _vals[MAXSIZE][MAXSIZE];
+
+    public:
+
+        LegacyMatrix(uint8_t rows, uint8_t cols)
+        {
+            _rows = rows;
+            _cols = cols;
+            memset(_vals, 0, sizeof(_vals));
+        }
+
+        float get(uint8_t j, uint8_t k) const
+        {
+            return _vals[j][k];
+        }
+
+        void set(uint8_t j, uint8_t k, float val)
+        {
+            _vals[j][k] = val;
+        }
+
+        static void trans(LegacyMatrix & a, LegacyMatrix & at)
+        {
+            for (uint8_t j=0; j<a._rows; ++j) {
+                for (uint8_t k=0; k<a._cols; ++k) {
+                    at._vals[k][j] = a._vals[j][k];
+                }
+            }
+        }
+
+        static void mult(LegacyMatrix & a, LegacyMatrix & b, LegacyMatrix & c)
+        {
+            for(uint8_t i=0; i<a._rows; ++i) {
+                for(uint8_t j=0; j<b._cols; ++j) {
+                    c._vals[i][j] = 0;
+                    for(uint8_t k=0; k<a._cols; ++k) {
+                        c._vals[i][j] += a._vals[i][k] *b._vals[k][j];
+                    }
+                }
+            }
+        }
+
+}; // class LegacyMatrix
+
+typedef hf::Matrix<STATE_DIM, STATE_DIM> covariance_t;
+typedef hf::Matrix<1, STATE_DIM> measurement_t;
+typedef hf::Matrix<STATE_DIM, 1> gain_t;
+typedef hf::Matrix<3, 3> block_t;
+
+// A flow sample: the nonzero measurement entries and the attitude error
+typedef struct {
+
+    float hxz, hxpx;
+    float hyz, hypy;
+    float d[3];
+
+} sample_t;
+
+// Symmetry, bounds, and measurement noise, as in stateEstimatorScalarUpdate()
+template <typename M>
+static void bound(M & Pm, const float * K, float R)
+{
+    for (int i=0; i<STATE_DIM; i++) {
+        for (int j=i; j<STATE_DIM; j++) {
+            float v = K ? K[i] * R * K[j] : 0;
+            float p = 0.5f*Pm.get(i,j) + 0.5f*Pm.get(j,i) + v;
+            if (std::isnan(p) || p > MAX_COVARIANCE) {
+                p = MAX_COVARIANCE;
+            } else if (i==j && p < MIN_COVARIANCE) {
+                p = MIN_COVARIANCE;
+            }
+            Pm.set(i,j, p);
+            Pm.set(j,i, p);
+        }
+    }
+}
+
+// The attitude rotation of finalize(), whole (a = STATE_D0) or
+// just its attitude block (a = 0)
+template <typename M>
+static void rotation(M & Am, const float * d, uint8_t a)
+{
+    for (int i=0; i<a; i++) {
+        Am.set(i,i, 1);
+    }
+
+    Am.set(a+0,a+0,  1 - d[1]*d[1]/2 - d[2]*d[2]/2);
+    Am.set(a+0,a+1,  d[2] + d[0]*d[1]/2);
+    Am.set(a+0,a+2, -d[1] + d[0]*d[2]/2);
+
+    Am.set(a+1,a+0, -d[2] + d[0]*d[1]/2);
+    Am.set(a+1,a+1,  1 - d[0]*d[0]/2 - d[2]*d[2]/2);
+    Am.set(a+1,a+2,  d[0] + d[1]*d[2]/2);
+
+    Am.set(a+2,a+0,  d[1] + d[0]*d[2]/2);
+    Am.set(a+2,a+1, -d[0] + d[1]*d[2]/2);
+    Am.set(a+2,a+2,  1 - d[0]*d[0]/2 - d[1]*d[1]/2);
+}
+
+class LegacyFilter {
+
+    private:
+
+        LegacyMatrix _Km    = LegacyMatrix(STATE_DIM, 1);
+        LegacyMatrix _HTm   = LegacyMatrix(STATE_DIM, 1);
+        LegacyMatrix _PHTm  = LegacyMatrix(STATE_DIM, 1);
+        LegacyMatrix _tmp1m = LegacyMatrix(STATE_DIM, STATE_DIM);
+        LegacyMatrix _tmp2m = LegacyMatrix(STATE_DIM, STATE_DIM);
+        LegacyMatrix _tmp3m = LegacyMatrix(STATE_DIM, STATE_DIM);
+        LegacyMatrix _Am    = LegacyMatrix(STATE_DIM, STATE_DIM);
+
+        void update(LegacyMatrix & Hm)
+        {
+            LegacyMatrix::trans(Hm, _HTm);
+            LegacyMatrix::mult(Pm, _HTm, _PHTm);
+
+            float R = STDDEV*STDDEV;
+            float HPHR = R;
+            for (int i=0; i<STATE_DIM; i++) {
+                HPHR += Hm.get(0,i)*_PHTm.get(i,0);
+            }
+
+            float K[STATE_DIM];
+            for (int i=0; i<STATE_DIM; i++) {
+                K[i] = _PHTm.get(i,0)/HPHR;
+                _Km.set(i,0, K[i]);
+            }
+
+            LegacyMatrix::mult(_Km, Hm, _tmp1m);
+            for (int i=0; i<STATE_DIM; i++) {
+                _tmp1m.set(i,i, _tmp1m.get(i,i)-1);
+            }
+            LegacyMatrix::trans(_tmp1m, _tmp2m);
+            LegacyMatrix::mult(_tmp1m, Pm, _tmp3m);
+            LegacyMatrix::mult(_tmp3m, _tmp2m, Pm);
+
+            bound(Pm, K, R);
+        }
+
+    public:
+
+        LegacyMatrix Pm = LegacyMatrix(STATE_DIM, STATE_DIM);
+
+        void step(const sample_t & s)
+        {
+            LegacyMatrix Hx(1, STATE_DIM);
+            Hx.set(0, STATE_Z,  s.hxz);
+            Hx.set(0, STATE_PX, s.hxpx);
+            update(Hx);
+
+            LegacyMatrix Hy(1, STATE_DIM);
+            Hy.set(0, STATE_Z,  s.hyz);
+            Hy.set(0, STATE_PY, s.hypy);
+            update(Hy);
+
+            rotation(_Am, s.d, STATE_D0);
+            LegacyMatrix::trans(_Am, _tmp1m);
+            LegacyMatrix::mult(_Am, Pm, _tmp2m);
+            LegacyMatrix::mult(_tmp2m, _tmp1m, Pm);
+
+            bound(Pm, NULL, 0);
+        }
+
+}; // class LegacyFilter
+
+class DenseFilter {
+
+    private:
+
+        gain_t _Km;
+        gain_t _PHTm;
+        covariance_t _tmp1m;
+        covariance_t _tmp2m;
+        covariance_t _Am;
+
+        void update(const measurement_t & Hm)
+        {
+            gain_t::multTrans(Pm, Hm, _PHTm);
+
+            float R = STDDEV*STDDEV;
+            float HPHR = R;
+            for (int i=0; i<STATE_DIM; i++) {
+                HPHR += Hm.get(0,i)*_PHTm.get(i,0);
+            }
+
+            float K[STATE_DIM];
+            for (int i=0; i<STATE_DIM; i++) {
+                K[i] = _PHTm.get(i,0)/HPHR;
+                _Km.set(i,0, K[i]);
+            }
+
+            covariance_t::mult(_Km, Hm, _tmp1m);
+            for (int i=0; i<STATE_DIM; i++) {
+                _tmp1m.set(i,i, _tmp1m.get(i,i)-1);
+            }
+            covariance_t::mult(_tmp1m, Pm, _tmp2m);
+            covariance_t::multTrans(_tmp2m, _tmp1m, Pm);
+
+            bound(Pm, K, R);
+        }
+
+    public:
+
+        covariance_t Pm;
+
+        void step(const sample_t & s)
+        {
+            measurement_t Hx;
+            Hx.set(0, STATE_Z,  s.hxz);
+            Hx.set(0, STATE_PX, s.hxpx);
+            update(Hx);
+
+            measurement_t Hy;
+            Hy.set(0, STATE_Z,  s.hyz);
+            Hy.set(0, STATE_PY, s.hypy);
+            update(Hy);
+
+            rotation(_Am, s.d, STATE_D0);
+            covariance_t::mult(_Am, Pm, _tmp2m);
+            covariance_t::multTrans(_tmp2m, _Am, Pm);
+
+            bound(Pm, NULL, 0);
+        }
+
+}; // class DenseFilter
+
+class SymmetricFilter {
+
+    private:
+
+        block_t _Am;
+        block_t _tmp1m;
+        block_t _tmp2m;
+
+        void update(const uint8_t * states, const float * derivs)
+        {
+            float PHT[STATE_DIM];
+            Pm.multSparse(states, derivs, 2, PHT);
+
+            float HPHR = STDDEV*STDDEV;
+            for (uint8_t m=0; m<2; m++) {
+                HPHR += derivs[m]*PHT[states[m]];
+            }
+
+            Pm.downdate(PHT, HPHR);
+            Pm.bound(MIN_COVARIANCE, MAX_COVARIANCE);
+        }
+
+    public:
+
+        hf::SymmetricMatrix<STATE_DIM> Pm;
+
+        void step(const sample_t & s)
+        {
+            const uint8_t xstates[2] = {STATE_Z, STATE_PX};
+            const float xderivs[2] = {s.hxz, s.hxpx};
+            update(xstates, xderivs);
+
+            const uint8_t ystates[2] = {STATE_Z, STATE_PY};
+            const float yderivs[2] = {s.hyz, s.hypy};
+            update(ystates, yderivs);
+
+            rotation(_Am, s.d, 0);
+
+            for (uint8_t i=0; i<STATE_D0; i++) {
+                float p[3] = {Pm.get(i,STATE_D0), Pm.get(i,STATE_D1), Pm.get(i,STATE_D2)};
+                for (uint8_t j=0; j<3; j++) {
+                    Pm.set(i, STATE_D0+j, _Am.get(j,0)*p[0] + _Am.get(j,1)*p[1] + _Am.get(j,2)*p[2]);
+                }
+            }
+
+            for (uint8_t j=0; j<3; j++) {
+                for (uint8_t k=0; k<3; k++) {
+                    _tmp1m.set(j, k, Pm.get(STATE_D0+j, STATE_D0+k));
+                }
+            }
+            block_t::mult(_Am, _tmp1m, _tmp2m);
+            block_t::multTrans(_tmp2m, _Am, _tmp1m);
+            for (uint8_t j=0; j<3; j++) {
+                for (uint8_t k=j; k<3; k++) {
+                    Pm.set(STATE_D0+j, STATE_D0+k, _tmp1m.get(j,k));
+                }
+            }
+
+            Pm.bound(MIN_COVARIANCE, MAX_COVARIANCE);
+        }
+
+}; // class SymmetricFilter
+
+template <typename M1, typename M2>
+static float difference(const M1 & a, const M2 & b)
+{
+    float diff = 0;
+
+    for (int i=0; i<STATE_DIM; i++) {
+        for (int j=0; j<STATE_DIM; j++) {
+            float d = fabsf(a.get(i,j) - b.get(i,j));
+            if (d > diff) {
+                diff = d;
+            }
+        }
+    }
+
+    return diff;
+}
+
+// Process noise between samples, so that the covariance doesn't collapse
+template <typename M>
+static void predict(M & Pm)
+{
+    for (int i=0; i<STATE_DIM; i++) {
+        Pm.set(i,i, Pm.get(i,i) + PROCESS_NOISE);
+    }
+}
+
+template <typename F>
+static void run(const char * name, F & filter, const sample_t * samples, uint32_t count)
+{
+    hf::CycleStats stats;
+
+    for (int i=0; i<STATE_DIM; i++) {
+        filter.Pm.set(i,i, 1);
+    }
+
+    for (uint32_t k=0; k<count; ++k) {
+
+        predict(filter.Pm);
+
+        uint64_t start = hf::Cycles::now();
+        filter.step(samples[k]);
+        stats.add(hf::Cycles::now() - start);
+    }
+
+    stats.print(name);
+}
+
+int main(int argc, char ** argv)
+{
+    uint32_t count = argc > 1 ? atoi(argv[1]) : 200000;
+
+    // Deterministic flow samples at 100 Hz, hovering near a metre
+    sample_t * samples = new sample_t[count];
+
+    for (uint32_t k=0; k<count; ++k) {
+        float t = k * 0.01f;
+        float z = 1 + 0.2f * sinf(t);
+        float vx = 0.5f * sinf(0.7f * t);
+        float vy = 0.5f * cosf(0.3f * t);
+        float scale = 30 * 0.01f / (4.2f * M_PI / 180);
+        sample_t & s = samples[k];
+        s.hxz = -scale * vx / (z*z);
+        s.hxpx = scale / z;
+        s.hyz = -scale * vy / (z*z);
+        s.hypy = scale / z;
+        s.d[0] = 1e-3f * sinf(3 * t);
+        s.d[1] = 1e-3f * cosf(5 * t);
+        s.d[2] = 5e-4f * sinf(2 * t);
+    }
+
+    LegacyFilter legacy;
+    DenseFilter dense;
+    SymmetricFilter symmetric;
+
+    printf("Optical-flow EKF covariance update per flow sample, %s\n", hf::Cycles::units());
+    hf::CycleStats::printHeader("matrix");
+
+    run("10x10 Matrix", legacy, samples, count);
+    run("Matrix<R,C>", dense, samples, count);
+    run("SymmetricMatrix", symmetric, samples, count);
+
+    // All must give the same covariance, to rounding
+    printf("%-18s largest covariance difference %g (Matrix<R,C>), %g (SymmetricMatrix)\n", "",
+            difference(legacy.Pm, dense.Pm), difference(legacy.Pm, symmetric.Pm));
+
+    delete[] samples;
+
+    return 0;
+}
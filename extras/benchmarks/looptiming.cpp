@@ -0,0 +1,217 @@
+/*
+   Loop-timing benchmark for Hackflight::update()
+
+   Runs the flight loop on the simulated board against a set of scripted
+   sensor/receiver traces and reports mean, median, 99th percentile and
+   worst-case cost of each stage of the loop and of each optional sensor.
+   The traces are deterministic, so runs are directly comparable.
+
+   Usage: looptiming [ITERATIONS]
+
+   Copyright (c) 2020 Simon D. Levy
+
+   This file is part of Hackflight.
+
+   Hackflight is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   Hackflight is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+   You should have received a copy of the GNU General Public License
+   along with Hackflight.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include "cycles.hpp"
+#include "../sim/simloop.hpp"
+#include "sensors/rangefinders/sim.hpp"
+#include "pidcontrollers/rate.hpp"
+#include "pidcontrollers/level.hpp"
+#include "pidcontrollers/althold.hpp"
+
+static const uint32_t LOOP_MICROS        = 125;   // 8 kHz loop
+static const uint32_t GYRO_MICROS        = 1000;  // 1 kHz gyro
+static const uint32_t QUATERNION_MICROS  = 5000;  // 200 Hz quaternion
+static const uint32_t RECEIVER_MICROS    = 11000; // DSMX frame rate
+static const uint32_t RANGEFINDER_MICROS = 10000; // 100 Hz time-of-flight
+static const uint32_t GCS_MICROS         = 15000; // GCS attitude polling
+
+static const float ARM_SECONDS      = 0.25f;
+static const float THROTTLE_SECONDS = 0.50f;
+
+static const uint8_t MAX_SENSORS = 8;
+
+// Collects one sample per bracketed stage --------------------------------------
+
+class BenchmarkTimer : public hf::StageTimer {
+
+    private:
+
+        uint64_t _start[STAGE_COUNT][MAX_SENSORS] = {{0}};
+
+    protected:
+
+        virtual void beginStage(uint8_t stage, uint8_t index) override
+        {
+            _start[stage][index] = hf::Cycles::now();
+        }
+
+        virtual void endStage(uint8_t stage, uint8_t index) override
+        {
+            stats[stage][index].add(hf::Cycles::now() - _start[stage][index]);
+        }
+
+    public:
+
+        hf::CycleStats stats[STAGE_COUNT][MAX_SENSORS];
+
+        // Cost of an empty bracket, i.e., the floor under every number we report
+        uint32_t overhead(void)
+        {
+            hf::CycleStats empty;
+            for (uint32_t k=0; k<10000; ++k) {
+                uint64_t start = hf::Cycles::now();
+                beginStage(STAGE_UPDATE, 0);
+                endStage(STAGE_UPDATE, 0);
+                empty.add(hf::Cycles::now() - start);
+            }
+            stats[STAGE_UPDATE][0].clear();
+            return empty.median();
+        }
+};
+
+// Scripted traces ---------------------------------------------------------------
+
+typedef struct {
+
+    const char * name;
+    bool armed;
+    bool althold;
+    bool rangefinder;
+    bool gcs;
+
+} trace_t;
+
+static const trace_t TRACES[] = {
+
+    // name        armed  althold range  gcs
+    { "idle",      false, false,  false, false },
+    { "hover",     true,  false,  false, false },
+    { "althold",   true,  true,   true,  false },
+    { "gcs",       true,  false,  false, true  },
+};
+
+// Deterministic noise so every run sees identical inputs
+static float noise(uint32_t & seed)
+{
+    seed = seed * 1664525u + 1013904223u;
+    return ((seed >> 8) / (float)(1<<24)) - 0.5f;
+}
+
+static void runTrace(const trace_t & trace, uint32_t iterations)
+{
+    hf::SimLoop sim(LOOP_MICROS);
+
+    hf::RatePid ratePid = hf::RatePid(0.225, 0.001875, 0.375, 1.0625, 0.005625f);
+    hf::LevelPid levelPid = hf::LevelPid(0.20f);
+    hf::AltitudeHoldPid altHoldPid = hf::AltitudeHoldPid(0.75f, 1.0f, 0.0f, 0.0f);
+    hf::SimRangefinder rangefinder;
+
+    BenchmarkTimer timer;
+
+    sim.begin();
+    sim.hackflight.addPidController(&levelPid);
+    sim.hackflight.addPidController(&ratePid);
+    if (trace.althold) {
+        sim.hackflight.addPidController(&altHoldPid, 1);
+    }
+    if (trace.rangefinder) {
+        sim.hackflight.addSensor(&rangefinder);
+    }
+    sim.hackflight.setStageTimer(&timer);
+
+    uint32_t overhead = timer.overhead();
+
+    uint32_t seed = 12345;
+
+    for (uint32_t i=0; i<iterations; ++i) {
+
+        uint32_t usec = sim.board.getMicros();
+        float t = usec / 1.e6f;
+
+        if (usec % RECEIVER_MICROS < LOOP_MICROS) {
+            bool armed = trace.armed && t > ARM_SECONDS;
+            bool flying = armed && t > THROTTLE_SECONDS;
+            sim.receiver.setChannel(hf::SimLoop::CHAN_THROTTLE, flying ? 0.1f * sinf(t) : -1);
+            sim.receiver.setChannel(hf::SimLoop::CHAN_ROLL,     flying ? 0.2f * sinf(2 * M_PI * t) : 0);
+            sim.receiver.setChannel(hf::SimLoop::CHAN_PITCH,    flying ? 0.2f * cosf(2 * M_PI * t) : 0);
+            sim.receiver.setChannel(hf::SimLoop::CHAN_YAW,      0);
+            sim.receiver.setChannel(hf::SimLoop::CHAN_AUX1,     armed ? +1 : -1);
+            sim.receiver.setChannel(hf::SimLoop::CHAN_AUX2,     trace.althold ? +1 : -1);
+        }
+
+        if (usec % GYRO_MICROS < LOOP_MICROS) {
+            sim.imu.setGyrometer(0.1f * noise(seed), 0.1f * noise(seed), 0.1f * noise(seed));
+        }
+
+        if (usec % QUATERNION_MICROS < LOOP_MICROS) {
+            float roll = 0.05f * noise(seed);
+            sim.imu.setQuaternion(cosf(roll/2), sinf(roll/2), 0, 0);
+        }
+
+        if (trace.rangefinder && usec % RANGEFINDER_MICROS < LOOP_MICROS) {
+            rangefinder.setDistance(1.0f + 0.01f * noise(seed));
+        }
+
+        if (trace.gcs && usec % GCS_MICROS < LOOP_MICROS) {
+            uint8_t request[6];
+            uint16_t count = hf::MspParser::serialize_ATTITUDE_RADIANS_Request(request);
+            sim.board.serialInject(request, count);
+            uint8_t reply[256];
+            sim.board.serialDrain(reply, sizeof(reply));
+        }
+
+        sim.step();
+    }
+
+    static const char * NAMES[hf::StageTimer::STAGE_COUNT] = {
+        "update", "receiver", "pidtask", "mixer", "gyrometer", "quaternion", "sensor", "serialtask"
+    };
+
+    printf("\nTrace '%s': %u iterations, %s per stage (timer overhead %u)\n",
+            trace.name, iterations, hf::Cycles::units(), overhead);
+    hf::CycleStats::printHeader("stage");
+
+    for (uint8_t stage=0; stage<hf::StageTimer::STAGE_COUNT; ++stage) {
+        if (stage == hf::StageTimer::STAGE_SENSOR) {
+            for (uint8_t k=0; k<MAX_SENSORS; ++k) {
+                char name[32];
+                snprintf(name, sizeof(name), "sensor[%d]", k);
+                timer.stats[stage][k].print(name);
+            }
+        }
+        else {
+            timer.stats[stage][0].print(NAMES[stage]);
+        }
+    }
+}
+
+int main(int argc, char ** argv)
+{
+    uint32_t iterations = argc > 1 ? atoi(argv[1]) : 200000;
+
+    printf("Hackflight loop timing (sensor[0] = quaternion, sensor[1] = gyrometer, sensor[2] = rangefinder)\n");
+
+    for (uint8_t k=0; k<sizeof(TRACES)/sizeof(trace_t); ++k) {
+        runTrace(TRACES[k], iterations);
+    }
+
+    return 0;
+}
@@ -0,0 +1,161 @@
+/*
+   Compares the cost of running the PID controllers through the runtime
+   pointer table (Hackflight::addPidController) and through a compile-time
+   PidChain, on the same altitude-hold trace
+
+   Usage: pidchain [ITERATIONS]
+
+   Copyright (c) 2020 Simon D. Levy
+
+   This file is part of Hackflight.
+
+   Hackflight is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   Hackflight is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+   You should have received a copy of the GNU General Public License
+   along with Hackflight.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include "cycles.hpp"
+#include "../sim/simloop.hpp"
+#include "pidchain.hpp"
+#include "pidcontrollers/rate.hpp"
+#include "pidcontrollers/level.hpp"
+#include "pidcontrollers/althold.hpp"
+
+static const uint32_t LOOP_MICROS       = 125;   // 8 kHz loop
+static const uint32_t GYRO_MICROS       = 1000;  // 1 kHz gyro
+static const uint32_t QUATERNION_MICROS = 5000;  // 200 Hz quaternion
+static const uint32_t RECEIVER_MICROS   = 11000; // DSMX frame rate
+
+static const float ARM_SECONDS      = 0.25f;
+static const float THROTTLE_SECONDS = 0.50f;
+
+// Times the PID task with the mixer taken out, i.e., just the controllers
+class ControllerTimer : public hf::StageTimer {
+
+    private:
+
+        uint64_t _taskStart = 0;
+        uint64_t _mixerStart = 0;
+        uint64_t _mixerCycles = 0;
+
+    protected:
+
+        virtual void beginStage(uint8_t stage, uint8_t index) override
+        {
+            (void)index;
+
+            if (stage == STAGE_PIDTASK) {
+                _mixerCycles = 0;
+                _taskStart = hf::Cycles::now();
+            }
+
+            if (stage == STAGE_MIXER) {
+                _mixerStart = hf::Cycles::now();
+            }
+        }
+
+        virtual void endStage(uint8_t stage, uint8_t index) override
+        {
+            (void)index;
+
+            uint64_t now = hf::Cycles::now();
+
+            if (stage == STAGE_MIXER) {
+                _mixerCycles = now - _mixerStart;
+            }
+
+            if (stage == STAGE_PIDTASK) {
+                stats.add(now - _taskStart - _mixerCycles);
+            }
+        }
+
+    public:
+
+        hf::CycleStats stats;
+};
+
+static void run(const char * name, bool chained, uint32_t iterations)
+{
+    hf::SimLoop sim(LOOP_MICROS);
+
+    hf::RatePid ratePid = hf::RatePid(0.225, 0.001875, 0.375, 1.0625, 0.005625f);
+    hf::LevelPid levelPid = hf::LevelPid(0.20f);
+    hf::AltitudeHoldPid altHoldPid = hf::AltitudeHoldPid(0.75f, 1.0f, 0.0f, 0.0f);
+
+    hf::PidChain<hf::LevelPid, hf::RatePid, hf::AltitudeHoldPid> chain(levelPid, ratePid, altHoldPid);
+
+    ControllerTimer timer;
+
+    sim.begin();
+
+    if (chained) {
+        chain.setAuxState(altHoldPid, 1);
+        sim.hackflight.setPidChain(&chain);
+    }
+    else {
+        sim.hackflight.addPidController(&levelPid);
+        sim.hackflight.addPidController(&ratePid);
+        sim.hackflight.addPidController(&altHoldPid, 1);
+    }
+
+    sim.hackflight.setStageTimer(&timer);
+
+    for (uint32_t i=0; i<iterations; ++i) {
+
+        uint32_t usec = sim.board.getMicros();
+        float t = usec / 1.e6f;
+
+        if (usec % RECEIVER_MICROS < LOOP_MICROS) {
+            bool armed = t > ARM_SECONDS;
+            bool flying = t > THROTTLE_SECONDS;
+            sim.receiver.setChannel(hf::SimLoop::CHAN_THROTTLE, flying ? 0.1f * sinf(t) : -1);
+            sim.receiver.setChannel(hf::SimLoop::CHAN_ROLL,     flying ? 0.2f * sinf(2 * M_PI * t) : 0);
+            sim.receiver.setChannel(hf::SimLoop::CHAN_PITCH,    flying ? 0.2f * cosf(2 * M_PI * t) : 0);
+            sim.receiver.setChannel(hf::SimLoop::CHAN_YAW,      0);
+            sim.receiver.setChannel(hf::SimLoop::CHAN_AUX1,     armed ? +1 : -1);
+            sim.receiver.setChannel(hf::SimLoop::CHAN_AUX2,     +1);
+        }
+
+        if (usec % GYRO_MICROS < LOOP_MICROS) {
+            sim.imu.setGyrometer(0.05f * sinf(2 * M_PI * 3 * t), 0.05f * cosf(2 * M_PI * 3 * t), 0);
+        }
+
+        if (usec % QUATERNION_MICROS < LOOP_MICROS) {
+            float roll = 0.05f * sinf(2 * M_PI * t);
+            sim.imu.setQuaternion(cosf(roll/2), sinf(roll/2), 0, 0);
+        }
+
+        sim.step();
+    }
+
+    timer.stats.print(name);
+
+    // Both paths must fly the same
+    printf("%-16s motors %.4f %.4f %.4f %.4f\n", "",
+            sim.motor(0).getValue(), sim.motor(1).getValue(), sim.motor(2).getValue(), sim.motor(3).getValue());
+}
+
+int main(int argc, char ** argv)
+{
+    uint32_t iterations = argc > 1 ? atoi(argv[1]) : 400000;
+
+    printf("Level + Rate + AltitudeHold controllers per PID update, %s, mixer excluded\n", hf::Cycles::units());
+    hf::CycleStats::printHeader("path");
+
+    run("runtime", false, iterations);
+    run("PidChain", true, iterations);
+
+    return 0;
+}
@@ -0,0 +1,192 @@
+#!/usr/bin/env python3
+'''
+Decodes a binary flight log written by the Recorder (src/recorder.hpp) and
+prints it as CSV, one row per PID record; input records, which are for
+replay (extras/sim/replay.cpp), are skipped
+
+Usage: decodelog.py LOGFILE [OUTFILE]
+
+Copyright (C) Simon D. Levy 2020
+
+This file is part of Hackflight.
+
+Hackflight is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as
+published by the Free Software Foundation, either version 3 of the
+License, or (at your option) any later version.
+This code is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with this code.  If not, see <http:#www.gnu.org/licenses/>.
+'''
+
+import struct
+import sys
+
+# Must match src/recorder.hpp
+VERSION = 2
+
+RECORD_DELTA  = 0
+RECORD_KEY    = 1
+RECORD_SCHEMA = 2
+RECORD_INPUT  = 3
+
+RECORD_MASK   = 0x03
+FLAG_ARMED    = 0x04
+FLAG_FAILSAFE = 0x08
+
+INPUT_SHIFT  = 2
+
+# Number of float32 values in each type of input record
+INPUT_VALUES = [0, 0, 8, 1, 3, 3, 4, 1, 2]
+
+SCALE_STATE    = 1e-3
+SCALE_ROTATION = 2e-4
+SCALE_DEMAND   = 1e-3
+SCALE_RAW      = 1e-3
+SCALE_MOTOR    = 1e-4
+
+STATE_NAMES = [
+        'location', 'rotation', 'angularVel', 'bodyAccel', 'bodyVel', 'inertialVel'
+        ]
+
+DEMAND_NAMES = ['throttle', 'roll', 'pitch', 'yaw']
+
+
+class LogError(Exception):
+    pass
+
+
+class Layout(object):
+
+    def __init__(self, nstages, nraw, nmotors):
+
+        self.names = []
+        self.scales = []
+
+        for name in STATE_NAMES:
+            for axis in 'xyz':
+                self.names.append('%s_%s' % (name, axis))
+                self.scales.append(SCALE_ROTATION if name == 'rotation' else SCALE_STATE)
+
+        for stage in range(nstages):
+            for name in DEMAND_NAMES:
+                self.names.append('stage%d_%s' % (stage, name))
+                self.scales.append(SCALE_DEMAND)
+
+        for k in range(nraw):
+            self.names.append('raw%d' % k)
+            self.scales.append(SCALE_RAW)
+
+        for k in range(nmotors):
+            self.names.append('m%d' % (k+1))
+            self.scales.append(SCALE_MOTOR)
+
+    def count(self):
+
+        return len(self.names)
+
+
+def records(data):
+    '''
+    Yields (layout, usec, armed, failsafe, values) for each KEY or DELTA record,
+    with values in physical units.  Time is the recorder's 32-bit microsecond
+    count, unwrapped.
+    '''
+
+    layout = None
+    counts = None
+    usec32 = 0
+    usec = None
+    pos = 0
+
+    while pos < len(data):
+
+        header = data[pos]
+        kind = header & RECORD_MASK
+        pos += 1
+
+        if kind == RECORD_INPUT:
+            inp = header >> INPUT_SHIFT
+            if inp >= len(INPUT_VALUES):
+                raise LogError('Bad input type %d at byte %d' % (inp, pos-1))
+            pos += 4 + 4*INPUT_VALUES[inp]
+            continue
+
+        if kind == RECORD_SCHEMA:
+            magic, version, nstages, nraw, nmotors = struct.unpack_from('<4sBBBB', data, pos)
+            if magic != b'HFLG':
+                raise LogError('Bad schema magic at byte %d' % (pos-1))
+            if version != VERSION:
+                raise LogError('Log version %d, decoder version %d' % (version, VERSION))
+            pos += 8
+            layout = Layout(nstages, nraw, nmotors)
+            counts = None
+            continue
+
+        if layout is None:
+            raise LogError('Record before schema at byte %d' % (pos-1))
+
+        n = layout.count()
+
+        if kind == RECORD_KEY:
+            stamp = struct.unpack_from('<I', data, pos)[0]
+            usec = stamp if usec is None else usec + ((stamp - usec32) & 0xFFFFFFFF)
+            usec32 = stamp
+            counts = list(struct.unpack_from('<%dh' % n, data, pos+4))
+            pos += 4 + 2*n
+
+        elif kind == RECORD_DELTA:
+            if counts is None:
+                raise LogError('Delta record before key at byte %d' % (pos-1))
+            dusec = struct.unpack_from('<H', data, pos)[0]
+            deltas = struct.unpack_from('<%db' % n, data, pos+2)
+            usec32 = (usec32 + dusec) & 0xFFFFFFFF
+            usec += dusec
+            counts = [c + d for c, d in zip(counts, deltas)]
+            pos += 2 + n
+
+        else:
+            raise LogError('Bad record type %d at byte %d' % (kind, pos-1))
+
+        values = [c * s for c, s in zip(counts, layout.scales)]
+
+        yield layout, usec, bool(header & FLAG_ARMED), bool(header & FLAG_FAILSAFE), values
+
+
+def main():
+
+    if len(sys.argv) < 2:
+        print('Usage: %s LOGFILE [OUTFILE]' % sys.argv[0])
+        exit(1)
+
+    data = open(sys.argv[1], 'rb').read()
+
+    out = open(sys.argv[2], 'w') if len(sys.argv) > 2 else sys.stdout
+
+    current = None
+
+    try:
+
+        for layout, usec, armed, failsafe, values in records(data):
+
+            # A new header whenever the layout changes
+            if layout is not current:
+                out.write(','.join(['time', 'armed', 'failsafe'] + layout.names) + '\n')
+                current = layout
+
+            out.write('%.6f,%d,%d,' % (usec / 1e6, armed, failsafe))
+            out.write(','.join('%g' % v for v in values) + '\n')
+
+    except (LogError, struct.error) as e:
+
+        sys.stderr.write('%s: %s\n' % (sys.argv[1], e))
+        exit(1)
+
+
+if __name__ == '__main__':
+
+    main()
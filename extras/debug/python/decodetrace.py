@@ -0,0 +1,147 @@
+#!/usr/bin/env python3
+'''
+Formats the binary Debugger::trace() messages sent to a sink set with
+Hackflight::setDebugSink() (see src/debugger.hpp)
+
+Usage: decodetrace.py TRACEFILE
+
+Copyright (C) Simon D. Levy 2020
+
+This file is part of Hackflight.
+
+Hackflight is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as
+published by the Free Software Foundation, either version 3 of the
+License, or (at your option) any later version.
+This code is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with this code.  If not, see <http:#www.gnu.org/licenses/>.
+'''
+
+import re
+import struct
+import sys
+
+# Must match src/debugger.hpp
+RECORD_FORMAT  = ord('F')
+RECORD_EVENT   = ord('E')
+RECORD_DROPPED = ord('D')
+
+ARG_INT      = 0
+ARG_UNSIGNED = 1
+ARG_FLOAT    = 2
+ARG_STRING   = 3
+
+# A C conversion, less the length modifiers that Python doesn't take
+CONVERSION = re.compile(r'%([-+ #0]*[0-9]*(?:\.[0-9]*)?)[hlLjzt]*([diouxXcsfFeEgGaA%])')
+
+
+class TraceError(Exception):
+    pass
+
+
+def convert(fmt, args):
+    '''
+    Formats args with the C format string fmt
+    '''
+
+    values = iter(args)
+
+    def substitute(match):
+
+        flags, conversion = match.groups()
+
+        if conversion == '%':
+            return '%'
+
+        value = next(values, None)
+
+        if value is None:
+            return ''
+
+        if conversion in 'ouxX' and value < 0:
+            value &= 0xFFFFFFFF
+
+        if conversion in 'diouxXc' and isinstance(value, float):
+            value = int(value)
+
+        if conversion in 'aA':
+            return float(value).hex()
+
+        return ('%' + flags + conversion) % value
+
+    return CONVERSION.sub(substitute, fmt)
+
+
+def messages(data):
+    '''
+    Yields each formatted message, and a note wherever events were dropped
+    '''
+
+    formats = {}
+    pos = 0
+
+    while pos < len(data):
+
+        kind = data[pos]
+
+        if kind == RECORD_FORMAT:
+            ident, length = data[pos+1], data[pos+2]
+            formats[ident] = data[pos+3:pos+3+length].decode('ascii', 'replace')
+            pos += 3 + length
+
+        elif kind == RECORD_EVENT:
+            ident, count = data[pos+1], data[pos+2]
+            pos += 3
+            args = []
+            for _ in range(count):
+                argtype = data[pos]
+                pos += 1
+                if argtype == ARG_STRING:
+                    length = data[pos]
+                    args.append(data[pos+1:pos+1+length].decode('ascii', 'replace'))
+                    pos += 1 + length
+                else:
+                    code = {ARG_INT: '<i', ARG_UNSIGNED: '<I', ARG_FLOAT: '<f'}.get(argtype)
+                    if code is None:
+                        raise TraceError('Bad argument type %d at byte %d' % (argtype, pos-1))
+                    args.append(struct.unpack_from(code, data, pos)[0])
+                    pos += 4
+            if ident not in formats:
+                raise TraceError('Event with undefined format %d at byte %d' % (ident, pos))
+            yield convert(formats[ident], args)
+
+        elif kind == RECORD_DROPPED:
+            yield '(%d events dropped so far)\n' % struct.unpack_from('<I', data, pos+1)[0]
+            pos += 5
+
+        else:
+            raise TraceError('Bad record type %d at byte %d' % (kind, pos))
+
+
+def main():
+
+    if len(sys.argv) < 2:
+        print('Usage: %s TRACEFILE' % sys.argv[0])
+        exit(1)
+
+    data = open(sys.argv[1], 'rb').read()
+
+    try:
+
+        for message in messages(data):
+            sys.stdout.write(message)
+
+    except (TraceError, struct.error, IndexError) as e:
+
+        sys.stderr.write('%s: %s\n' % (sys.argv[1], e))
+        exit(1)
+
+
+if __name__ == '__main__':
+
+    main()
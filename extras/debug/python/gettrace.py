@@ -0,0 +1,72 @@
+#!/usr/bin/env python3
+'''
+Uses MSPPG to drain stage-trace events from the flight controller
+
+Requires a sketch that installs a Tracer with Hackflight::setTracer().
+Prints one line per event: stage, index, begin, end, duration (in the
+board's cycle-count units).
+
+Copyright (C) Simon D. Levy 2020
+
+This file is part of Hackflight.
+
+Hackflight is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as 
+published by the Free Software Foundation, either version 3 of the 
+License, or (at your option) any later version.
+This code is distributed in the hope that it will be useful,     
+but WITHOUT ANY WARRANTY without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License 
+along with this code.  If not, see <http:#www.gnu.org/licenses/>.
+'''
+
+BAUD = 115200
+
+PORT = 'COM9'          # Windows
+#PORT = '/dev/ttyACM0' # Linux
+
+# Must match StageTimer::stage_t in src/stagetimer.hpp
+STAGES = ['update', 'receiver', 'pidtask', 'mixer', 'gyrometer', 'quaternion', 'sensor', 'serialtask']
+
+from msppg import Parser, serialize_TRACE_Request
+import serial
+from time import sleep
+from sys import stdout
+
+class TraceParser(Parser):
+
+    def handle_TRACE(self, count, s1, b1, e1, s2, b2, e2, s3, b3, e3, s4, b4, e4):
+
+        events = [(s1, b1, e1), (s2, b2, e2), (s3, b3, e3), (s4, b4, e4)]
+
+        for s, b, e in events[:count]:
+            b &= 0xFFFFFFFF
+            e &= 0xFFFFFFFF
+            print('%-10s %2d %10d %10d %8d' % (STAGES[s>>8], s&0xFF, b, e, (e-b) & 0xFFFFFFFF))
+
+        stdout.flush()
+        port.write(request)
+
+if __name__ == '__main__':
+
+    parser = TraceParser()
+    request = serialize_TRACE_Request()
+    port = serial.Serial(PORT, BAUD)
+
+    # Connecting causes reboot on ESP32
+    sleep(1)
+
+    port.write(request)
+
+    while True:
+
+        try:
+
+            parser.parse(port.read(1))
+
+        except KeyboardInterrupt:
+
+            break
@@ -30,6 +30,8 @@ CONNECTION_DELAY_MSEC  = 4000
 
 USB_UPDATE_MSEC = 200
 
+TELEMETRY_RATE_HZ = 50
+
 from comms import Comms
 from serial.tools.list_ports import comports
 import os
@@ -128,10 +130,6 @@ class GCS(msppg.Parser):
         # Create a message parser 
         #self.parser = msppg.Parser()
 
-        # Set up parser's request strings
-        self.attitude_request = msppg.serialize_ATTITUDE_RADIANS_Request()
-        self.rc_request = msppg.serialize_RC_NORMAL_Request()
-
         # No messages yet
         self.roll_pitch_yaw = [0]*3
         self.rxchannels = [0]*6
@@ -180,29 +178,17 @@ class GCS(msppg.Parser):
 
         self.root.after(delay_msec, task)
 
-    def handle_RC_NORMAL(self, c1, c2, c3, c4, c5, c6):
+    # The FC pushes telemetry once we've subscribed to it
+    def handle_TELEMETRY(self, roll, pitch, yaw, altitude, variometer, positionX, positionY, heading,
+            velocityForward, velocityRightward, c1, c2, c3, c4, c5, c6, m1, m2, m3, m4):
+
+        self.roll_pitch_yaw = roll, -pitch, yaw  
 
         # Display throttle as [0,1], other channels as [-1,+1]
         self.rxchannels = c1/2.+.5, c2, c3, c4, c5, c6
 
-        # As soon as we handle the callback from one request, send another request, if receiver dialog is running
-        if self.receiver.running:
-            self._send_rc_request()
-
-        #self.messages.setCurrentMessage('Receiver: %04d %04d %04d %04d %04d' % (c1, c2, c3, c4, c5))
-
-    def handle_ATTITUDE_RADIANS(self, x, y, z):
-
-        self.roll_pitch_yaw = x, -y, z  
-
         self.gotimu = True
 
-        #self.messages.setCurrentMessage('Roll/Pitch/Yaw: %+3.3f %+3.3f %+3.3f' % self.roll_pitch_yaw)
-
-        # As soon as we handle the callback from one request, send another request, if IMU dialog is running
-        if self.imu.running:
-            self._send_attitude_request()
-
     def _add_pane(self):
 
         pane = tk.PanedWindow(self.frame, bg=BACKGROUND_COLOR)
@@ -226,12 +212,11 @@ class GCS(msppg.Parser):
         #self.messages.stop()
         #self.maps.stop()
 
-        self._send_attitude_request()
         self.imu.start()
 
     def _start(self):
 
-        self._send_attitude_request()
+        self._subscribe(TELEMETRY_RATE_HZ)
         self.imu.start()
 
         self.gotimu = False
@@ -248,15 +233,10 @@ class GCS(msppg.Parser):
             self._disable_button(self.button_motors)
             self._disable_button(self.button_receiver)
 
-    # Sends Attitude request to FC
-    def _send_attitude_request(self):
-
-        self.comms.send_request(self.attitude_request)
-
-    # Sends RC request to FC
-    def _send_rc_request(self):
+    # Asks FC to push telemetry at a given rate; zero to stop
+    def _subscribe(self, rate):
 
-        self.comms.send_request(self.rc_request)
+        self.comms.send_message(msppg.serialize_SET_TELEMETRY_RATE, [rate])
 
     # Callback for Motors button
     def _motors_button_callback(self):
@@ -283,7 +263,6 @@ class GCS(msppg.Parser):
         #self.messages.stop()
         #self.maps.stop()
 
-        self._send_rc_request()
         self.receiver.start()
 
     # Callback for Messages button
@@ -329,6 +308,7 @@ class GCS(msppg.Parser):
 
             if not self.comms is None:
 
+                self._subscribe(0)
                 self.comms.stop()
 
             self._clear()
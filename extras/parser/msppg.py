@@ -61,6 +61,10 @@ class CodeEmitter(object):
 
         return self._paysize(argtypes)
 
+    def _fitsv1(self, message):
+
+        return message[0] < 256 and self._paysize(self._getargtypes(message)) < 256
+
     def _getargnames(self, message):
 
         return [argname for (argname,_) in self._getargs(message)]
@@ -131,16 +135,16 @@ class Python_Emitter(LocalCodeEmitter):
         for msgtype in msgdict.keys():
             msgstuff = msgdict[msgtype]
             msgid = msgstuff[0]
-            self._write(4*self.indent + ('if self.message_id == %d:\n\n' % msgstuff[0]))
-            self._write(5*self.indent + ('if self.message_direction == 0:\n\n'))
-            self._write(6*self.indent + 'self.handle_%s_Request()\n\n' % msgtype)
-            self._write(5*self.indent + 'else:\n\n')
-            self._write(6*self.indent + 'self.handle_%s(*struct.unpack(\'=' % msgtype)
+            self._write(2*self.indent + ('if self.message_id == %d:\n\n' % msgstuff[0]))
+            self._write(3*self.indent + ('if self.message_direction == 0:\n\n'))
+            self._write(4*self.indent + 'self.handle_%s_Request()\n\n' % msgtype)
+            self._write(3*self.indent + 'else:\n\n')
+            self._write(4*self.indent + 'self.handle_%s(*struct.unpack(\'=' % msgtype)
             for argtype in self._getargtypes(msgstuff):
                 self._write('%s' % self.type2pack[argtype])
             self._write("\'" + ', self.message_buffer))\n\n')
 
-        self._write(self._getsrc('bottom-py') + '\n')
+        self._write('\n')
 
         # Emit handler methods for parser
         for msgtype in msgdict.keys():
@@ -163,26 +167,42 @@ class Python_Emitter(LocalCodeEmitter):
             msgstuff = msgdict[msgtype]
             msgid = msgstuff[0]
 
-            self._write('def serialize_' + msgtype + '(' + ', '.join(self._getargnames(msgstuff)) + '):\n')
+            # MSPv1 only if the message fits it
+            if self._fitsv1(msgstuff):
+
+                self._write('def serialize_' + msgtype + '(' + ', '.join(self._getargnames(msgstuff)) + '):\n')
+                self._write(self.indent + "'''\n")
+                self._write(self.indent + 'Serializes the contents of a message of type ' + msgtype + '.\n')
+                self._write(self.indent + "'''\n")
+                self._write(self.indent + 'message_buffer = struct.pack(\'')
+                for argtype in self._getargtypes(msgstuff):
+                    self._write(self.type2pack[argtype])
+                self._write('\'')
+                for argname in self._getargnames(msgstuff):
+                    self._write(', ' + argname)
+                self._write(')\n\n')
+                self._write(self.indent)
+
+                self._write('if sys.version[0] == \'2\':\n')
+                self._write(self.indent*2 + 'msg = chr(len(message_buffer)) + chr(%s) + str(message_buffer)\n' % msgid)
+                self._write(self.indent*2 + 'return \'$M%c\' + msg + chr(_CRC8(msg))\n\n' % ('>' if msgid < 200 else '<'))
+                self._write(self.indent+'else:\n')
+                self._write(self.indent*2 + 'msg = [len(message_buffer), %s] + list(message_buffer)\n' % msgid)
+                self._write(self.indent*2 + 'return bytes([ord(\'$\'), ord(\'M\'), ord(\'<\')] + msg + [_CRC8(msg)])\n\n')
+
+            self._write('def serialize_' + msgtype + '_V2(' + ', '.join(self._getargnames(msgstuff)) + '):\n')
             self._write(self.indent + "'''\n")
-            self._write(self.indent + 'Serializes the contents of a message of type ' + msgtype + '.\n')
+            self._write(self.indent + 'Serializes the contents of a message of type ' + msgtype + ' in MSPv2.\n')
             self._write(self.indent + "'''\n")
-            self._write(self.indent + 'message_buffer = struct.pack(\'')
+            self._write(self.indent + 'message_buffer = struct.pack(\'<')
             for argtype in self._getargtypes(msgstuff):
                 self._write(self.type2pack[argtype])
             self._write('\'')
             for argname in self._getargnames(msgstuff):
                 self._write(', ' + argname)
             self._write(')\n\n')
-            self._write(self.indent)
-
-            self._write('if sys.version[0] == \'2\':\n')
-            self._write(self.indent*2 + 'msg = chr(len(message_buffer)) + chr(%s) + str(message_buffer)\n' % msgid)
-            self._write(self.indent*2 + 'return \'$M%c\' + msg + chr(_CRC8(msg))\n\n' % ('>' if msgid < 200 else '<'))
-            self._write(self.indent+'else:\n')
-            self._write(self.indent*2 + 'msg = [len(message_buffer), %s] + list(message_buffer)\n' % msgid)
-            self._write(self.indent*2 + 'return bytes([ord(\'$\'), ord(\'M\'), ord(\'<\')] + msg + [_CRC8(msg)])\n\n')
-
+            self._write(self.indent + 'msg = struct.pack(\'<BHH\', 0, %s, len(message_buffer)) + message_buffer\n' % msgid)
+            self._write(self.indent + 'return b\'$X%c\' + msg + bytes(bytearray([_CRC8_DVB_S2(msg)]))\n\n' % ('>' if msgid < 200 else '<'))
 
             if msgid < 200:
 
@@ -193,6 +213,13 @@ class Python_Emitter(LocalCodeEmitter):
                 self._write(self.indent+'msg = \'$M<\' + chr(0) + chr(%s) + chr(%s)\n' % (msgid, msgid))
                 self._write(self.indent+'return bytes(msg) if sys.version[0] == \'2\' else bytes(msg, \'utf-8\')\n\n')
 
+                self._write('def serialize_' + msgtype + '_Request_V2():\n\n')
+                self._write(self.indent + "'''\n")
+                self._write(self.indent + 'Serializes an MSPv2 request for ' + msgtype + ' data.\n')
+                self._write(self.indent + "'''\n")
+                self._write(self.indent + 'msg = struct.pack(\'<BHH\', 0, %s, 0)\n' % msgid)
+                self._write(self.indent + 'return b\'$X<\' + msg + bytes(bytearray([_CRC8_DVB_S2(msg)]))\n\n')
+
 
     def _write(self, s):
 
@@ -216,49 +243,104 @@ class HPP_Emitter(CodeEmitter):
         # Open file for appending
         self.output = open('../../src/mspparser.hpp', 'a')
 
-        # Add dispatchMessage() method
+        # Add payload structs, laid out as on the wire
 
-        self.output.write(3*self.indent + 'void dispatchMessage(void)\n')
-        self.output.write(3*self.indent + '{\n')
-        self.output.write(4*self.indent + 'switch (_command) {\n\n')
+        self.output.write(2*self.indent + 'public:\n\n')
+
+        # Add message IDs
+
+        self.output.write(3*self.indent + 'enum {\n')
+        for msgtype in msgdict.keys():
+            self.output.write(4*self.indent + 'ID_%s = %d,\n' % (msgtype, msgdict[msgtype][0]))
+        self.output.write(3*self.indent + '};\n\n')
+
+        self.output.write(3*self.indent + '// Message payloads, decoded and encoded in place\n\n')
 
         for msgtype in msgdict.keys():
 
             msgstuff = msgdict[msgtype]
-            msgid = msgstuff[0]
 
             argnames = self._getargnames(msgstuff)
             argtypes = self._getargtypes(msgstuff)
 
-            self.output.write(5*self.indent + ('case %s:\n' % msgdict[msgtype][0]))
-            self.output.write(5*self.indent + '{\n')
-            nargs = len(argnames)
+            # Fields must fall on their natural boundaries, so the struct has no
+            # padding and can be read and written in place
             offset = 0
-            for k in range(nargs):
-                argname = argnames[k]
-                argtype = argtypes[k]
-                decl = self.type2decl[argtype]
-                self.output.write(6*self.indent + decl  + ' ' + argname + ' = 0;\n')
-                if msgid >= 200:
-                    self.output.write(6*self.indent + 'memcpy(&%s,  &_inBuf[%d], sizeof(%s));\n\n' % (argname, offset, decl))
+            for argname,argtype in zip(argnames, argtypes):
+                if offset % self.type2size[argtype] != 0:
+                    error('Field %s of message %s is not aligned: reorder the fields' % (argname, msgtype))
                 offset += self.type2size[argtype]
-            self.output.write(6*self.indent + 'handle_%s%s(' % (msgtype, '_Request' if msgid<200 else ''))
-            for k in range(nargs):
-                self.output.write(argnames[k])
-                if k < nargs-1:
-                    self.output.write(', ')
-            self.output.write(');\n')
+            if offset > 0xFFFF:
+                error('Payload of message %s is too large' % msgtype)
+
+            self.output.write(3*self.indent + 'typedef struct __attribute__((may_alias)) {\n\n')
+            for argname,argtype in zip(argnames, argtypes):
+                self.output.write(4*self.indent + '%s %s;\n' % (self.type2decl[argtype], argname))
+            self.output.write('\n' + 3*self.indent + '} %s_payload_t;\n\n' % msgtype)
+
+        # Add a dispatch method for each message
+
+        self.output.write(2*self.indent + 'private:\n\n')
+
+        for msgtype in msgdict.keys():
+
+            msgstuff = msgdict[msgtype]
+            msgid = msgstuff[0]
+
+            argnames = self._getargnames(msgstuff)
+            argtypes = self._getargtypes(msgstuff)
+
+            self.output.write(3*self.indent + 'void dispatch_%s(void)\n' % msgtype)
+            self.output.write(3*self.indent + '{\n')
             if msgid < 200:
-                argtype = argtypes[0].capitalize() # XXX enforce uniform type for now
-                self.output.write(6*self.indent + ('prepareToSend%ss(%d);\n' % (argtype, nargs)))
-                for argname in argnames:
-                    self.output.write(6*self.indent + ('send%s(%s);\n' % (argtype, argname)))
-                self.output.write(6*self.indent + "serialize8(_checksum);\n")
-            self.output.write(6*self.indent + '} break;\n\n')
-
-        self.output.write(4*self.indent + '}\n')
+                paysize = self._paysize(argtypes)
+                self.output.write(4*self.indent + 
+                        'static_assert(REPLY_PAYLOAD + %d < OUTBUF_SIZE, "HACKFLIGHT_MSP_BUFFER too small for %s");\n' % (paysize, msgtype))
+                self.output.write(4*self.indent + 
+                        '%s_payload_t * payload = (%s_payload_t *)replyPayload(%d);\n' % (msgtype, msgtype, paysize))
+                self.output.write(4*self.indent + 'handle_%s_Request(' % msgtype)
+                self.output.write(', '.join(['payload->' + argname for argname in argnames]))
+                self.output.write(');\n')
+                self.output.write(4*self.indent + 'sendReply(%d, %d);\n' % (msgid, paysize))
+            else:
+                self.output.write(4*self.indent + 
+                        'static_assert(%d <= INBUF_SIZE, "HACKFLIGHT_MSP_BUFFER too small for %s");\n' % 
+                        (self._paysize(argtypes), msgtype))
+                self.output.write(4*self.indent + 
+                        'const %s_payload_t * payload = (const %s_payload_t *)_inBuf;\n' % (msgtype, msgtype))
+                self.output.write(4*self.indent + 'handle_%s(' % msgtype)
+                self.output.write(', '.join(['payload->' + argname for argname in argnames]))
+                self.output.write(');\n')
+            self.output.write(3*self.indent + '}\n\n')
+
+        # Add the table of messages for dispatchMessage() and push()
+
+        self.output.write(3*self.indent + 'static const message_t * lookup(uint16_t id)\n')
+        self.output.write(3*self.indent + '{\n')
+        self.output.write(4*self.indent + 'static const message_t messages[] = {\n')
+
+        for msgtype in msgdict.keys():
+
+            msgstuff = msgdict[msgtype]
+            msgid = msgstuff[0]
+
+            paysize = self._paysize(self._getargtypes(msgstuff))
+
+            self.output.write(5*self.indent + 
+                    '{%d, %d, %d, &MspParser::dispatch_%s},\n' % 
+                    (msgid, 0 if msgid < 200 else paysize, paysize if msgid < 200 else 0, msgtype))
+
+        self.output.write(4*self.indent + '};\n\n')
+        self.output.write(4*self.indent + 'for (uint8_t k=0; k<sizeof(messages)/sizeof(messages[0]); ++k) {\n')
+        self.output.write(5*self.indent + 'if (messages[k].id == id) {\n')
+        self.output.write(6*self.indent + 'return &messages[k];\n')
+        self.output.write(5*self.indent + '}\n')
+        self.output.write(4*self.indent + '}\n\n')
+        self.output.write(4*self.indent + 'return NULL;\n')
         self.output.write(3*self.indent + '}\n\n')
 
+        self.output.write(2*self.indent + 'protected:\n\n')
+
         # Add virtual declarations for handler methods
 
         for msgtype in msgdict.keys():
@@ -288,11 +370,13 @@ class HPP_Emitter(CodeEmitter):
             argnames = self._getargnames(msgstuff)
             argtypes = self._getargtypes(msgstuff)
 
+            msgsize = self._msgsize(argtypes)
+
             # Incoming messages
             if msgid < 200:
 
-                # Write request method
-                self.output.write(3*self.indent + 'static uint8_t serialize_%s_Request(uint8_t bytes[])\n' % msgtype)
+                # Write request methods
+                self.output.write(3*self.indent + 'static uint16_t serialize_%s_Request(uint8_t bytes[])\n' % msgtype)
                 self.output.write(3*self.indent + '{\n')
                 self.output.write(4*self.indent + 'bytes[0] = 36;\n')
                 self.output.write(4*self.indent + 'bytes[1] = 77;\n')
@@ -303,35 +387,64 @@ class HPP_Emitter(CodeEmitter):
                 self.output.write(4*self.indent + 'return 6;\n')
                 self.output.write(3*self.indent + '}\n\n')
 
-            # Add parser method for serializing message
-            self.output.write(3*self.indent + 'static uint8_t serialize_%s' % msgtype)
+                self.output.write(3*self.indent + 'static uint16_t serialize_%s_Request_V2(uint8_t bytes[])\n' % msgtype)
+                self.output.write(3*self.indent + '{\n')
+                self._write_v2_header(60, 0, msgid)
+                self.output.write(4*self.indent + 'bytes[8] = CRC8_DVB_S2(&bytes[3], 5);\n\n')
+                self.output.write(4*self.indent + 'return 9;\n')
+                self.output.write(3*self.indent + '}\n\n')
+
+            # Add parser method for serializing message in MSPv1, if it fits
+            if self._fitsv1(msgstuff):
+                self.output.write(3*self.indent + 'static uint16_t serialize_%s' % msgtype)
+                self._write_params(self.output, argtypes, argnames, '(uint8_t bytes[], ')
+                self.output.write('\n' + 3*self.indent + '{\n')
+                self.output.write(4*self.indent + 'bytes[0] = 36;\n')
+                self.output.write(4*self.indent + 'bytes[1] = 77;\n')
+                self.output.write(4*self.indent + 'bytes[2] = 62;\n')
+                self.output.write(4*self.indent + 'bytes[3] = %d;\n' % msgsize)
+                self.output.write(4*self.indent + 'bytes[4] = %d;\n\n' % msgid)
+                self._write_payload(argnames, argtypes, 5)
+                self.output.write(4*self.indent + 
+                        'bytes[%d] = CRC8(&bytes[3], %d);\n\n' % (msgsize+5, msgsize+2))
+                self.output.write(4*self.indent + 'return %d;\n'% (msgsize+6))
+                self.output.write(3*self.indent + '}\n\n')
+
+            # And in MSPv2
+            self.output.write(3*self.indent + 'static uint16_t serialize_%s_V2' % msgtype)
             self._write_params(self.output, argtypes, argnames, '(uint8_t bytes[], ')
             self.output.write('\n' + 3*self.indent + '{\n')
-            msgsize = self._msgsize(argtypes)
-            self.output.write(4*self.indent + 'bytes[0] = 36;\n')
-            self.output.write(4*self.indent + 'bytes[1] = 77;\n')
-            self.output.write(4*self.indent + 'bytes[2] = 62;\n')
-            self.output.write(4*self.indent + 'bytes[3] = %d;\n' % msgsize)
-            self.output.write(4*self.indent + 'bytes[4] = %d;\n\n' % msgid)
-            nargs = len(argnames)
-            offset = 5
-            for k in range(nargs):
-                argname = argnames[k]
-                argtype = argtypes[k]
-                decl = self.type2decl[argtype]
-                self.output.write(4*self.indent + 
-                        'memcpy(&bytes[%d], &%s, sizeof(%s));\n' %  (offset, argname, decl))
-                offset += self.type2size[argtype]
-            self.output.write('\n')
+            self._write_v2_header(62 if msgid < 200 else 60, msgsize, msgid)
+            self._write_payload(argnames, argtypes, 8)
             self.output.write(4*self.indent + 
-                    'bytes[%d] = CRC8(&bytes[3], %d);\n\n' % (msgsize+5, msgsize+2))
-            self.output.write(4*self.indent + 'return %d;\n'% (msgsize+6))
+                    'bytes[%d] = CRC8_DVB_S2(&bytes[3], %d);\n\n' % (msgsize+8, msgsize+5))
+            self.output.write(4*self.indent + 'return %d;\n'% (msgsize+9))
             self.output.write(3*self.indent + '}\n\n')
  
         self.output.write(self.indent + '}; // class MspParser\n\n')
         self.output.write('} // namespace hf\n')
         self.output.close()
 
+    def _write_v2_header(self, direction, msgsize, msgid):
+
+        self.output.write(4*self.indent + 'bytes[0] = 36;\n')
+        self.output.write(4*self.indent + 'bytes[1] = 88;\n')
+        self.output.write(4*self.indent + 'bytes[2] = %d;\n' % direction)
+        self.output.write(4*self.indent + 'bytes[3] = 0;\n')
+        self.output.write(4*self.indent + 'bytes[4] = %d;\n' % (msgid & 0xFF))
+        self.output.write(4*self.indent + 'bytes[5] = %d;\n' % (msgid >> 8))
+        self.output.write(4*self.indent + 'bytes[6] = %d;\n' % (msgsize & 0xFF))
+        self.output.write(4*self.indent + 'bytes[7] = %d;\n\n' % (msgsize >> 8))
+
+    def _write_payload(self, argnames, argtypes, offset):
+
+        for argname,argtype in zip(argnames, argtypes):
+            decl = self.type2decl[argtype]
+            self.output.write(4*self.indent + 
+                    'memcpy(&bytes[%d], &%s, sizeof(%s));\n' %  (offset, argname, decl))
+            offset += self.type2size[argtype]
+        self.output.write('\n')
+
 
 # Java emitter =======================================================================================
 
@@ -361,8 +474,8 @@ class Java_Emitter(CompileableCodeEmitter):
 
             if msgid < 200:
 
-                self._write(6*self.indent + 'case (byte)%d:\n' % msgid)
-                self._write(8*self.indent + 'this.handle_%s(\n' % msgtype)
+                self._write(3*self.indent + 'case %d:\n' % msgid)
+                self._write(4*self.indent + 'this.handle_%s(\n' % msgtype)
 
                 argnames = self._getargnames(msgstuff)
                 argtypes = self._getargtypes(msgstuff)
@@ -372,15 +485,15 @@ class Java_Emitter(CompileableCodeEmitter):
                 offset = 0
                 for k in range(nargs):
                     argtype = argtypes[k]
-                    self._write(8*self.indent + 'bb.get%s(%d)' % (self.type2bb[argtype], offset))
+                    self._write(5*self.indent + 'bb.get%s(%d)' % (self.type2bb[argtype], offset))
                     offset += self.type2size[argtype]
                     if k < nargs-1:
                         self._write(',\n')
                 self._write(');\n')
 
-                self._write(7*self.indent + 'break;\n\n')
+                self._write(4*self.indent + 'break;\n\n')
 
-        self._write(5*self.indent + '}\n' + 4*self.indent + '}\n' + 2*self.indent + '}\n' + self.indent + '}\n\n')
+        self._write(2*self.indent + '}\n' + self.indent + '}\n\n')
 
         for msgtype in msgdict.keys():
 
@@ -407,6 +520,20 @@ class Java_Emitter(CompileableCodeEmitter):
                 self._write(2*self.indent + 'return message;\n')
                 self._write(self.indent + '}\n\n')
 
+                self._write(self.indent + 'public byte [] serialize_%s_Request_V2() {\n\n' % msgtype)
+                self._write(2*self.indent + 'byte [] message = new byte[9];\n\n')
+                self._write(2*self.indent + 'message[0] = 36;\n')
+                self._write(2*self.indent + 'message[1] = 88;\n')
+                self._write(2*self.indent + 'message[2] = 60;\n')
+                self._write(2*self.indent + 'message[3] = 0;\n')
+                self._write(2*self.indent + 'message[4] = (byte)%d;\n' % (msgid & 0xFF))
+                self._write(2*self.indent + 'message[5] = (byte)%d;\n' % (msgid >> 8))
+                self._write(2*self.indent + 'message[6] = 0;\n')
+                self._write(2*self.indent + 'message[7] = 0;\n')
+                self._write(2*self.indent + 'message[8] = CRC8_DVB_S2(message, 3, 8);\n\n')
+                self._write(2*self.indent + 'return message;\n')
+                self._write(self.indent + '}\n\n')
+
                 # Write handler for replies from flight controller
                 self._write(self.indent + 'protected void handle_%s' % msgtype)
                 self._write_params(self.output, argtypes, argnames)
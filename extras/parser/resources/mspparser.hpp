@@ -27,6 +27,12 @@
 #include <stdint.h>
 #include <string.h>
 
+// Size of each of the parser's input and output buffers, bounding the MSPv2
+// payloads it can take and send
+#ifndef HACKFLIGHT_MSP_BUFFER
+#define HACKFLIGHT_MSP_BUFFER 128
+#endif
+
 namespace hf {
 
     class MspParser {
@@ -37,8 +43,16 @@ namespace hf {
 
         private:
 
-            static const int INBUF_SIZE  = 128;
-            static const int OUTBUF_SIZE = 128;
+            static const uint16_t INBUF_SIZE  = HACKFLIGHT_MSP_BUFFER;
+            static const uint16_t OUTBUF_SIZE = HACKFLIGHT_MSP_BUFFER;
+
+            // A reply is built in place in _outBuf, with its payload on a word
+            // boundary after the header: '$', 'M', '>', size, and command for
+            // MSPv1; '$', 'X', '>', flag, and 16-bit command and size for MSPv2.
+            // The checksum follows the payload.
+            static const uint8_t REPLY_PAYLOAD = 8;
+            static const uint8_t REPLY_START_V1 = REPLY_PAYLOAD - 5;
+            static const uint8_t REPLY_START_V2 = REPLY_PAYLOAD - 8;
 
             typedef enum serialState_t {
                 IDLE,
@@ -46,117 +60,148 @@ namespace hf {
                 HEADER_M,
                 HEADER_ARROW,
                 HEADER_SIZE,
-                HEADER_CMD
+                HEADER_CMD,
+                HEADER_X,
+                HEADER_V2_FLAG,
+                HEADER_V2_CMD_LO,
+                HEADER_V2_CMD_HI,
+                HEADER_V2_SIZE_LO,
+                HEADER_V2_SIZE_HI,
+                HEADER_V2_PAYLOAD
             } serialState_t;
 
+            // An entry in the table of messages
+            typedef struct {
+
+                uint16_t id;
+                uint16_t size;  // payload size of a command; zero for a request
+                uint16_t reply; // payload size of the reply to a request; zero for a command
+                void (MspParser::*dispatch)(void);
+
+            } message_t;
+
+            typedef uint32_t __attribute__((may_alias)) word_t;
+
             uint8_t _checksum;
-            uint8_t _inBuf[INBUF_SIZE];
-            uint8_t _inBufIndex;
-            uint8_t _outBuf[OUTBUF_SIZE];
-            uint8_t _outBufIndex;
-            uint8_t _outBufSize;
-            uint8_t _command;
-            uint8_t _offset;
-            uint8_t _dataSize;
+            alignas(4) uint8_t _inBuf[INBUF_SIZE];
+            alignas(4) uint8_t _outBuf[OUTBUF_SIZE];
+            uint16_t _outBufIndex;
+            uint16_t _outBufSize;
+            uint16_t _command;
+            uint16_t _offset;
+            uint16_t _dataSize;
             uint8_t _direction;
+            uint8_t _version;
 
             serialState_t  _state;
 
-            void serialize8(uint8_t a)
+            // Payload of the reply being built, zeroed for the request handler
+            uint8_t * replyPayload(uint16_t size)
             {
-                _outBuf[_outBufSize++] = a;
-                _checksum ^= a;
+                memset(&_outBuf[REPLY_PAYLOAD], 0, size);
+                return &_outBuf[REPLY_PAYLOAD];
             }
 
-            void serialize16(int16_t a)
+            // Adds the header and checksum to the payload at replyPayload(),
+            // replacing any reply not yet read.  The reply is in the version of
+            // the latest message received, except that a payload too large for
+            // MSPv1 goes in MSPv2.
+            void sendReply(uint16_t id, uint16_t size)
             {
-                serialize8(a & 0xFF);
-                serialize8((a >> 8) & 0xFF);
+                if (_version == 1 && size <= MAXMSG) {
+                    sendReplyV1(id, (uint8_t)size);
+                }
+                else {
+                    sendReplyV2(id, size);
+                }
             }
 
-            void serialize32(uint32_t a)
+            void sendReplyV1(uint16_t id, uint8_t size)
             {
-                serialize8(a & 0xFF);
-                serialize8((a >> 8) & 0xFF);
-                serialize8((a >> 16) & 0xFF);
-                serialize8((a >> 24) & 0xFF);
-            }
+                uint8_t * reply = &_outBuf[REPLY_START_V1];
+
+                reply[0] = '$';
+                reply[1] = 'M';
+                reply[2] = '>';
+                reply[3] = size;
+                reply[4] = (uint8_t)id;
+
+                // XOR the payload a word at a time, then fold the word
+                const word_t * words = (const word_t *)&_outBuf[REPLY_PAYLOAD];
+                word_t x = 0;
+                uint8_t k = 0;
+                for (; k<size/4; ++k) {
+                    x ^= words[k];
+                }
+                x ^= x >> 16;
+                x ^= x >> 8;
 
-            void headSerialResponse(uint8_t err, uint8_t s)
-            {
-                serialize8('$');
-                serialize8('M');
-                serialize8(err ? '!' : '>');
-                _checksum = 0;               // start calculating a new _checksum
-                serialize8(s);
-                serialize8(_command);
-            }
+                uint8_t checksum = (uint8_t)x ^ size ^ reply[4];
+                for (k*=4; k<size; ++k) {
+                    checksum ^= _outBuf[REPLY_PAYLOAD+k];
+                }
 
-            void headSerialReply(uint8_t s)
-            {
-                headSerialResponse(0, s);
-            }
+                _outBuf[REPLY_PAYLOAD+size] = checksum;
 
-            void prepareToSend(uint8_t count, uint8_t size)
-            {
-                _outBufSize = 0;
-                _outBufIndex = 0;
-                headSerialReply(count*size);
+                _outBufIndex = REPLY_START_V1;
+                _outBufSize = size + 6;
             }
 
-            void prepareToSendBytes(uint8_t count)
+            void sendReplyV2(uint16_t id, uint16_t size)
             {
-                prepareToSend(count, 1);
-            }
+                uint8_t * reply = &_outBuf[REPLY_START_V2];
+
+                reply[0] = '$';
+                reply[1] = 'X';
+                reply[2] = '>';
+                reply[3] = 0;
+                reply[4] = id & 0xFF;
+                reply[5] = id >> 8;
+                reply[6] = size & 0xFF;
+                reply[7] = size >> 8;
+
+                uint8_t crc = 0;
+                for (uint16_t k=3; k<REPLY_PAYLOAD+size; ++k) {
+                    crc = crc8_dvb_s2(crc, reply[k]);
+                }
 
-            void sendByte(uint8_t src)
-            {
-                serialize8(src);
-            }
+                _outBuf[REPLY_PAYLOAD+size] = crc;
 
-            void prepareToSendShorts(uint8_t count)
-            {
-                prepareToSend(count, 2);
+                _outBufIndex = REPLY_START_V2;
+                _outBufSize = size + 9;
             }
 
-            void sendShort(short src)
+            static uint8_t CRC8(uint8_t * data, int n) 
             {
-                int16_t a;
-                memcpy(&a, &src, 2);
-                serialize16(a);
-            }
+                uint8_t crc = 0x00;
 
-            void prepareToSendInts(uint8_t count)
-            {
-                prepareToSend(count, 4);
-            }
+                for (int k=0; k<n; ++k) {
 
-            void sendInt(int32_t src)
-            {
-                int32_t a;
-                memcpy(&a, &src, 4);
-                serialize32(a);
-            }
+                    crc ^= data[k];
+                }
 
-            void prepareToSendFloats(uint8_t count)
-            {
-                prepareToSend(count, 4);
+                return crc;
             }
 
-            void sendFloat(float src)
+            // MSPv2 checksum, updated with one byte
+            static uint8_t crc8_dvb_s2(uint8_t crc, uint8_t c)
             {
-                uint32_t a;
-                memcpy(&a, &src, 4);
-                serialize32(a);
+                crc ^= c;
+
+                for (uint8_t k=0; k<8; ++k) {
+                    crc = (crc & 0x80) ? (uint8_t)((crc << 1) ^ 0xD5) : (uint8_t)(crc << 1);
+                }
+
+                return crc;
             }
 
-            static uint8_t CRC8(uint8_t * data, int n) 
+            static uint8_t CRC8_DVB_S2(uint8_t * data, int n)
             {
                 uint8_t crc = 0x00;
 
                 for (int k=0; k<n; ++k) {
 
-                    crc ^= data[k];
+                    crc = crc8_dvb_s2(crc, data[k]);
                 }
 
                 return crc;
@@ -172,10 +217,11 @@ namespace hf {
                 _command = 0;
                 _offset = 0;
                 _dataSize = 0;
+                _version = 1;
                 _state = IDLE;
             }
             
-            uint8_t availableBytes(void)
+            uint16_t availableBytes(void)
             {
                 return _outBufSize;
             }
@@ -186,6 +232,54 @@ namespace hf {
                 return _outBuf[_outBufIndex++];
             }
 
+            // Reads all of the available bytes at once, without copying them
+            uint16_t readBytes(const uint8_t ** bytes)
+            {
+                uint16_t count = _outBufSize;
+
+                *bytes = &_outBuf[_outBufIndex];
+                _outBufIndex += count;
+                _outBufSize = 0;
+
+                return count;
+            }
+
+            // Bytes that push() would send for a message; zero if it isn't a request
+            uint16_t pushBytes(uint16_t id)
+            {
+                const message_t * message = lookup(id);
+
+                if (!message || message->reply == 0) {
+                    return 0;
+                }
+
+                return message->reply + ((_version == 1 && message->reply <= MAXMSG) ? 6 : 9);
+            }
+
+            // Sends the reply to a request message as though requested, replacing
+            // any reply not yet read; false if the message isn't a request
+            bool push(uint16_t id)
+            {
+                const message_t * message = lookup(id);
+
+                if (!message || message->reply == 0) {
+                    return false;
+                }
+
+                (this->*message->dispatch)();
+
+                return true;
+            }
+
+            void dispatchMessage(void)
+            {
+                const message_t * message = lookup(_command);
+
+                if (message && _dataSize >= message->size) {
+                    (this->*message->dispatch)();
+                }
+            }
+
             // returns true if reboot request, false otherwise
             bool parse(uint8_t c)
             {
@@ -199,7 +293,7 @@ namespace hf {
                         break;
 
                     case HEADER_START:
-                        _state = (c == 'M') ? HEADER_M : IDLE;
+                        _state = (c == 'M') ? HEADER_M : (c == 'X') ? HEADER_X : IDLE;
                         break;
 
                     case HEADER_M:
@@ -225,7 +319,6 @@ namespace hf {
                         _dataSize = c;
                         _offset = 0;
                         _checksum = 0;
-                        _inBufIndex = 0;
                         _checksum ^= c;
                         _state = HEADER_SIZE;      // the command is to follow
                         break;
@@ -242,6 +335,72 @@ namespace hf {
                             _inBuf[_offset++] = c;
                         } else  {
                             if (_checksum == c) {        // compare calculated and transferred _checksum
+                                _version = 1;
+                                dispatchMessage();
+                            }
+                            _state = IDLE;
+                        }
+                        break;
+
+                    // MSPv2: flag, command, and size, each checksummed, then the payload
+                    // and checksum
+
+                    case HEADER_X:
+                        switch (c) {
+                           case '>':
+                                _direction = 1;
+                                _state = HEADER_V2_FLAG;
+                                break;
+                            case '<':
+                                _direction = 0;
+                                _state = HEADER_V2_FLAG;
+                                break;
+                             default:
+                                _state = IDLE;
+                        }
+                        break;
+
+                    case HEADER_V2_FLAG:
+                        _checksum = crc8_dvb_s2(0, c);
+                        _state = HEADER_V2_CMD_LO;
+                        break;
+
+                    case HEADER_V2_CMD_LO:
+                        _command = c;
+                        _checksum = crc8_dvb_s2(_checksum, c);
+                        _state = HEADER_V2_CMD_HI;
+                        break;
+
+                    case HEADER_V2_CMD_HI:
+                        _command |= c << 8;
+                        _checksum = crc8_dvb_s2(_checksum, c);
+                        _state = HEADER_V2_SIZE_LO;
+                        break;
+
+                    case HEADER_V2_SIZE_LO:
+                        _dataSize = c;
+                        _checksum = crc8_dvb_s2(_checksum, c);
+                        _state = HEADER_V2_SIZE_HI;
+                        break;
+
+                    case HEADER_V2_SIZE_HI:
+                        _dataSize |= c << 8;
+                        if (_dataSize > INBUF_SIZE) {
+                            _state = IDLE;
+                            return false;
+                        }
+                        _offset = 0;
+                        _checksum = crc8_dvb_s2(_checksum, c);
+                        _state = HEADER_V2_PAYLOAD;
+                        break;
+
+                    case HEADER_V2_PAYLOAD:
+                        if (_offset < _dataSize) {
+                            _checksum = crc8_dvb_s2(_checksum, c);
+                            _inBuf[_offset++] = c;
+                        } else  {
+                            if (_checksum == c) {
+                                _version = 2;
                                 dispatchMessage();
                             }
                             _state = IDLE;
@@ -0,0 +1,272 @@
+/*
+   Batch PID gain tuning on the software-in-the-loop simulator: flies the
+   StepTest for a grid of rate, level, and altitude-hold gains, one complete
+   Hackflight + SimVehicle pair per candidate, spread over all CPU cores,
+   then optionally refines the best candidate by pattern search.  Candidates
+   are ranked by a score that adds up the settled error, overshoot, and
+   settling time of each step, the altitude-hold error, and the motor
+   saturation.
+
+   Usage: gainsweep [THREADS] [ROUNDS]
+
+   THREADS defaults to the number of cores, as does 0; ROUNDS is the number
+   of pattern-search rounds after the grid (default 0).
+
+   Copyright (c) 2020 Simon D. Levy
+
+   This file is part of Hackflight.
+
+   Hackflight is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   Hackflight is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+   You should have received a copy of the GNU General Public License
+   along with Hackflight.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <algorithm>
+
+#include "steptest.hpp"
+
+typedef struct {
+
+    hf::StepTest::gains_t   gains;
+    hf::StepTest::results_t results;
+    float                   score;
+
+} candidate_t;
+
+static const float CRASH_SCORE = 1e6;
+
+// Lower is better; each term is around one for a poor but flyable response
+static float score(const hf::StepTest::results_t & results)
+{
+    if (results.crashed) {
+        return CRASH_SCORE;
+    }
+
+    float s = 0;
+
+    for (uint8_t k=0; k<hf::StepTest::NAXES; ++k) {
+        const hf::StepResponse::metrics_t & m = results.steps[k];
+        s += fabsf(m.error) + m.overshoot + m.settlingTime / hf::StepTest::STEP_SECONDS;
+    }
+
+    // Meters
+    s += results.holdError;
+
+    s += results.saturation;
+
+    return s;
+}
+
+// Flies every candidate, each worker taking the next unflown one
+static void flyAll(std::vector<candidate_t> & candidates, unsigned nthreads)
+{
+    std::atomic<size_t> next(0);
+
+    auto worker = [&candidates, &next](void) {
+
+        // One test object per thread; each run builds its own vehicle
+        hf::StepTest * test = new hf::StepTest();
+
+        for (size_t k=next++; k<candidates.size(); k=next++) {
+            candidates[k].results = test->run(candidates[k].gains);
+            candidates[k].score = score(candidates[k].results);
+        }
+
+        delete test;
+    };
+
+    std::vector<std::thread> threads;
+
+    for (unsigned k=0; k<nthreads; ++k) {
+        threads.push_back(std::thread(worker));
+    }
+
+    for (std::thread & thread : threads) {
+        thread.join();
+    }
+}
+
+static bool better(const candidate_t & a, const candidate_t & b)
+{
+    return a.score < b.score;
+}
+
+// Gains varied by the grid and the pattern search
+static const uint8_t NTUNED = 7;
+
+static float & tuned(hf::StepTest::gains_t & g, uint8_t index)
+{
+    float * gains[NTUNED] = {
+        &g.rateKp, &g.rateKd, &g.rateKpYaw, &g.levelKp, &g.altholdKpPos, &g.altholdKpVel, &g.altholdKdVel
+    };
+
+    return *gains[index];
+}
+
+static void makeGrid(std::vector<candidate_t> & candidates)
+{
+    static const float rateKp[]   = {0.10f, 0.225f, 0.40f};
+    static const float rateKd[]   = {0.10f, 0.375f, 0.60f};
+    static const float levelKp[]  = {0.20f, 0.50f, 1.00f, 2.00f};
+    static const float altKpPos[] = {0.50f, 1.00f};
+    static const float altKpVel[] = {0.15f, 0.30f, 0.60f};
+
+    for (float kp : rateKp) {
+        for (float kd : rateKd) {
+            for (float level : levelKp) {
+                for (float pos : altKpPos) {
+                    for (float vel : altKpVel) {
+                        candidate_t c = {};
+                        c.gains = hf::StepTest::defaultGains();
+                        c.gains.rateKp = kp;
+                        c.gains.rateKd = kd;
+                        c.gains.levelKp = level;
+                        c.gains.altholdKpPos = pos;
+                        c.gains.altholdKpVel = vel;
+                        candidates.push_back(c);
+                    }
+                }
+            }
+        }
+    }
+}
+
+// Pattern search: try scaling each tuned gain up and down by the step factor,
+// move to the best neighbor, and shrink the step when none is better
+static candidate_t refine(candidate_t best, unsigned rounds, unsigned nthreads, unsigned & flights)
+{
+    float factor = 1.5f;
+
+    for (unsigned round=0; round<rounds; ++round) {
+
+        std::vector<candidate_t> neighbors;
+
+        for (uint8_t k=0; k<NTUNED; ++k) {
+            for (int8_t dir=-1; dir<=1; dir+=2) {
+                candidate_t c = best;
+                tuned(c.gains, k) *= dir > 0 ? factor : 1/factor;
+                neighbors.push_back(c);
+            }
+        }
+
+        flyAll(neighbors, nthreads);
+        flights += neighbors.size();
+
+        candidate_t & champion = *std::min_element(neighbors.begin(), neighbors.end(), better);
+
+        if (champion.score < best.score) {
+            best = champion;
+        }
+        else {
+            factor = sqrtf(factor);
+        }
+
+        printf("Round %2u: score %.3f, step x%.3f\n", round+1, best.score, factor);
+    }
+
+    return best;
+}
+
+static void printHeader(void)
+{
+    printf("%7s %7s %7s %7s %7s %7s %7s  %7s  %14s %14s %14s %7s %6s\n",
+            "rateKp", "rateKd", "yawKp", "levelKp", "altPos", "altVel", "altKd",
+            "score", "roll err/os/ts", "pitch err/os/ts", "yaw err/os/ts", "hold", "sat");
+}
+
+static void printCandidate(const candidate_t & c)
+{
+    const hf::StepTest::gains_t & g = c.gains;
+
+    printf("%7.3f %7.3f %7.3f %7.3f %7.3f %7.3f %7.3f  ",
+            g.rateKp, g.rateKd, g.rateKpYaw, g.levelKp, g.altholdKpPos, g.altholdKpVel, g.altholdKdVel);
+
+    if (c.results.crashed) {
+        printf("%7s\n", "crash");
+        return;
+    }
+
+    printf("%7.3f ", c.score);
+
+    for (uint8_t k=0; k<hf::StepTest::NAXES; ++k) {
+        const hf::StepResponse::metrics_t & m = c.results.steps[k];
+        printf(" %4.0f%%/%3.0f%%/%3.1fs", 100 * m.error, 100 * m.overshoot, m.settlingTime);
+    }
+
+    printf(" %6.2fm %5.1f%%\n", c.results.holdError, 100 * c.results.saturation);
+}
+
+int main(int argc, char ** argv)
+{
+    unsigned nthreads = argc > 1 ? atoi(argv[1]) : 0;
+    unsigned rounds   = argc > 2 ? atoi(argv[2]) : 0;
+
+    if (nthreads == 0) {
+        nthreads = std::max(std::thread::hardware_concurrency(), 1u);
+    }
+
+    std::vector<candidate_t> candidates;
+
+    // The stock gains go first so that they can be compared with the rest
+    candidate_t baseline = {};
+    baseline.gains = hf::StepTest::defaultGains();
+    candidates.push_back(baseline);
+
+    makeGrid(candidates);
+
+    printf("Flying %zu candidates on %u threads\n", candidates.size(), nthreads);
+
+    auto start = std::chrono::steady_clock::now();
+
+    flyAll(candidates, nthreads);
+
+    unsigned flights = candidates.size();
+
+    baseline = candidates[0];
+
+    std::sort(candidates.begin(), candidates.end(), better);
+
+    candidate_t best = refine(candidates[0], rounds, nthreads, flights);
+
+    double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    unsigned crashes = 0;
+    for (const candidate_t & c : candidates) {
+        crashes += c.results.crashed ? 1 : 0;
+    }
+
+    printf("%u flights of %.0f simulated seconds in %.2f wall seconds (%.0f flights/sec), %u grid crashes\n\n",
+            flights, hf::StepTest::END_SECONDS, wall, wall > 0 ? flights / wall : 0, crashes);
+
+    printHeader();
+
+    printf("\nStock gains:\n");
+    printCandidate(baseline);
+
+    printf("\nBest of grid:\n");
+    for (size_t k=0; k<candidates.size() && k<10; ++k) {
+        printCandidate(candidates[k]);
+    }
+
+    if (rounds > 0) {
+        printf("\nAfter %u rounds of pattern search:\n", rounds);
+        printCandidate(best);
+    }
+
+    return 0;
+}
@@ -0,0 +1,208 @@
+/*
+   Runs the Hackflight flight loop on a host computer against a scripted
+   flight, as fast as the host allows
+
+   Usage: hfsim [SIMULATED_SECONDS] [trace] [gyrosync]
+
+   With "trace", the stage trace of the last few loop iterations is dumped
+   at the end of the run.  With "gyrosync", each gyro sample runs the rate
+   controller and mixer directly, as a data-ready interrupt would.
+
+   Copyright (c) 2020 Simon D. Levy
+
+   This file is part of Hackflight.
+
+   Hackflight is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   Hackflight is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+   You should have received a copy of the GNU General Public License
+   along with Hackflight.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <chrono>
+
+#include "simloop.hpp"
+#include "pidcontrollers/rate.hpp"
+#include "pidcontrollers/level.hpp"
+
+static const uint32_t LOOP_MICROS       = 125;   // 8 kHz loop
+static const uint32_t GYRO_MICROS       = 1000;  // 1 kHz gyro
+static const uint32_t QUATERNION_MICROS = 5000;  // 200 Hz quaternion
+static const uint32_t RECEIVER_MICROS   = 11000; // DSMX frame rate
+
+static const uint8_t TRACE_ITERATIONS = 8;
+
+// Virtual time from a gyro sample to the first motor write after it; samples
+// that arrive before that write are counted with the first one
+class LatencyStats {
+
+    private:
+
+        uint32_t _sampleMicros = 0;
+        bool     _pending = false;
+        uint32_t _writes = 0;
+
+        uint32_t _count = 0;
+        uint64_t _total = 0;
+        uint32_t _max = 0;
+
+    public:
+
+        void sample(uint32_t usec)
+        {
+            if (_pending) return;
+
+            _sampleMicros = usec;
+            _pending = true;
+        }
+
+        void check(hf::SimLoop & sim)
+        {
+            uint32_t writes = sim.motor(0).getWriteCount();
+
+            if (_pending && writes != _writes) {
+                uint32_t latency = sim.board.getMicros() - _sampleMicros;
+                _total += latency;
+                if (latency > _max) {
+                    _max = latency;
+                }
+                _count++;
+                _pending = false;
+            }
+
+            _writes = writes;
+        }
+
+        void print(void)
+        {
+            printf("Gyro-to-motor:     mean %.0f usec, max %u usec (%u samples)\n",
+                    _count ? (double)_total / _count : 0, _max, _count);
+        }
+
+}; // class LatencyStats
+
+static const float ARM_SECONDS      = 0.5f;
+static const float THROTTLE_SECONDS = 1.0f;
+
+// Disarmed until ARM_SECONDS, then hover throttle with a slow roll/pitch sweep
+static void flightScript(hf::SimLoop & sim, float t)
+{
+    float aux1 = t < ARM_SECONDS ? -1 : +1;
+    float throttle = t < THROTTLE_SECONDS ? -1 : 0;
+    float roll  = t < THROTTLE_SECONDS ? 0 : 0.2f * sinf(2 * M_PI * 0.5f * t);
+    float pitch = t < THROTTLE_SECONDS ? 0 : 0.2f * cosf(2 * M_PI * 0.5f * t);
+
+    sim.receiver.setChannel(hf::SimLoop::CHAN_THROTTLE, throttle);
+    sim.receiver.setChannel(hf::SimLoop::CHAN_ROLL,     roll);
+    sim.receiver.setChannel(hf::SimLoop::CHAN_PITCH,    pitch);
+    sim.receiver.setChannel(hf::SimLoop::CHAN_YAW,      0);
+    sim.receiver.setChannel(hf::SimLoop::CHAN_AUX1,     aux1);
+    sim.receiver.setChannel(hf::SimLoop::CHAN_AUX2,     -1);
+}
+
+int main(int argc, char ** argv)
+{
+    float seconds = argc > 1 ? atof(argv[1]) : 60;
+    bool trace = false;
+    bool gyrosync = false;
+
+    for (int k=2; k<argc; ++k) {
+        trace    = trace    || !strcmp(argv[k], "trace");
+        gyrosync = gyrosync || !strcmp(argv[k], "gyrosync");
+    }
+
+    hf::SimLoop sim(LOOP_MICROS);
+
+    hf::RatePid ratePid = hf::RatePid(0.225, 0.001875, 0.375, 1.0625, 0.005625f);
+    hf::LevelPid levelPid = hf::LevelPid(0.20f);
+
+    sim.begin();
+    // Inner loop at gyro rate, level loop at quaternion rate
+    sim.hackflight.setPidFrequency(1e6f / GYRO_MICROS);
+    sim.hackflight.addPidController(&levelPid, 0, 1e6f / QUATERNION_MICROS);
+    if (gyrosync) {
+        sim.hackflight.setGyroSynchronous(&ratePid);
+    }
+    else {
+        sim.hackflight.addPidController(&ratePid);
+    }
+
+    LatencyStats latency;
+
+    hf::Tracer tracer(&sim.board);
+    if (trace) {
+        sim.hackflight.setTracer(&tracer);
+    }
+
+    uint32_t endMicros = (uint32_t)(seconds * 1e6);
+
+    auto start = std::chrono::steady_clock::now();
+
+    uint32_t traceMicros = endMicros - TRACE_ITERATIONS * LOOP_MICROS;
+
+    while (sim.board.getMicros() < endMicros) {
+
+        // Keep only the final iterations in the trace
+        if (sim.board.getMicros() == traceMicros) {
+            tracer.clear();
+        }
+
+        uint32_t usec = sim.board.getMicros();
+        float t = usec / 1.e6f;
+
+        if (usec % RECEIVER_MICROS < LOOP_MICROS) {
+            flightScript(sim, t);
+        }
+
+        if (usec % GYRO_MICROS < LOOP_MICROS) {
+            sim.imu.setGyrometer(0.05f * sinf(2 * M_PI * 3 * t), 0.05f * cosf(2 * M_PI * 3 * t), 0);
+            if (t > THROTTLE_SECONDS) {
+                latency.sample(usec);
+            }
+            sim.hackflight.gyroInterrupt();
+            latency.check(sim);
+        }
+
+        if (usec % QUATERNION_MICROS < LOOP_MICROS) {
+            sim.imu.setQuaternion(1, 0, 0, 0);
+        }
+
+        sim.step();
+
+        latency.check(sim);
+    }
+
+    double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    printf("Iterations:        %u\n", sim.getIterations());
+    printf("Simulated seconds: %.3f\n", sim.getSeconds());
+    printf("Wall seconds:      %.3f\n", wall);
+    printf("Speedup:           %.0fx real time\n", wall > 0 ? sim.getSeconds() / wall : 0);
+    printf("Armed LED:         %s\n", sim.board.ledArmed() ? "on" : "off");
+
+    latency.print();
+
+    for (uint8_t k=0; k<hf::SimLoop::NMOTORS; ++k) {
+        printf("Motor %d:           %.3f (%u writes)\n", k+1, sim.motor(k).getValue(), sim.motor(k).getWriteCount());
+    }
+
+    printf("\nTimer tasks:\n");
+    sim.hackflight.getScheduler()->printStats();
+
+    if (trace) {
+        printf("\nStage trace (%s) for the last %d iterations:\n", "host CPU cycles", TRACE_ITERATIONS);
+        tracer.dump();
+    }
+
+    return 0;
+}
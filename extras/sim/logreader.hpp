@@ -0,0 +1,341 @@
+/*
+   Reads the records of a binary flight log written by the Recorder, on the
+   host.  The bytes can be appended while reading, so a log can be decoded as
+   it is recorded.
+
+   Copyright (c) 2020 Simon D. Levy
+
+   This file is part of Hackflight.
+
+   Hackflight is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   Hackflight is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+   You should have received a copy of the GNU General Public License
+   along with Hackflight.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+
+#include "recorder.hpp"
+
+namespace hf {
+
+    class LogReader {
+
+        public:
+
+            typedef enum {
+                ENTRY_RECORD,   // a PID update: state, demands, raw channels, motors
+                ENTRY_INPUT     // a sensor or receiver reading
+            } kind_t;
+
+            typedef struct {
+
+                uint8_t kind;
+
+                // Unwrapped from the log's 32-bit stamps
+                uint64_t usec;
+
+                // ENTRY_RECORD: quantized channels (see Recorder), and their values
+                bool armed;
+                bool failsafe;
+                uint8_t count;
+                int16_t counts[Recorder::MAX_CHANNELS];
+                float values[Recorder::MAX_CHANNELS];
+
+                // ENTRY_INPUT: Recorder::input_t, with count values
+                uint8_t input;
+                float inputs[Recorder::MAX_INPUT_VALUES];
+
+            } entry_t;
+
+        private:
+
+            std::vector<uint8_t> _data;
+            size_t _pos = 0;
+
+            // Layout from the latest schema
+            bool _haveSchema = false;
+            uint8_t _nstages = 0;
+            uint8_t _nraw = 0;
+            uint8_t _nmotors = 0;
+            uint8_t _nchannels = 0;
+            float _scales[Recorder::MAX_CHANNELS] = {0};
+
+            // Latest KEY or DELTA values
+            bool _haveKey = false;
+            int16_t _counts[Recorder::MAX_CHANNELS] = {0};
+            uint32_t _recordUsec32 = 0;
+
+            // Latest stamp of any kind, for unwrapping
+            bool _haveTime = false;
+            uint32_t _usec32 = 0;
+            uint64_t _usec = 0;
+
+            const char * _error = NULL;
+            size_t _errorPos = 0;
+
+            uint16_t get16(size_t pos)
+            {
+                return _data[pos] | (_data[pos+1] << 8);
+            }
+
+            uint32_t get32(size_t pos)
+            {
+                return get16(pos) | ((uint32_t)get16(pos+2) << 16);
+            }
+
+            uint64_t unwrap(uint32_t stamp)
+            {
+                _usec = _haveTime ? _usec + (uint32_t)(stamp - _usec32) : stamp;
+                _usec32 = stamp;
+                _haveTime = true;
+
+                return _usec;
+            }
+
+            bool fail(const char * error)
+            {
+                _error = error;
+                _errorPos = _pos;
+
+                return false;
+            }
+
+            void setLayout(uint8_t nstages, uint8_t nraw, uint8_t nmotors)
+            {
+                _nstages = nstages;
+                _nraw = nraw;
+                _nmotors = nmotors;
+                _nchannels = Recorder::STATE_CHANNELS + 4*nstages + nraw + nmotors;
+
+                uint8_t channel = 0;
+
+                for (uint8_t k=0; k<Recorder::STATE_CHANNELS; ++k) {
+                    _scales[channel++] = k/3 == 1 ? Recorder::SCALE_ROTATION : Recorder::SCALE_STATE;
+                }
+                for (uint8_t k=0; k<4*nstages; ++k) {
+                    _scales[channel++] = Recorder::SCALE_DEMAND;
+                }
+                for (uint8_t k=0; k<nraw; ++k) {
+                    _scales[channel++] = Recorder::SCALE_RAW;
+                }
+                for (uint8_t k=0; k<nmotors; ++k) {
+                    _scales[channel++] = Recorder::SCALE_MOTOR;
+                }
+
+                _haveSchema = true;
+                _haveKey = false;
+            }
+
+            bool record(uint8_t header, entry_t & entry)
+            {
+                entry.kind = ENTRY_RECORD;
+                entry.usec = unwrap(_recordUsec32);
+                entry.armed = header & Recorder::FLAG_ARMED;
+                entry.failsafe = header & Recorder::FLAG_FAILSAFE;
+                entry.count = _nchannels;
+
+                for (uint8_t k=0; k<_nchannels; ++k) {
+                    entry.counts[k] = _counts[k];
+                    entry.values[k] = _counts[k] * _scales[k];
+                }
+
+                return true;
+            }
+
+        public:
+
+            void append(const uint8_t * data, size_t count)
+            {
+                _data.insert(_data.end(), data, data + count);
+            }
+
+            bool load(const char * filename)
+            {
+                FILE * file = fopen(filename, "rb");
+
+                if (!file) return false;
+
+                uint8_t buffer[4096];
+                size_t count = 0;
+
+                while ((count = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+                    append(buffer, count);
+                }
+
+                fclose(file);
+
+                return true;
+            }
+
+            // Returns false at the end of the data or on an error; more data can be
+            // appended after the former
+            bool next(entry_t & entry)
+            {
+                while (_pos < _data.size() && !_error) {
+
+                    uint8_t header = _data[_pos];
+                    size_t left = _data.size() - _pos - 1;
+
+                    switch (header & Recorder::RECORD_MASK) {
+
+                        case Recorder::RECORD_SCHEMA:
+
+                            if (left < 8) return false;
+
+                            if (memcmp(&_data[_pos+1], "HFLG", 4)) {
+                                return fail("bad schema magic");
+                            }
+
+                            if (_data[_pos+5] != Recorder::VERSION) {
+                                return fail("unsupported log version");
+                            }
+
+                            if (_data[_pos+6] > Recorder::MAX_STAGES || _data[_pos+7] > Recorder::RAW_CHANNELS ||
+                                    _data[_pos+8] > Recorder::MAX_MOTORS) {
+                                return fail("bad schema");
+                            }
+
+                            setLayout(_data[_pos+6], _data[_pos+7], _data[_pos+8]);
+
+                            _pos += 9;
+
+                            break;
+
+                        case Recorder::RECORD_INPUT:
+                            {
+                                uint8_t input = header >> Recorder::INPUT_SHIFT;
+
+                                if (input >= Recorder::INPUT_COUNT) {
+                                    return fail("bad input type");
+                                }
+
+                                uint8_t count = Recorder::inputValues(input);
+
+                                if (left < 4 + 4*(size_t)count) return false;
+
+                                entry.kind = ENTRY_INPUT;
+                                entry.usec = unwrap(get32(_pos+1));
+                                entry.input = input;
+                                entry.count = count;
+
+                                for (uint8_t k=0; k<count; ++k) {
+                                    uint32_t bits = get32(_pos + 5 + 4*k);
+                                    memcpy(&entry.inputs[k], &bits, 4);
+                                }
+
+                                _pos += 5 + 4*count;
+
+                                return true;
+                            }
+
+                        case Recorder::RECORD_KEY:
+
+                            if (!_haveSchema) {
+                                return fail("record before schema");
+                            }
+
+                            if (left < 4 + 2*(size_t)_nchannels) return false;
+
+                            _recordUsec32 = get32(_pos+1);
+
+                            for (uint8_t k=0; k<_nchannels; ++k) {
+                                _counts[k] = (int16_t)get16(_pos + 5 + 2*k);
+                            }
+
+                            _haveKey = true;
+                            _pos += 5 + 2*_nchannels;
+
+                            return record(header, entry);
+
+                        default: // RECORD_DELTA
+
+                            if (!_haveKey) {
+                                return fail("delta record before key");
+                            }
+
+                            if (left < 2 + (size_t)_nchannels) return false;
+
+                            _recordUsec32 += get16(_pos+1);
+
+                            for (uint8_t k=0; k<_nchannels; ++k) {
+                                _counts[k] += (int8_t)_data[_pos + 3 + k];
+                            }
+
+                            _pos += 3 + _nchannels;
+
+                            return record(header, entry);
+                    }
+                }
+
+                return false;
+            }
+
+            // Null if none
+            const char * getError(void)
+            {
+                return _error;
+            }
+
+            size_t getErrorPosition(void)
+            {
+                return _errorPos;
+            }
+
+            uint8_t getStages(void)
+            {
+                return _nstages;
+            }
+
+            uint8_t getRawChannels(void)
+            {
+                return _nraw;
+            }
+
+            uint8_t getMotors(void)
+            {
+                return _nmotors;
+            }
+
+            // Name of a record channel in the current layout, as in decodelog.py
+            void getChannelName(uint8_t channel, char * name, size_t size)
+            {
+                static const char * state[] = {"location", "rotation", "angularVel", "bodyAccel", "bodyVel", "inertialVel"};
+                static const char * demands[] = {"throttle", "roll", "pitch", "yaw"};
+
+                if (channel < Recorder::STATE_CHANNELS) {
+                    snprintf(name, size, "%s_%c", state[channel/3], "xyz"[channel%3]);
+                    return;
+                }
+
+                channel -= Recorder::STATE_CHANNELS;
+
+                if (channel < 4*_nstages) {
+                    snprintf(name, size, "stage%d_%s", channel/4, demands[channel%4]);
+                    return;
+                }
+
+                channel -= 4*_nstages;
+
+                if (channel < _nraw) {
+                    snprintf(name, size, "raw%d", channel);
+                    return;
+                }
+
+                snprintf(name, size, "m%d", channel - _nraw + 1);
+            }
+
+    }; // class LogReader
+
+} // namespace hf
@@ -0,0 +1,386 @@
+/*
+   Rigid-body quadcopter model for software-in-the-loop simulation
+
+   Consumes the motor values written by the mixer and produces gyrometer,
+   accelerometer, quaternion, rangefinder and optical-flow readings in the
+   sign conventions documented in imu.hpp.  Internally the body frame is
+   forward-right-down and the world frame is north-east-down; motors are laid
+   out as in MixerQuadXCF, with motors 1 and 4 spinning clockwise seen from
+   above.
+
+   Copyright (c) 2020 Simon D. Levy
+
+   This file is part of Hackflight.
+
+   Hackflight is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   Hackflight is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+   You should have received a copy of the GNU General Public License
+   along with Hackflight.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <math.h>
+#include <string.h>
+
+namespace hf {
+
+    class Multirotor {
+
+        public:
+
+            static const uint8_t NMOTORS = 4;
+
+            static constexpr float GRAVITY = 9.80665f;
+
+            static constexpr float SEA_LEVEL_PRESSURE = 101325; // Pa
+
+            typedef struct {
+
+                float mass;          // kg
+                float armLength;     // m, center to each motor
+                float inertia[3];    // kg m^2 about body x, y, z
+                float maxThrust;     // N per motor at full speed; thrust goes as speed squared
+                float torqueRatio;   // m, propeller drag torque per unit thrust
+                float motorTau;      // s, first-order lag from motor value to speed
+                float linearDrag;    // N per m/s
+                float angularDrag;   // N m per rad/s
+
+                float rangeMax;      // m, rangefinder reports this when out of range or over-tilted
+                float flowPixels;    // optical-flow sensor pixels across its field of view
+                float flowFov;       // rad, optical-flow field of view
+
+            } params_t;
+
+            // A 250 g-class quad that hovers at half throttle
+            static params_t defaultParams(void)
+            {
+                params_t p;
+
+                p.mass         = 0.50f;
+                p.armLength    = 0.10f;
+                p.inertia[0]   = 2.5e-3f;
+                p.inertia[1]   = 2.5e-3f;
+                p.inertia[2]   = 4.5e-3f;
+                p.maxThrust    = p.mass * GRAVITY;
+                p.torqueRatio  = 0.016f;
+                p.motorTau     = 0.02f;
+                p.linearDrag   = 0.10f;
+                p.angularDrag  = 2.0e-3f;
+
+                p.rangeMax     = 4.0f;
+                p.flowPixels   = 30.0f;
+                p.flowFov      = 4.2f * M_PI / 180;
+
+                return p;
+            }
+
+        private:
+
+            // MixerQuadXCF layout: x forward, y right; spin +1 = clockwise from above
+            static constexpr float LAYOUT[NMOTORS][3] = {
+                //  x   y  spin
+                { -1, +1, +1 },   // 1 right rear
+                { +1, +1, -1 },   // 2 right front
+                { -1, -1, -1 },   // 3 left rear
+                { +1, -1, +1 },   // 4 left front
+            };
+
+            params_t _p;
+
+            // World position and velocity, NED
+            float _pos[3] = {0};
+            float _vel[3] = {0};
+
+            // Attitude, body to world
+            float _q[4] = {1, 0, 0, 0};
+
+            // Body angular velocity
+            float _omega[3] = {0};
+
+            // Normalized motor speeds, lagging the motor values
+            float _speed[NMOTORS] = {0};
+
+            // Specific force in body frame, for the accelerometer
+            float _specificForce[3] = {0, 0, -GRAVITY};
+
+            // Flow-sensor pixel counts accumulated since the last read
+            float _flow[2] = {0};
+
+            bool _onGround = true;
+
+            // Column k of the body-to-world rotation is body axis k in world coordinates
+            void rotation(float R[3][3])
+            {
+                float w = _q[0], x = _q[1], y = _q[2], z = _q[3];
+
+                R[0][0] = 1 - 2*(y*y + z*z);
+                R[0][1] = 2*(x*y - w*z);
+                R[0][2] = 2*(x*z + w*y);
+                R[1][0] = 2*(x*y + w*z);
+                R[1][1] = 1 - 2*(x*x + z*z);
+                R[1][2] = 2*(y*z - w*x);
+                R[2][0] = 2*(x*z - w*y);
+                R[2][1] = 2*(y*z + w*x);
+                R[2][2] = 1 - 2*(x*x + y*y);
+            }
+
+            void integrateAttitude(float dt)
+            {
+                float w = _q[0], x = _q[1], y = _q[2], z = _q[3];
+                float p = _omega[0], q = _omega[1], r = _omega[2];
+
+                _q[0] += 0.5f * dt * (-x*p - y*q - z*r);
+                _q[1] += 0.5f * dt * ( w*p + y*r - z*q);
+                _q[2] += 0.5f * dt * ( w*q - x*r + z*p);
+                _q[3] += 0.5f * dt * ( w*r + x*q - y*p);
+
+                float norm = sqrtf(_q[0]*_q[0] + _q[1]*_q[1] + _q[2]*_q[2] + _q[3]*_q[3]);
+                for (uint8_t k=0; k<4; ++k) {
+                    _q[k] /= norm;
+                }
+            }
+
+            // Resting on the ground: level, keeping heading, with the ground holding up the weight
+            void land(void)
+            {
+                float yaw = getYaw();
+
+                _q[0] = cosf(yaw/2);
+                _q[1] = 0;
+                _q[2] = 0;
+                _q[3] = sinf(yaw/2);
+
+                _pos[2] = 0;
+                memset(_vel, 0, sizeof(_vel));
+                memset(_omega, 0, sizeof(_omega));
+
+                _specificForce[0] = 0;
+                _specificForce[1] = 0;
+                _specificForce[2] = -GRAVITY;
+
+                _onGround = true;
+            }
+
+        public:
+
+            Multirotor(const params_t & params = defaultParams())
+            {
+                _p = params;
+            }
+
+            // Advances the model by dt seconds with the given motor values in [0,1]
+            void update(const float motors[NMOTORS], float dt)
+            {
+                float a = _p.armLength / sqrtf(2);
+
+                float thrust = 0;
+                float torque[3] = {0};
+
+                for (uint8_t k=0; k<NMOTORS; ++k) {
+
+                    float value = motors[k] < 0 ? 0 : (motors[k] > 1 ? 1 : motors[k]);
+
+                    // Exact discretization of the first-order lag
+                    _speed[k] += (value - _speed[k]) * (1 - expf(-dt / _p.motorTau));
+
+                    float t = _p.maxThrust * _speed[k] * _speed[k];
+
+                    // Thrust acts along -z, so r x F = (-y T, x T, 0); drag torque opposes the spin
+                    thrust    += t;
+                    torque[0] += -LAYOUT[k][1] * a * t;
+                    torque[1] +=  LAYOUT[k][0] * a * t;
+                    torque[2] += -LAYOUT[k][2] * _p.torqueRatio * t;
+                }
+
+                // Euler's equations with a diagonal inertia tensor
+                const float * I = _p.inertia;
+                float p = _omega[0], q = _omega[1], r = _omega[2];
+                float pdot = (torque[0] - (I[2] - I[1]) * q * r - _p.angularDrag * p) / I[0];
+                float qdot = (torque[1] - (I[0] - I[2]) * r * p - _p.angularDrag * q) / I[1];
+                float rdot = (torque[2] - (I[1] - I[0]) * p * q - _p.angularDrag * r) / I[2];
+
+                float R[3][3];
+                rotation(R);
+
+                // Thrust along body -z, plus drag, in world frame
+                float force[3];
+                for (uint8_t i=0; i<3; ++i) {
+                    force[i] = -R[i][2] * thrust - _p.linearDrag * _vel[i];
+                }
+
+                float accel[3] = {force[0] / _p.mass, force[1] / _p.mass, force[2] / _p.mass + GRAVITY};
+
+                // Stay on the ground until thrust exceeds weight
+                if (_onGround && accel[2] >= 0) {
+                    land();
+                    return;
+                }
+
+                _onGround = false;
+
+                _omega[0] += pdot * dt;
+                _omega[1] += qdot * dt;
+                _omega[2] += rdot * dt;
+
+                integrateAttitude(dt);
+
+                for (uint8_t i=0; i<3; ++i) {
+                    _vel[i] += accel[i] * dt;
+                    _pos[i] += _vel[i] * dt;
+                }
+
+                // Specific force is everything but gravity, expressed in body frame
+                for (uint8_t j=0; j<3; ++j) {
+                    _specificForce[j] = (R[0][j] * force[0] + R[1][j] * force[1] + R[2][j] * force[2]) / _p.mass;
+                }
+
+                // Touchdown
+                if (_pos[2] > 0) {
+                    land();
+                    return;
+                }
+
+                // Ground features drift across the downward-looking camera with translation
+                // and with rotation alike
+                float height = -_pos[2];
+                float vforward = R[0][0] * _vel[0] + R[1][0] * _vel[1] + R[2][0] * _vel[2];
+                float vright   = R[0][1] * _vel[0] + R[1][1] * _vel[1] + R[2][1] * _vel[2];
+                float scale = dt * _p.flowPixels / _p.flowFov;
+                if (height > 0.05f) {
+                    _flow[0] -= scale * (vright / height + _omega[0]);
+                    _flow[1] += scale * (vforward / height - _omega[1]);
+                }
+            }
+
+            // Sensor readings, in the conventions of imu.hpp --------------------
+
+            void getGyrometer(float & gx, float & gy, float & gz)
+            {
+                gx = _omega[0];
+                gy = _omega[1];
+                gz = _omega[2];
+            }
+
+            void getQuaternion(float & qw, float & qx, float & qy, float & qz)
+            {
+                qw = _q[0];
+                qx = _q[1];
+                qy = _q[2];
+                qz = _q[3];
+            }
+
+            // Gs
+            void getAccelerometer(float & ax, float & ay, float & az)
+            {
+                ax = -_specificForce[0] / GRAVITY;
+                ay = -_specificForce[1] / GRAVITY;
+                az = -_specificForce[2] / GRAVITY;
+            }
+
+            // Meters along the body z axis to the ground
+            float getRangefinder(void)
+            {
+                float R[3][3];
+                rotation(R);
+
+                float height = -_pos[2];
+
+                if (R[2][2] < 0.5f) {
+                    return _p.rangeMax;
+                }
+
+                float range = height / R[2][2];
+
+                return range > _p.rangeMax ? _p.rangeMax : range;
+            }
+
+            // Pascals, from the standard atmosphere at sea level
+            float getBarometer(void)
+            {
+                return SEA_LEVEL_PRESSURE * powf(1 - getAltitude() / 44330, 5.255f);
+            }
+
+            // Pixel counts since the previous call, as a motion sensor reports them
+            void getOpticalFlow(int16_t & dx, int16_t & dy)
+            {
+                dx = (int16_t)_flow[0];
+                dy = (int16_t)_flow[1];
+
+                // Keep the fractional pixels for next time
+                _flow[0] -= dx;
+                _flow[1] -= dy;
+            }
+
+            // Ground truth -----------------------------------------------------
+
+            // Meters above the ground
+            float getAltitude(void)
+            {
+                return -_pos[2];
+            }
+
+            // Meters per second, positive up
+            float getClimbRate(void)
+            {
+                return -_vel[2];
+            }
+
+            // Meters per second north, east, down
+            float getVelocity(uint8_t axis)
+            {
+                return _vel[axis];
+            }
+
+            // Radians, roll right positive
+            float getRoll(void)
+            {
+                return atan2f(2*(_q[0]*_q[1] + _q[2]*_q[3]), 1 - 2*(_q[1]*_q[1] + _q[2]*_q[2]));
+            }
+
+            // Radians, nose up positive
+            float getPitch(void)
+            {
+                float s = 2*(_q[0]*_q[2] - _q[3]*_q[1]);
+                return asinf(s > 1 ? 1 : (s < -1 ? -1 : s));
+            }
+
+            // Radians, right positive
+            float getYaw(void)
+            {
+                return atan2f(2*(_q[0]*_q[3] + _q[1]*_q[2]), 1 - 2*(_q[2]*_q[2] + _q[3]*_q[3]));
+            }
+
+            // Body rates p, q, r in rad/s
+            float getAngularVelocity(uint8_t axis)
+            {
+                return _omega[axis];
+            }
+
+            float getMotorSpeed(uint8_t index)
+            {
+                return _speed[index];
+            }
+
+            bool onGround(void)
+            {
+                return _onGround;
+            }
+
+            const params_t & getParams(void)
+            {
+                return _p;
+            }
+
+    }; // class Multirotor
+
+    constexpr float Multirotor::LAYOUT[Multirotor::NMOTORS][3];
+
+} // namespace hf
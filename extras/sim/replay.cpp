@@ -0,0 +1,162 @@
+/*
+   Replays a flight log recorded by silsim (or StepTest) through the unchanged
+   Hackflight::update() and reports how the replayed PID updates compare with
+   the logged ones.  With the logged gains, the replay should be exact; with
+   changed gains it shows how far the new controllers depart from the flight.
+
+   Usage: replay LOGFILE [GAIN=VALUE ...]
+
+   GAIN is one of the StepTest gains: rateKp, rateKi, rateKd, rateKpYaw,
+   rateKiYaw, levelKp, altholdKpPos, altholdKpVel, altholdKiVel, altholdKdVel.
+   A log with gyro-interrupt inputs is replayed gyro-synchronously.  The exit
+   status is zero only if every record matches.
+
+   Copyright (c) 2020 Simon D. Levy
+
+   This file is part of Hackflight.
+
+   Hackflight is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   Hackflight is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+   You should have received a copy of the GNU General Public License
+   along with Hackflight.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+
+#include "replay.hpp"
+#include "steptest.hpp"
+
+static float * findGain(hf::StepTest::gains_t & g, const char * name, size_t length)
+{
+    static const char * names[] = {
+        "rateKp", "rateKi", "rateKd", "rateKpYaw", "rateKiYaw",
+        "levelKp", "altholdKpPos", "altholdKpVel", "altholdKiVel", "altholdKdVel"
+    };
+
+    float * gains[] = {
+        &g.rateKp, &g.rateKi, &g.rateKd, &g.rateKpYaw, &g.rateKiYaw,
+        &g.levelKp, &g.altholdKpPos, &g.altholdKpVel, &g.altholdKiVel, &g.altholdKdVel
+    };
+
+    for (uint8_t k=0; k<sizeof(names)/sizeof(names[0]); ++k) {
+        if (strlen(names[k]) == length && !strncmp(names[k], name, length)) {
+            return gains[k];
+        }
+    }
+
+    return NULL;
+}
+
+// Logs from a gyro-synchronous vehicle have the gyro readings of its interrupts
+static bool isGyroSynchronous(const char * filename)
+{
+    hf::LogReader reader;
+    reader.load(filename);
+
+    hf::LogReader::entry_t entry = {};
+
+    while (reader.next(entry)) {
+        if (entry.kind == hf::LogReader::ENTRY_INPUT && entry.input == hf::Recorder::INPUT_GYRO_INTERRUPT) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+int main(int argc, char ** argv)
+{
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s LOGFILE [GAIN=VALUE ...]\n", argv[0]);
+        return 2;
+    }
+
+    const char * filename = argv[1];
+
+    hf::StepTest::gains_t gains = hf::StepTest::defaultGains();
+
+    for (int k=2; k<argc; ++k) {
+
+        const char * equals = strchr(argv[k], '=');
+        float * gain = equals ? findGain(gains, argv[k], equals - argv[k]) : NULL;
+
+        if (!gain) {
+            fprintf(stderr, "Unknown gain setting %s\n", argv[k]);
+            return 2;
+        }
+
+        *gain = atof(equals + 1);
+    }
+
+    hf::LogReader log;
+
+    if (!log.load(filename)) {
+        fprintf(stderr, "Unable to open %s\n", filename);
+        return 2;
+    }
+
+    bool gyrosync = isGyroSynchronous(filename);
+
+    // Same vehicle and controllers as StepTest
+    hf::Replay replay;
+    hf::StepTest::Controllers controllers(gains);
+
+    replay.begin();
+    controllers.add(replay.vehicle.sim.hackflight, gyrosync);
+
+    auto start = std::chrono::steady_clock::now();
+
+    bool ok = replay.run(log);
+
+    double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    if (!ok) {
+        fprintf(stderr, "%s: %s at byte %zu\n", filename, log.getError(), log.getErrorPosition());
+        return 2;
+    }
+
+    const hf::Replay::report_t & report = replay.getReport();
+
+    float seconds = replay.vehicle.sim.getSeconds();
+
+    printf("Replayed %s%s: %.3f simulated seconds in %.3f wall seconds (%.0fx real time)\n",
+            filename, gyrosync ? " (gyro-synchronous)" : "", seconds, wall, wall > 0 ? seconds / wall : 0);
+    printf("%u inputs, %u updates, %u records compared\n", report.inputs, report.updates, report.records);
+
+    if (replay.identical()) {
+        printf("Identical to the log\n");
+        return 0;
+    }
+
+    printf("%u records differ, %u unmatched\n", report.mismatched, report.missing);
+
+    if (report.firstChannel < 0) {
+        printf("First difference at %.6f s: no replayed record at that time, or different flags\n",
+                report.firstUsec / 1e6);
+    }
+    else {
+        char name[32] = {0};
+        replay.getChannelName(report.firstChannel, name, sizeof(name));
+        printf("First difference at %.6f s: %s logged %g, replayed %g\n",
+                report.firstUsec / 1e6, name, report.firstLogged, report.firstReplayed);
+    }
+
+    static const char * groups[hf::Replay::NGROUPS] = {"state", "demands", "raw", "motors"};
+
+    printf("Largest differences:");
+    for (uint8_t k=0; k<hf::Replay::NGROUPS; ++k) {
+        printf(" %s %g%s", groups[k], report.maxError[k], k < hf::Replay::NGROUPS-1 ? "," : "\n");
+    }
+
+    return 1;
+}
@@ -0,0 +1,334 @@
+/*
+   Deterministic replay of a flight log recorded with inputs (see
+   Recorder::setInputs()): feeds each logged sensor and receiver reading to a
+   SimVehicle's simulated devices at its logged time, runs the unchanged
+   Hackflight::update() (or gyroInterrupt()) whenever the original did, and
+   compares each PID update's state, demands, and motors with the log.
+
+   The replayed Hackflight must be set up as the original was: the same PID
+   controllers, rates, and optional sensors added in the same order.  With
+   the same setup and build, a log from the simulator replays exactly; a log
+   from a flight controller replays to within its floating-point differences.
+   Changing a gain or filter then shows where, and by how much, the new code
+   departs from the flight.
+
+   Things the log doesn't capture aren't replayed: MSP messages from a ground
+   station, and sensors in a SensorChain.  Gyro interrupts are replayed between
+   loop iterations, where the simulator calls them.
+
+   Copyright (c) 2020 Simon D. Levy
+
+   This file is part of Hackflight.
+
+   Hackflight is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   Hackflight is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+   You should have received a copy of the GNU General Public License
+   along with Hackflight.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <math.h>
+#include <deque>
+
+#include "vehicle.hpp"
+#include "logreader.hpp"
+#include "logsink.hpp"
+
+namespace hf {
+
+    class Replay {
+
+        public:
+
+            // Channel groups of a record, for the largest errors
+            enum {
+                GROUP_STATE,
+                GROUP_DEMANDS,
+                GROUP_RAW,
+                GROUP_MOTORS,
+                NGROUPS
+            };
+
+            typedef struct {
+
+                uint32_t inputs;        // logged inputs fed to the vehicle
+                uint32_t updates;       // calls to update() and gyroInterrupt()
+                uint32_t records;       // PID records compared
+                uint32_t mismatched;    // records with any channel different
+                uint32_t missing;       // logged records with no replayed one at their time
+
+                // First difference
+                uint64_t firstUsec;
+                int16_t  firstChannel;  // -1 for a missing record or different flags
+                float    firstLogged;
+                float    firstReplayed;
+
+                // Largest difference in each group, in the channels' units
+                float maxError[NGROUPS];
+
+            } report_t;
+
+        private:
+
+            // Appends the replay's own log to a reader
+            class ReaderSink : public LogSink {
+
+                public:
+
+                    LogReader * reader = NULL;
+
+                    virtual uint16_t write(const uint8_t * data, uint16_t count) override
+                    {
+                        reader->append(data, count);
+                        return count;
+                    }
+
+            }; // class ReaderSink
+
+            Recorder _recorder;
+            ReaderSink _sink;
+            LogReader _replayed;
+
+            // Logged records awaiting the replayed ones
+            std::deque<LogReader::entry_t> _expected;
+
+            uint64_t _usec = 0;
+
+            bool _pending = false;
+            uint64_t _pendingUsec = 0;
+
+            report_t _report = {};
+
+            uint8_t group(uint8_t channel)
+            {
+                uint8_t demands = Recorder::STATE_CHANNELS + 4*_replayed.getStages();
+                uint8_t raw = demands + _replayed.getRawChannels();
+
+                return channel < Recorder::STATE_CHANNELS ? GROUP_STATE :
+                    channel < demands ? GROUP_DEMANDS :
+                    channel < raw ? GROUP_RAW :
+                    GROUP_MOTORS;
+            }
+
+            void mismatch(uint64_t usec, int16_t channel, float logged, float replayed)
+            {
+                if (_report.mismatched + _report.missing == 0) {
+                    _report.firstUsec = usec;
+                    _report.firstChannel = channel;
+                    _report.firstLogged = logged;
+                    _report.firstReplayed = replayed;
+                }
+            }
+
+            void missed(const LogReader::entry_t & logged)
+            {
+                mismatch(logged.usec, -1, 0, 0);
+                _report.missing++;
+            }
+
+            void compare(const LogReader::entry_t & logged, const LogReader::entry_t & replayed)
+            {
+                _report.records++;
+
+                bool same = true;
+
+                if (logged.count != replayed.count ||
+                        logged.armed != replayed.armed || logged.failsafe != replayed.failsafe) {
+                    mismatch(logged.usec, -1, 0, 0);
+                    same = false;
+                }
+
+                for (uint8_t k=0; k<logged.count && k<replayed.count; ++k) {
+
+                    if (logged.counts[k] == replayed.counts[k]) continue;
+
+                    if (same) {
+                        mismatch(logged.usec, k, logged.values[k], replayed.values[k]);
+                    }
+
+                    float error = fabsf(logged.values[k] - replayed.values[k]);
+                    float & max = _report.maxError[group(k)];
+                    if (error > max) {
+                        max = error;
+                    }
+
+                    same = false;
+                }
+
+                if (!same) {
+                    _report.mismatched++;
+                }
+            }
+
+            // Compares the records the replay has produced so far
+            void drain(void)
+            {
+                uint8_t buffer[256];
+
+                for (uint16_t count=_recorder.read(buffer, sizeof(buffer)); count>0;
+                        count=_recorder.read(buffer, sizeof(buffer))) {
+                    _replayed.append(buffer, count);
+                }
+
+                LogReader::entry_t entry = {};
+
+                while (_replayed.next(entry)) {
+
+                    // A logged record that the replay ran past
+                    while (!_expected.empty() && _expected.front().usec < entry.usec) {
+                        missed(_expected.front());
+                        _expected.pop_front();
+                    }
+
+                    // Otherwise a replayed record falling between logged ones was left out
+                    // by the recorder's divisor
+                    if (!_expected.empty() && _expected.front().usec == entry.usec) {
+                        compare(_expected.front(), entry);
+                        _expected.pop_front();
+                    }
+                }
+            }
+
+            void advanceTo(uint64_t usec)
+            {
+                if (usec > _usec) {
+                    vehicle.sim.board.advanceMicros((uint32_t)(usec - _usec));
+                    _usec = usec;
+                }
+            }
+
+            // Runs the update() whose inputs have been staged
+            void flush(void)
+            {
+                if (!_pending) return;
+
+                advanceTo(_pendingUsec);
+                vehicle.sim.hackflight.update();
+                _report.updates++;
+                _pending = false;
+
+                drain();
+            }
+
+            void stage(const LogReader::entry_t & entry)
+            {
+                const float * v = entry.inputs;
+
+                switch (entry.input) {
+
+                    case Recorder::INPUT_RECEIVER:
+                        vehicle.sim.receiver.setChannels(v, Recorder::RECEIVER_CHANNELS);
+                        break;
+
+                    case Recorder::INPUT_LOST_SIGNAL:
+                        vehicle.sim.receiver.setLostSignal(v[0] != 0);
+                        break;
+
+                    case Recorder::INPUT_GYRO:
+                        vehicle.sim.imu.setGyrometer(v[0], v[1], v[2]);
+                        break;
+
+                    case Recorder::INPUT_QUATERNION:
+                        vehicle.sim.imu.setQuaternion(v[0], v[1], v[2], v[3]);
+                        break;
+
+                    case Recorder::INPUT_RANGE:
+                        vehicle.rangefinder.setDistance(v[0]);
+                        break;
+
+                    case Recorder::INPUT_FLOW:
+                        vehicle.opticalFlow.addMotionCount((int16_t)v[0], (int16_t)v[1]);
+                        break;
+
+                    default: // INPUT_START, INPUT_UPDATE: only the time matters
+                        break;
+                }
+            }
+
+        public:
+
+            SimVehicle vehicle;
+
+            // Initializes the vehicle and its log; add the PID controllers after this
+            void begin(void)
+            {
+                vehicle.begin();
+
+                _sink.reader = &_replayed;
+                vehicle.sim.hackflight.setRecorder(&_recorder, &_sink);
+            }
+
+            // Replays a whole log; returns false if it can't be read
+            bool run(LogReader & log)
+            {
+                LogReader::entry_t entry = {};
+
+                while (log.next(entry)) {
+
+                    if (entry.kind == LogReader::ENTRY_RECORD) {
+                        _expected.push_back(entry);
+                    }
+
+                    // Gyro interrupts come between loop iterations
+                    else if (entry.input == Recorder::INPUT_GYRO_INTERRUPT) {
+                        flush();
+                        advanceTo(entry.usec);
+                        vehicle.sim.imu.setGyrometer(entry.inputs[0], entry.inputs[1], entry.inputs[2]);
+                        vehicle.sim.hackflight.gyroInterrupt();
+                        _report.inputs++;
+                        _report.updates++;
+                        continue;
+                    }
+
+                    // Everything at one time was consumed by the same update()
+                    if (_pending && entry.usec != _pendingUsec) {
+                        flush();
+                    }
+
+                    if (entry.kind == LogReader::ENTRY_INPUT) {
+                        stage(entry);
+                        _report.inputs++;
+                    }
+
+                    _pending = true;
+                    _pendingUsec = entry.usec;
+                }
+
+                flush();
+
+                while (!_expected.empty()) {
+                    missed(_expected.front());
+                    _expected.pop_front();
+                }
+
+                return log.getError() == NULL;
+            }
+
+            const report_t & getReport(void)
+            {
+                return _report;
+            }
+
+            // Names a channel of the replayed records, as decodelog.py does
+            void getChannelName(uint8_t channel, char * name, size_t size)
+            {
+                _replayed.getChannelName(channel, name, size);
+            }
+
+            // Records that don't match, to the log's resolution
+            bool identical(void)
+            {
+                return _report.mismatched == 0 && _report.missing == 0;
+            }
+
+    }; // class Replay
+
+} // namespace hf
@@ -0,0 +1,127 @@
+/*
+   Software-in-the-loop flight test: flies the unmodified Hackflight control
+   stack against the Multirotor physics model through a scripted takeoff,
+   altitude hold, and roll / pitch / yaw stick steps, and reports the step
+   response of each axis
+
+   Usage: silsim [csv] [gyrosync] [log] [ekf]
+
+   With "csv", the flight is printed as comma-separated values at the
+   quaternion rate instead of the report.  With "gyrosync", each gyro
+   sample runs the rate controller and mixer directly, as in hfsim.  With
+   "log", the flight log is recorded to silsim.hflog, for decoding with
+   extras/debug/python/decodelog.py.  With "ekf", the StateEstimator fuses
+   the accelerometer, attitude, rangefinder, barometer, and optical flow;
+   the log doesn't have its accelerometer and barometer readings, and its
+   rangefinder is read in interrupt mode, whose readings are logged when
+   they're drained rather than when they arrive, so the two can't be
+   combined.  Either way, the errors in the estimated altitude and
+   velocities are reported.
+
+   Copyright (c) 2020 Simon D. Levy
+
+   This file is part of Hackflight.
+
+   Hackflight is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   Hackflight is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+   You should have received a copy of the GNU General Public License
+   along with Hackflight.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <chrono>
+
+#include "steptest.hpp"
+#include "logsinks/sim.hpp"
+
+static const char * LOGFILE = "silsim.hflog";
+
+static const char * STEP_NAMES[hf::StepTest::NAXES] = {"Roll angle", "Pitch angle", "Yaw rate"};
+
+int main(int argc, char ** argv)
+{
+    bool csv = false;
+    bool gyrosync = false;
+    bool log = false;
+    bool ekf = false;
+
+    for (int k=1; k<argc; ++k) {
+        csv      = csv      || !strcmp(argv[k], "csv");
+        gyrosync = gyrosync || !strcmp(argv[k], "gyrosync");
+        log      = log      || !strcmp(argv[k], "log");
+        ekf      = ekf      || !strcmp(argv[k], "ekf");
+    }
+
+    if (log && ekf) {
+        fprintf(stderr, "Flights with the estimator can't be logged for replay\n");
+        return 1;
+    }
+
+    FILE * logfile = NULL;
+    if (log) {
+        logfile = fopen(LOGFILE, "wb");
+        if (!logfile) {
+            fprintf(stderr, "Unable to open %s\n", LOGFILE);
+            return 1;
+        }
+    }
+
+    hf::SimLogSink sink(logfile);
+
+    hf::StepTest test;
+
+    auto start = std::chrono::steady_clock::now();
+
+    hf::StepTest::results_t results = test.run(hf::StepTest::defaultGains(), gyrosync, csv ? stdout : NULL, log ? &sink : NULL, ekf);
+
+    double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    if (logfile) {
+        fclose(logfile);
+    }
+
+    if (csv) return 0;
+
+    printf("Simulated seconds: %.3f\n", hf::StepTest::END_SECONDS);
+    printf("Wall seconds:      %.3f\n", wall);
+    printf("Speedup:           %.0fx real time\n", wall > 0 ? hf::StepTest::END_SECONDS / wall : 0);
+
+    if (results.crashed) {
+        printf("Crashed\n");
+        return 1;
+    }
+
+    printf("Hold altitude:     %.2f m, max error %.3f m\n", results.holdAltitude, results.holdError);
+    printf("Saturation:        %.1f%% of airborne iterations\n", 100 * results.saturation);
+    printf("Estimate errors:   altitude %.3f m, climb %.3f m/s, horizontal %.3f m/s RMS\n",
+            results.altitudeError, results.climbError, results.velocityError);
+
+    if (log) {
+        printf("Flight log:        %u bytes in %s, %u records dropped\n",
+                sink.getBytes(), LOGFILE, test.getRecorder()->getDropped());
+    }
+
+    printf("\n%-12s %8s %8s %8s %10s %8s %10s\n", "Step", "Target", "Final", "Error", "Overshoot", "Rise", "Settling");
+
+    for (uint8_t k=0; k<hf::StepTest::NAXES; ++k) {
+        const hf::StepResponse::metrics_t & m = results.steps[k];
+        printf("%-12s %8.2f %8.2f %7.1f%% %9.1f%% ", STEP_NAMES[k], m.target, m.final, 100 * m.error, 100 * m.overshoot);
+        if (m.riseTime < 0) {
+            printf("%8s ", "-");
+        }
+        else {
+            printf("%6.0fms ", 1000 * m.riseTime);
+        }
+        printf("%8.0fms\n", 1000 * m.settlingTime);
+    }
+
+    return 0;
+}
@@ -0,0 +1,111 @@
+/*
+   Host-side harness that wires Hackflight to the simulated board, IMU,
+   receiver and motors and steps it on a virtual clock
+
+   Copyright (c) 2020 Simon D. Levy
+
+   This file is part of Hackflight.
+
+   Hackflight is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   Hackflight is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+   You should have received a copy of the GNU General Public License
+   along with Hackflight.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "hackflight.hpp"
+#include "boards/simboard.hpp"
+#include "imus/sim.hpp"
+#include "receivers/sim.hpp"
+#include "motors/sim.hpp"
+#include "actuators/mixers/quadxcf.hpp"
+
+namespace hf {
+
+    class SimLoop {
+
+        public:
+
+            static const uint8_t NMOTORS = 4;
+
+            // Raw transmitter channel order for SimReceiver's default map
+            enum {
+                CHAN_THROTTLE,
+                CHAN_ROLL,
+                CHAN_PITCH,
+                CHAN_YAW,
+                CHAN_AUX1,
+                CHAN_AUX2
+            };
+
+        private:
+
+            // Virtual time between calls to Hackflight::update()
+            uint32_t _loopMicros = 0;
+
+            SimMotor  _motorObjects[NMOTORS];
+            Motor   * _motorPointers[NMOTORS] = {NULL};
+
+            uint32_t _iterations = 0;
+
+        public:
+
+            Hackflight   hackflight;
+            SimBoard     board;
+            SimIMU       imu;
+            SimReceiver  receiver;
+            MixerQuadXCF mixer;
+
+            SimLoop(uint32_t loopMicros=125)
+            {
+                _loopMicros = loopMicros;
+
+                for (uint8_t k=0; k<NMOTORS; ++k) {
+                    _motorPointers[k] = &_motorObjects[k];
+                }
+            }
+
+            void begin(void)
+            {
+                hackflight.init(&board, &imu, &receiver, &mixer, _motorPointers);
+            }
+
+            // Advances the virtual clock by one loop period and runs one iteration
+            void step(void)
+            {
+                board.advanceMicros(_loopMicros);
+                hackflight.update();
+                _iterations++;
+            }
+
+            SimMotor & motor(uint8_t index)
+            {
+                return _motorObjects[index];
+            }
+
+            uint32_t getIterations(void)
+            {
+                return _iterations;
+            }
+
+            uint32_t getLoopMicros(void)
+            {
+                return _loopMicros;
+            }
+
+            float getSeconds(void)
+            {
+                return board.getMicros() / 1.e6f;
+            }
+
+    }; // class SimLoop
+
+} // namespace hf
@@ -0,0 +1,145 @@
+/*
+   Step-response metrics for a signal recorded over a fixed window after a
+   step in the command: settled error, overshoot, rise time, and settling
+   time, measured against the value the command asks for
+
+   Copyright (c) 2020 Simon D. Levy
+
+   This file is part of Hackflight.
+
+   Hackflight is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   Hackflight is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+   You should have received a copy of the GNU General Public License
+   along with Hackflight.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <math.h>
+
+namespace hf {
+
+    class StepResponse {
+
+        public:
+
+            // Enough for a few seconds at the quaternion rate
+            static const uint16_t MAXSAMPLES = 2000;
+
+            // Settled means staying within this fraction of the step
+            static constexpr float SETTLING_BAND = 0.05f;
+
+            // The final value is the mean over this trailing fraction of the window
+            static constexpr float FINAL_FRACTION = 0.1f;
+
+            typedef struct {
+
+                float target;
+                float final;         // settled value
+                float error;         // settled error, as a fraction of the step
+                float overshoot;     // fraction of the step by which the peak passes the target
+                float riseTime;      // seconds from 10% to 90% of the step, or negative if never reached
+                float settlingTime;  // seconds until the signal stays in the settling band
+
+            } metrics_t;
+
+        private:
+
+            float _times[MAXSAMPLES] = {0};
+            float _values[MAXSAMPLES] = {0};
+            uint16_t _count = 0;
+
+            float _startTime = 0;
+            float _initial = 0;
+
+            metrics_t _metrics = {};
+
+        public:
+
+            void begin(float time, float initial)
+            {
+                _count = 0;
+                _startTime = time;
+                _initial = initial;
+
+                _metrics = {};
+                _metrics.final = initial;
+            }
+
+            void sample(float time, float value)
+            {
+                if (_count < MAXSAMPLES) {
+                    _times[_count] = time - _startTime;
+                    _values[_count] = value;
+                    _count++;
+                }
+            }
+
+            // Computes the metrics over the samples since begin(), against the target value
+            const metrics_t & end(float target)
+            {
+                _metrics.target = target;
+
+                if (_count == 0) return _metrics;
+
+                uint16_t tail = (uint16_t)(_count * FINAL_FRACTION) + 1;
+                float sum = 0;
+                for (uint16_t k=_count-tail; k<_count; ++k) {
+                    sum += _values[k];
+                }
+                _metrics.final = sum / tail;
+
+                float step = _metrics.target - _initial;
+                if (fabsf(step) < 1e-6f) return _metrics;
+
+                _metrics.error = (_metrics.final - _metrics.target) / step;
+
+                // Work with the response normalized to a unit step
+                bool rose10 = false;
+                float t10 = 0;
+                float peak = 0;
+                _metrics.riseTime = -1;
+                _metrics.settlingTime = 0;
+
+                for (uint16_t k=0; k<_count; ++k) {
+
+                    float y = (_values[k] - _initial) / step;
+
+                    if (y > peak) {
+                        peak = y;
+                    }
+
+                    if (!rose10 && y >= 0.1f) {
+                        rose10 = true;
+                        t10 = _times[k];
+                    }
+
+                    if (_metrics.riseTime < 0 && y >= 0.9f) {
+                        _metrics.riseTime = _times[k] - t10;
+                    }
+
+                    if (fabsf(y - 1) > SETTLING_BAND) {
+                        _metrics.settlingTime = k+1 < _count ? _times[k+1] : _times[k];
+                    }
+                }
+
+                _metrics.overshoot = peak > 1 ? peak - 1 : 0;
+
+                return _metrics;
+            }
+
+            const metrics_t & getMetrics(void)
+            {
+                return _metrics;
+            }
+
+    }; // class StepResponse
+
+} // namespace hf
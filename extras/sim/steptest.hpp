@@ -0,0 +1,390 @@
+/*
+   Scripted step test of the rate, level, and altitude-hold controllers on a
+   SimVehicle: takeoff and climb in altitude hold, a hover, then roll, pitch,
+   and yaw stick steps, each held and then released.  One StepTest is one
+   complete flight, so independent tests can run on separate threads.
+
+   Copyright (c) 2020 Simon D. Levy
+
+   This file is part of Hackflight.
+
+   Hackflight is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   Hackflight is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+   You should have received a copy of the GNU General Public License
+   along with Hackflight.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <stdio.h>
+#include <math.h>
+
+#include "vehicle.hpp"
+#include "stepresponse.hpp"
+#include "recorder.hpp"
+#include "pidcontrollers/rate.hpp"
+#include "pidcontrollers/level.hpp"
+#include "pidcontrollers/althold.hpp"
+
+namespace hf {
+
+    class StepTest {
+
+        public:
+
+            typedef struct {
+
+                float rateKp;
+                float rateKi;
+                float rateKd;
+                float rateKpYaw;
+                float rateKiYaw;
+
+                float levelKp;
+
+                float altholdKpPos;
+                float altholdKpVel;
+                float altholdKiVel;
+                float altholdKdVel;
+
+            } gains_t;
+
+            // The gains in the example sketches
+            static gains_t defaultGains(void)
+            {
+                gains_t g;
+
+                g.rateKp       = 0.225f;
+                g.rateKi       = 0.001875f;
+                g.rateKd       = 0.375f;
+                g.rateKpYaw    = 1.0625f;
+                g.rateKiYaw    = 0.005625f;
+
+                g.levelKp      = 0.20f;
+
+                g.altholdKpPos = 1.00f;
+                g.altholdKpVel = 0.15f;
+                g.altholdKiVel = 0.01f;
+                g.altholdKdVel = 0.05f;
+
+                return g;
+            }
+
+            // The controllers flown by the test, set up the same way for a replay of its log
+            class Controllers {
+
+                private:
+
+                    RatePid _rate;
+                    LevelPid _level;
+                    AltitudeHoldPid _althold;
+
+                public:
+
+                    Controllers(const gains_t & gains)
+                        : _rate(gains.rateKp, gains.rateKi, gains.rateKd, gains.rateKpYaw, gains.rateKiYaw),
+                          _level(gains.levelKp),
+                          _althold(gains.altholdKpPos, gains.altholdKpVel, gains.altholdKiVel, gains.altholdKdVel)
+                    {
+                    }
+
+                    // Inner loop at gyro rate, level loop at quaternion rate
+                    void add(Hackflight & hackflight, bool gyrosync)
+                    {
+                        hackflight.setPidFrequency(1e6f / SimVehicle::GYRO_MICROS);
+                        hackflight.addPidController(&_level, 0, 1e6f / SimVehicle::QUATERNION_MICROS);
+                        hackflight.addPidController(&_althold, 1);
+                        if (gyrosync) {
+                            hackflight.setGyroSynchronous(&_rate);
+                        }
+                        else {
+                            hackflight.addPidController(&_rate);
+                        }
+                    }
+
+            }; // class Controllers
+
+            enum {
+                AXIS_ROLL,
+                AXIS_PITCH,
+                AXIS_YAW,
+                NAXES
+            };
+
+            typedef struct {
+
+                // Roll and pitch angles in degrees, yaw rate in degrees per second
+                StepResponse::metrics_t steps[NAXES];
+
+                float holdAltitude;  // m
+                float holdError;     // m, largest departure from holdAltitude while hovering
+                float saturation;    // fraction of airborne iterations with a motor at zero or full
+
+                // RMS differences between the state and the truth while airborne
+                float altitudeError; // m
+                float climbError;    // m/s
+                float velocityError; // m/s, horizontal
+
+
+                // Tipped over or fell out of the sky; the other results are then incomplete
+                bool crashed;
+
+            } results_t;
+
+            static const uint32_t LOOP_MICROS     = 125;   // 8 kHz loop
+            static const uint32_t RECEIVER_MICROS = 11000; // DSMX frame rate
+
+            // Logs include the inputs, which need the recorder drained faster; still
+            // below the PID rate, so that it never delays a PID update
+            static constexpr float RECORDER_FREQ = 500;
+
+            static constexpr float ARM_SECONDS   = 0.25f;
+            static constexpr float CLIMB_SECONDS = 0.50f;
+            static constexpr float HOLD_SECONDS  = 2.00f;
+            static constexpr float STEP_SECONDS  = 1.50f;
+            static constexpr float END_SECONDS   = 13.0f;
+
+            static constexpr float CLIMB_STICK = 0.5f;
+            static constexpr float STEP_STICK  = 0.25f;
+
+            // Hover is judged after the climb has had this long to die out
+            static constexpr float HOLD_SETTLE_SECONDS = 0.5f;
+
+        private:
+
+            // LevelPid's angle for a demand of +/-0.5
+            static constexpr float LEVEL_MAX_DEGREES = 45;
+
+            static constexpr float CRASH_DEGREES = 80;
+
+            // Each step is held for STEP_SECONDS, then the stick is centered for as long
+            static float stepStart(uint8_t axis)
+            {
+                return 4.0f + 3.0f * axis;
+            }
+
+            static uint8_t stepChannel(uint8_t axis)
+            {
+                static const uint8_t channels[NAXES] = {SimLoop::CHAN_ROLL, SimLoop::CHAN_PITCH, SimLoop::CHAN_YAW};
+                return channels[axis];
+            }
+
+            static bool inStep(uint8_t axis, float t)
+            {
+                return t >= stepStart(axis) && t < stepStart(axis) + STEP_SECONDS;
+            }
+
+            static float throttleStick(float t)
+            {
+                return t < CLIMB_SECONDS ? -1 : (t < HOLD_SECONDS ? CLIMB_STICK : 0);
+            }
+
+            static void flightScript(SimLoop & sim, float t)
+            {
+                float sticks[6] = {0};
+
+                sticks[SimLoop::CHAN_THROTTLE] = throttleStick(t);
+                sticks[SimLoop::CHAN_AUX1]     = t < ARM_SECONDS ? -1 : +1;
+                sticks[SimLoop::CHAN_AUX2]     = t < CLIMB_SECONDS ? -1 : +1;
+
+                for (uint8_t k=0; k<NAXES; ++k) {
+                    if (inStep(k, t)) {
+                        sticks[stepChannel(k)] = STEP_STICK;
+                    }
+                }
+
+                sim.receiver.setChannels(sticks, 6);
+            }
+
+            // Roll right and pitch nose-up in degrees, yaw right in degrees per second
+            static float response(Multirotor & multirotor, uint8_t axis)
+            {
+                switch (axis) {
+                    case AXIS_ROLL:
+                        return multirotor.getRoll() * 180 / M_PI;
+                    case AXIS_PITCH:
+                        return multirotor.getPitch() * 180 / M_PI;
+                    default:
+                        return multirotor.getAngularVelocity(2) * 180 / M_PI;
+                }
+            }
+
+            // What the demands ask for, in the units of response()
+            static float target(SimLoop & sim, uint8_t axis)
+            {
+                demands_t demands = {};
+                sim.receiver.getShapedDemands(demands);
+
+                switch (axis) {
+                    case AXIS_ROLL:
+                        return demands.roll * 2 * LEVEL_MAX_DEGREES;
+                    case AXIS_PITCH:
+                        return -demands.pitch * 2 * LEVEL_MAX_DEGREES;
+                    default:
+                        // Receiver reverses yaw; the rate controller drives the negated gyro z to the demand
+                        return -demands.yaw * 180 / M_PI;
+                }
+            }
+
+            StepResponse _responses[NAXES];
+            float _targets[NAXES] = {0};
+
+            // Squared estimate errors, summed while airborne
+            float _altitudeSquares = 0;
+            float _climbSquares = 0;
+            float _velocitySquares = 0;
+            uint32_t _estimates = 0;
+
+            void sampleEstimates(Hackflight & hackflight, Multirotor & multirotor)
+            {
+                const state_t & state = hackflight.getState();
+
+                float altitude = state.location[2] - multirotor.getAltitude();
+                float climb = state.inertialVel[2] - multirotor.getClimbRate();
+                float north = state.inertialVel[0] - multirotor.getVelocity(0);
+                float east = state.inertialVel[1] - multirotor.getVelocity(1);
+
+                _altitudeSquares += altitude * altitude;
+                _climbSquares += climb * climb;
+                _velocitySquares += north * north + east * east;
+                _estimates++;
+            }
+
+            Recorder _recorder;
+
+        public:
+
+            // Flies the test with the given gains.  With csv non-null, the flight is
+            // written to it at the quaternion rate; with log non-null, the flight log
+            // is recorded to it, with the inputs needed to replay it.  With estimate
+            // set, the StateEstimator supplies the altitude and velocities.
+            results_t run(const gains_t & gains, bool gyrosync=false, FILE * csv=NULL, LogSink * log=NULL, bool estimate=false)
+            {
+                SimVehicle vehicle(LOOP_MICROS);
+                SimLoop & sim = vehicle.sim;
+                Multirotor & multirotor = vehicle.multirotor;
+
+                Controllers controllers(gains);
+
+                vehicle.begin(estimate);
+
+                controllers.add(sim.hackflight, gyrosync);
+
+                if (log) {
+                    _recorder.setInputs(true);
+                    sim.hackflight.setRecorder(&_recorder, log, RECORDER_FREQ);
+                }
+
+                results_t results = {};
+
+                if (csv) {
+                    fprintf(csv, "time,throttle,roll,pitch,yaw,altitude,climb,roll_deg,pitch_deg,yawrate_dps,m1,m2,m3,m4\n");
+                }
+
+                while (sim.getSeconds() < END_SECONDS) {
+
+                    uint32_t usec = sim.board.getMicros();
+                    float t = usec / 1.e6f;
+
+                    if (usec % RECEIVER_MICROS < LOOP_MICROS) {
+                        flightScript(sim, t);
+                    }
+
+                    vehicle.step();
+
+                    if (usec % SimVehicle::QUATERNION_MICROS != 0) continue;
+
+                    // Sticks reach the controllers with the next receiver frame, so the
+                    // target is taken from the latest demands while the step is held
+                    for (uint8_t k=0; k<NAXES; ++k) {
+                        if (inStep(k, t)) {
+                            if (fabsf(t - stepStart(k)) < 1e-6f) {
+                                _responses[k].begin(t, response(multirotor, k));
+                            }
+                            _responses[k].sample(t, response(multirotor, k));
+                            _targets[k] = target(sim, k);
+                        }
+                        else if (fabsf(t - (stepStart(k) + STEP_SECONDS)) < 1e-6f) {
+                            _responses[k].end(_targets[k]);
+                        }
+                    }
+
+                    if (!multirotor.onGround()) {
+                        sampleEstimates(sim.hackflight, multirotor);
+                    }
+
+                    if (t >= HOLD_SECONDS + HOLD_SETTLE_SECONDS && t < stepStart(0)) {
+                        if (results.holdAltitude == 0) {
+                            results.holdAltitude = multirotor.getAltitude();
+                        }
+                        float error = fabsf(multirotor.getAltitude() - results.holdAltitude);
+                        if (error > results.holdError) {
+                            results.holdError = error;
+                        }
+                    }
+
+                    if (csv) {
+                        fprintf(csv, "%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,%.2f,%.2f,%.2f,%.3f,%.3f,%.3f,%.3f\n",
+                                t,
+                                throttleStick(t),
+                                inStep(AXIS_ROLL, t)  ? STEP_STICK : 0,
+                                inStep(AXIS_PITCH, t) ? STEP_STICK : 0,
+                                inStep(AXIS_YAW, t)   ? STEP_STICK : 0,
+                                multirotor.getAltitude(),
+                                multirotor.getClimbRate(),
+                                response(multirotor, AXIS_ROLL),
+                                response(multirotor, AXIS_PITCH),
+                                response(multirotor, AXIS_YAW),
+                                sim.motor(0).getValue(), sim.motor(1).getValue(), sim.motor(2).getValue(), sim.motor(3).getValue());
+                    }
+
+                    // No point flying on after a crash
+                    if (t > HOLD_SECONDS &&
+                            (multirotor.onGround() ||
+                             fabsf(response(multirotor, AXIS_ROLL)) > CRASH_DEGREES ||
+                             fabsf(response(multirotor, AXIS_PITCH)) > CRASH_DEGREES)) {
+                        results.crashed = true;
+                        break;
+                    }
+                }
+
+                for (uint8_t k=0; k<NAXES; ++k) {
+                    results.steps[k] = _responses[k].getMetrics();
+                }
+
+                results.saturation = vehicle.getSaturation();
+
+                if (_estimates > 0) {
+                    results.altitudeError = sqrtf(_altitudeSquares / _estimates);
+                    results.climbError = sqrtf(_climbSquares / _estimates);
+                    results.velocityError = sqrtf(_velocitySquares / _estimates);
+                }
+
+                // Drain what the recorder task hasn't got to yet
+                if (log) {
+                    const uint8_t * data = NULL;
+                    for (uint16_t count=_recorder.peek(data); count>0; count=_recorder.peek(data)) {
+                        uint16_t written = log->write(data, count);
+                        _recorder.consume(written);
+                        if (written == 0) break;
+                    }
+                }
+
+                return results;
+            }
+
+            Recorder * getRecorder(void)
+            {
+                return &_recorder;
+            }
+
+    }; // class StepTest
+
+} // namespace hf
@@ -0,0 +1,171 @@
+/*
+   Closes the loop between Hackflight and the Multirotor physics model: each
+   step flies the model on the motor values of the previous iteration, feeds
+   its sensor readings to the simulated IMU, rangefinder and optical-flow
+   sensor at their own rates, and runs one iteration of the flight loop.
+   Optionally, the StateEstimator fuses those readings and the barometer's.
+
+   Copyright (c) 2020 Simon D. Levy
+
+   This file is part of Hackflight.
+
+   Hackflight is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   Hackflight is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+   You should have received a copy of the GNU General Public License
+   along with Hackflight.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <string.h>
+
+#include "simloop.hpp"
+#include "multirotor.hpp"
+#include "sensors/rangefinders/sim.hpp"
+#include "sensors/opticalflow/sim.hpp"
+#include "sensors/surfacemount/barometer.hpp"
+#include "sensors/estimator.hpp"
+
+namespace hf {
+
+    class SimVehicle {
+
+        public:
+
+            // Sensor sample periods
+            static const uint32_t GYRO_MICROS       = 1000;   // 1 kHz gyro and accelerometer
+            static const uint32_t QUATERNION_MICROS = 5000;   // 200 Hz quaternion
+            static const uint32_t RANGE_MICROS      = 10000;  // 100 Hz rangefinder
+            static const uint32_t FLOW_MICROS       = 10000;  // 100 Hz optical flow
+            static const uint32_t BARO_MICROS       = 20000;  // 50 Hz barometer
+
+            // A range reading is this old when the rangefinder delivers it
+            static const uint32_t RANGE_LATENCY_MICROS = 20000;
+
+        private:
+
+            uint32_t _saturated = 0;
+            uint32_t _airborne = 0;
+
+            // Ranges not yet delivered, one per RANGE_MICROS, newest last
+            static const uint8_t RANGE_DELAY = RANGE_LATENCY_MICROS / RANGE_MICROS;
+            float _ranges[RANGE_DELAY+1] = {0};
+
+            bool due(uint32_t usec, uint32_t period)
+            {
+                return usec % period < sim.getLoopMicros();
+            }
+
+        public:
+
+            SimLoop        sim;
+            Multirotor     multirotor;
+            SimRangefinder rangefinder;
+            SimOpticalFlow opticalFlow;
+            Barometer      barometer;
+            StateEstimator estimator;
+
+            SimVehicle(uint32_t loopMicros=125, const Multirotor::params_t & params=Multirotor::defaultParams())
+                : sim(loopMicros), multirotor(params), rangefinder(RANGE_LATENCY_MICROS)
+            {
+            }
+
+            // With estimate set, the StateEstimator replaces the rangefinder's and
+            // optical-flow sensor's own estimates, and fuses the barometer too; the
+            // rangefinder is then read on its data-ready interrupt, at its full rate
+            void begin(bool estimate=false)
+            {
+                sim.begin();
+
+                // Ahead of the other sensors, so it predicts before they correct
+                if (estimate) {
+                    sim.hackflight.setEstimator(&estimator);
+                }
+
+                sim.hackflight.addSensor(&rangefinder);
+                sim.hackflight.addSensor(&opticalFlow);
+
+                if (estimate) {
+                    sim.hackflight.addSensor(&barometer);
+                    rangefinder.useInterrupt();
+                }
+            }
+
+            void step(void)
+            {
+                float motors[SimLoop::NMOTORS];
+
+                bool saturated = false;
+
+                for (uint8_t k=0; k<SimLoop::NMOTORS; ++k) {
+                    motors[k] = sim.motor(k).getValue();
+                    saturated = saturated || motors[k] <= 0 || motors[k] >= 1;
+                }
+
+                multirotor.update(motors, sim.getLoopMicros() * 1e-6f);
+
+                if (!multirotor.onGround()) {
+                    _airborne++;
+                    if (saturated) {
+                        _saturated++;
+                    }
+                }
+
+                uint32_t usec = sim.board.getMicros();
+
+                if (due(usec, QUATERNION_MICROS)) {
+                    float qw=0, qx=0, qy=0, qz=0;
+                    multirotor.getQuaternion(qw, qx, qy, qz);
+                    sim.imu.setQuaternion(qw, qx, qy, qz);
+                }
+
+                if (due(usec, RANGE_MICROS)) {
+                    memmove(_ranges, _ranges+1, RANGE_DELAY*sizeof(float));
+                    _ranges[RANGE_DELAY] = multirotor.getRangefinder();
+                    rangefinder.setDistance(_ranges[0]);
+
+                    // Does nothing unless the rangefinder is interrupt-driven
+                    rangefinder.interrupt(usec);
+                }
+
+                if (due(usec, BARO_MICROS)) {
+                    sim.imu.setBarometer(multirotor.getBarometer());
+                }
+
+                if (due(usec, FLOW_MICROS)) {
+                    int16_t dx=0, dy=0;
+                    multirotor.getOpticalFlow(dx, dy);
+                    opticalFlow.addMotionCount(dx, dy);
+                }
+
+                if (due(usec, GYRO_MICROS)) {
+
+                    float gx=0, gy=0, gz=0, ax=0, ay=0, az=0;
+                    multirotor.getGyrometer(gx, gy, gz);
+                    multirotor.getAccelerometer(ax, ay, az);
+                    sim.imu.setGyrometer(gx, gy, gz);
+                    sim.imu.setAccelerometer(ax, ay, az);
+
+                    // Does nothing unless the vehicle is gyro-synchronous
+                    sim.hackflight.gyroInterrupt();
+                }
+
+                sim.step();
+            }
+
+            // Fraction of airborne iterations with at least one motor at zero or full
+            float getSaturation(void)
+            {
+                return _airborne ? (float)_saturated / _airborne : 0;
+            }
+
+    }; // class SimVehicle
+
+} // namespace hf
@@ -34,7 +34,7 @@ class _MyArgumentParser(argparse.ArgumentParser):
         self.print_help()
         sys.exit(1)
 
-_request = msppg.serialize_STATE_Request()
+TELEMETRY_RATE_HZ = 50
 
 class _StateParser(msppg.Parser):
 
@@ -49,15 +49,15 @@ class _StateParser(msppg.Parser):
         # Visualizer object should provide a display() method
         self.viz = visualizer
 
-    def handle_STATE(self, altitude, variometer, positionX, positionY, heading, velocityForward, velocityRightward):
+    def handle_TELEMETRY(self, roll, pitch, yaw, altitude, variometer, positionX, positionY, heading,
+            velocityForward, velocityRightward, c1, c2, c3, c4, c5, c6, m1, m2, m3, m4):
 
         self.viz.display(altitude, positionX, positionY, math.degrees(heading))
 
-        self.writefun(_request)
-
     def begin(self):
 
-        self.writefun(_request)
+        # Subscribe once; the FC then pushes its state
+        self.writefun(msppg.serialize_SET_TELEMETRY_RATE(TELEMETRY_RATE_HZ))
 
         while True:
 
@@ -67,6 +67,7 @@ class _StateParser(msppg.Parser):
 
                 except KeyboardInterrupt:
 
+                    self.writefun(msppg.serialize_SET_TELEMETRY_RATE(0))
                     self.closefun()
                     break
 
@@ -30,6 +30,7 @@ namespace hf {
 
         friend class Hackflight;
         friend class SerialTask;
+        friend class Recorder;
 
         private:
 
@@ -145,6 +146,7 @@ namespace hf {
             {
                 for (uint8_t i = 0; i < _nmotors; i++) {
                     writeMotor(i, 0);
+                    _motorsPrev[i] = 0;
                 }
             }
 
@@ -32,17 +32,46 @@ namespace hf {
         friend class TimerTask;
         friend class SerialTask;
         friend class PidTask;
+        friend class Tracer;
 
         protected:
 
             //------------------------------------ Core functionality ----------------------------------------------------
             virtual float getTime(void) = 0;
 
+            // Boards with a microsecond counter should override this to skip the float conversion
+            virtual uint32_t getMicros(void) { return (uint32_t)(getTime() * 1e6f); }
+
+            // Free-running counter for stage tracing; CPU cycles where available, else microseconds
+            virtual uint32_t getCycleCount(void) { return 0; }
+
             //------------------------------- Serial communications via MSP ----------------------------------------------
             virtual uint8_t serialAvailableBytes(void) { return 0; }
             virtual uint8_t serialReadByte(void)  { return 1; }
             virtual void    serialWriteByte(uint8_t c) { (void)c; }
 
+            // Bulk transfers, each returning the number of bytes moved: up to n
+            // available bytes read, or as many of n written as there is room for.
+            // Boards with buffered serial ports should override these; the
+            // defaults go a byte at a time.
+            virtual uint16_t serialRead(uint8_t * buf, uint16_t n)
+            {
+                uint16_t count = serialAvailableBytes();
+                count = count < n ? count : n;
+                for (uint16_t k=0; k<count; ++k) {
+                    buf[k] = serialReadByte();
+                }
+                return count;
+            }
+
+            virtual uint16_t serialWrite(const uint8_t * buf, uint16_t n)
+            {
+                for (uint16_t k=0; k<n; ++k) {
+                    serialWriteByte(buf[k]);
+                }
+                return n;
+            }
+
             //----------------------------------------- Safety -----------------------------------------------------------
             virtual void showArmedStatus(bool armed) { (void)armed; }
             virtual void flashLed(bool shouldflash) { (void)shouldflash; }
@@ -67,6 +67,16 @@ namespace hf {
                 return micros() / 1.e6f;
             }
 
+            virtual uint32_t getMicros(void) override
+            {
+                return micros();
+            }
+
+            virtual uint32_t getCycleCount(void) override
+            {
+                return micros();
+            }
+
             void delaySeconds(float sec)
             {
                 delay((uint32_t)(1000*sec));
@@ -104,12 +114,48 @@ namespace hf {
                 }
             }
 
+            // Chooses the port once for all the bytes read, as serialAvailableBytes()
+            // does, and writes to the port last read from
+            virtual uint16_t serialRead(uint8_t * buf, uint16_t n) override
+            {
+                uint8_t available = serialAvailableBytes();
+
+                n = available < n ? available : n;
+
+                if (n == 0) return 0;
+
+                return _useSerialTelemetry ? serialTelemetryReadBytes(buf, n) : serialNormalReadBytes(buf, n);
+            }
+
+            virtual uint16_t serialWrite(const uint8_t * buf, uint16_t n) override
+            {
+                return _useSerialTelemetry ? serialTelemetryWriteBytes(buf, n) : serialNormalWriteBytes(buf, n);
+            }
+
             virtual uint8_t serialNormalAvailable(void) = 0;
 
             virtual uint8_t serialNormalRead(void) = 0;
 
             virtual void    serialNormalWrite(uint8_t c) = 0;
 
+            // Bulk versions of the above, for n bytes known to be available; boards
+            // whose ports are buffered should override these
+            virtual uint16_t serialNormalReadBytes(uint8_t * buf, uint16_t n)
+            {
+                for (uint16_t k=0; k<n; ++k) {
+                    buf[k] = serialNormalRead();
+                }
+                return n;
+            }
+
+            virtual uint16_t serialNormalWriteBytes(const uint8_t * buf, uint16_t n)
+            {
+                for (uint16_t k=0; k<n; ++k) {
+                    serialNormalWrite(buf[k]);
+                }
+                return n;
+            }
+
             virtual uint8_t serialTelemetryAvailable(void)
             {
                 return 0;
@@ -125,6 +171,22 @@ namespace hf {
                 (void)c;
             }
 
+            virtual uint16_t serialTelemetryReadBytes(uint8_t * buf, uint16_t n)
+            {
+                for (uint16_t k=0; k<n; ++k) {
+                    buf[k] = serialTelemetryRead();
+                }
+                return n;
+            }
+
+            virtual uint16_t serialTelemetryWriteBytes(const uint8_t * buf, uint16_t n)
+            {
+                for (uint16_t k=0; k<n; ++k) {
+                    serialTelemetryWrite(buf[k]);
+                }
+                return n;
+            }
+
             void showArmedStatus(bool armed)
             {
                 // Set LED to indicate armed
@@ -59,6 +59,16 @@ namespace hf {
                 Serial.write(c);
             }
 
+            uint16_t serialNormalReadBytes(uint8_t * buf, uint16_t n)
+            {
+                return Serial.readBytes((char *)buf, n);
+            }
+
+            uint16_t serialNormalWriteBytes(const uint8_t * buf, uint16_t n)
+            {
+                return Serial.write(buf, n);
+            }
+
         public:
 
             static void powerPins(uint8_t pwr, uint8_t gnd)
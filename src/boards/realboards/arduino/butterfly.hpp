@@ -44,6 +44,16 @@ namespace hf {
                 Serial2.write(c);
             }
 
+            virtual uint16_t serialTelemetryReadBytes(uint8_t * buf, uint16_t n) override
+            {
+                return Serial2.readBytes((char *)buf, n);
+            }
+
+            virtual uint16_t serialTelemetryWriteBytes(const uint8_t * buf, uint16_t n) override
+            {
+                return Serial2.write(buf, n);
+            }
+
          public:
 
             Butterfly(void) 
@@ -44,6 +44,16 @@ namespace hf {
                 Serial1.write(c);
             }
 
+            uint16_t serialTelemetryReadBytes(uint8_t * buf, uint16_t n) override
+            {
+                return Serial1.readBytes((char *)buf, n);
+            }
+
+            uint16_t serialTelemetryWriteBytes(const uint8_t * buf, uint16_t n) override
+            {
+                return Serial1.write(buf, n);
+            }
+
         public:
 
             MockBoard(uint8_t ledPin, bool ledInverted=false) 
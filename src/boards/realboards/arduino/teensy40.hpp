@@ -27,6 +27,13 @@ namespace hf {
 
     class Teensy40 : public ArduinoBoard {
 
+        protected:
+
+            uint32_t getCycleCount(void) override
+            {
+                return ARM_DWT_CYCCNT;
+            }
+
          public:
 
             Teensy40(void) 
@@ -39,6 +39,11 @@ namespace hf {
 
         protected:
 
+            uint32_t getCycleCount(void) override
+            {
+                return ESP.getCycleCount();
+            }
+
             void setLed(bool isOn) 
             { 
                 tp.DotStar_SetPixelColor(0, isOn?255:0, 0);
@@ -59,6 +64,16 @@ namespace hf {
                 Serial.write(c);
             }
 
+            uint16_t serialNormalReadBytes(uint8_t * buf, uint16_t n) override
+            {
+                return Serial.readBytes((char *)buf, n);
+            }
+
+            uint16_t serialNormalWriteBytes(const uint8_t * buf, uint16_t n) override
+            {
+                return Serial.write(buf, n);
+            }
+
          public:
 
             TinyPico(void) 
@@ -0,0 +1,218 @@
+/*
+   Simulated board for running Hackflight on a host computer
+
+   Time comes from a virtual clock that the caller advances explicitly, so a
+   flight loop can run much faster than real time and always produces the
+   same results for the same inputs.
+
+   Copyright (c) 2020 Simon D. Levy
+
+   This file is part of Hackflight.
+
+   Hackflight is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   Hackflight is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+   You should have received a copy of the GNU General Public License
+   along with Hackflight.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#else
+#include <time.h>
+#endif
+
+#include "board.hpp"
+
+namespace hf {
+
+    class SimBoard : public Board {
+
+        private:
+
+            // Big enough for several MSP messages in each direction
+            static const uint16_t SERIAL_BUFSIZE = 256;
+
+            // Virtual clock
+            uint32_t _usec = 0;
+
+            // Serial input from simulated GCS
+            uint8_t  _inbuf[SERIAL_BUFSIZE] = {0};
+            uint16_t _inhead = 0;
+            uint16_t _intail = 0;
+
+            // Serial output to simulated GCS
+            uint8_t  _outbuf[SERIAL_BUFSIZE] = {0};
+            uint16_t _outhead = 0;
+            uint16_t _outtail = 0;
+
+            // Status LED
+            bool _ledArmed = false;
+            bool _ledFlashing = false;
+
+            static bool push(uint8_t * buf, uint16_t & head, uint16_t tail, uint8_t c)
+            {
+                uint16_t next = (head + 1) % SERIAL_BUFSIZE;
+
+                // Drop the byte if full, as a real UART would
+                if (next == tail) {
+                    return false;
+                }
+
+                buf[head] = c;
+                head = next;
+                return true;
+            }
+
+            // Bulk versions of push() and of taking a byte, in at most two
+            // contiguous pieces; put() drops what doesn't fit
+            static uint16_t put(uint8_t * ring, uint16_t & head, uint16_t tail, const uint8_t * buf, uint16_t n)
+            {
+                uint16_t room = (tail + SERIAL_BUFSIZE - head - 1) % SERIAL_BUFSIZE;
+                uint16_t count = n < room ? n : room;
+                uint16_t first = SERIAL_BUFSIZE - head;
+                first = count < first ? count : first;
+
+                memcpy(&ring[head], buf, first);
+                memcpy(ring, &buf[first], count - first);
+                head = (head + count) % SERIAL_BUFSIZE;
+
+                return count;
+            }
+
+            static uint16_t get(const uint8_t * ring, uint16_t head, uint16_t & tail, uint8_t * buf, uint16_t n)
+            {
+                uint16_t available = (head + SERIAL_BUFSIZE - tail) % SERIAL_BUFSIZE;
+                uint16_t count = n < available ? n : available;
+                uint16_t first = SERIAL_BUFSIZE - tail;
+                first = count < first ? count : first;
+
+                memcpy(buf, &ring[tail], first);
+                memcpy(&buf[first], ring, count - first);
+                tail = (tail + count) % SERIAL_BUFSIZE;
+
+                return count;
+            }
+
+        protected:
+
+            // Board overrides ---------------------------------------------------
+
+            virtual float getTime(void) override
+            {
+                return _usec / 1.e6f;
+            }
+
+            // Tracing measures the host CPU, not the virtual clock
+            virtual uint32_t getCycleCount(void) override
+            {
+#if defined(__x86_64__) || defined(__i386__)
+                return (uint32_t)__rdtsc();
+#else
+                struct timespec ts;
+                clock_gettime(CLOCK_MONOTONIC, &ts);
+                return (uint32_t)(ts.tv_sec * 1000000000ull + ts.tv_nsec);
+#endif
+            }
+
+            virtual uint8_t serialAvailableBytes(void) override
+            {
+                uint16_t count = (_inhead + SERIAL_BUFSIZE - _intail) % SERIAL_BUFSIZE;
+                return count > 255 ? 255 : count;
+            }
+
+            virtual uint8_t serialReadByte(void) override
+            {
+                uint8_t c = _inbuf[_intail];
+                _intail = (_intail + 1) % SERIAL_BUFSIZE;
+                return c;
+            }
+
+            virtual void serialWriteByte(uint8_t c) override
+            {
+                push(_outbuf, _outhead, _outtail, c);
+            }
+
+            virtual uint16_t serialRead(uint8_t * buf, uint16_t n) override
+            {
+                return get(_inbuf, _inhead, _intail, buf, n);
+            }
+
+            virtual uint16_t serialWrite(const uint8_t * buf, uint16_t n) override
+            {
+                return put(_outbuf, _outhead, _outtail, buf, n);
+            }
+
+            virtual void showArmedStatus(bool armed) override
+            {
+                _ledArmed = armed;
+            }
+
+            virtual void flashLed(bool shouldflash) override
+            {
+                _ledFlashing = shouldflash;
+            }
+
+        public:
+
+            // Virtual clock -------------------------------------------------------
+
+            void setMicros(uint32_t usec)
+            {
+                _usec = usec;
+            }
+
+            void advanceMicros(uint32_t usec)
+            {
+                _usec += usec;
+            }
+
+            virtual uint32_t getMicros(void) override
+            {
+                return _usec;
+            }
+
+            // Simulated GCS side of the serial link -------------------------------
+
+            uint16_t serialInject(const uint8_t * bytes, uint16_t count)
+            {
+                return put(_inbuf, _inhead, _intail, bytes, count);
+            }
+
+            uint16_t serialDrain(uint8_t * bytes, uint16_t maxcount)
+            {
+                return get(_outbuf, _outhead, _outtail, bytes, maxcount);
+            }
+
+            // LED status ---------------------------------------------------------
+
+            bool ledArmed(void)
+            {
+                return _ledArmed;
+            }
+
+            bool ledFlashing(void)
+            {
+                return _ledFlashing;
+            }
+
+    }; // class SimBoard
+
+    void Board::outbuf(char * buf)
+    {
+        fputs(buf, stdout);
+    }
+
+} // namespace hf
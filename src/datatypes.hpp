@@ -20,6 +20,8 @@
 
 #pragma once
 
+#include <stdint.h>
+
 namespace hf {
 
     enum {
@@ -51,4 +53,15 @@ namespace hf {
 
     } state_t;
 
+    // Captured once at the start of each loop iteration, so that every stage agrees on "now".
+    // Time is kept as integer microseconds, which never loses resolution; compute intervals
+    // as integers and convert the result to seconds.
+    typedef struct {
+
+        uint64_t usec;   // Board::getMicros(), extended past its 32-bit wraparound
+        uint32_t dusec;  // since the previous iteration
+        float    dt;     // dusec in seconds
+
+    } timing_t;
+
 } // namespace hf
@@ -5,6 +5,19 @@
     debug messages.  Your Board implementation should provide and outbuf(char
     method that displays the message in an appropriate way.
 
+    printf() formats and writes the message at once, so it stalls the caller
+    for as long as the write takes.  From the flight loop, use trace()
+    instead: it only queues the format string and the raw arguments, and the
+    DebugTask formats them later at low priority -- or, with a sink set,
+    sends them in binary for formatting on the host by
+    extras/debug/python/decodetrace.py.  The binary records are:
+
+      FORMAT:  'F', id, length, the format string (sent before its first use)
+      EVENT:   'E', id, argument count, then for each argument a type byte
+               and a little-endian int32, uint32, or float32, or for a string
+               a length byte and the characters
+      DROPPED: 'D', uint32 count of events lost so far to a full queue
+
     Copyright (c) 2018 Simon D. Levy
 
     This file is part of Hackflight.
@@ -26,14 +39,57 @@
 
 #include <stdarg.h>
 #include <stdio.h>
+#include <string.h>
 
 #include "board.hpp"
+#include "logsink.hpp"
+
+// Queue of trace() events; must be a power of two
+#ifndef HACKFLIGHT_DEBUG_EVENTS
+#define HACKFLIGHT_DEBUG_EVENTS 32
+#endif
 
 namespace hf {
 
     class Debugger {
 
         friend class Hackflight;
+        friend class DebugTask;
+
+        public:
+
+            static const uint8_t MAX_ARGS = 6;
+
+            static const uint8_t SIZE = HACKFLIGHT_DEBUG_EVENTS;
+
+            typedef enum {
+                ARG_INT,
+                ARG_UNSIGNED,
+                ARG_FLOAT,
+                ARG_STRING
+            } arg_t;
+
+            typedef enum {
+                RECORD_FORMAT  = 'F',
+                RECORD_EVENT   = 'E',
+                RECORD_DROPPED = 'D'
+            } record_t;
+
+            // Integers are kept to 32 bits
+            typedef struct {
+
+                const char * fmt;
+                uint8_t count;
+                uint8_t types[MAX_ARGS];
+
+                union {
+                    int32_t      i;
+                    uint32_t     u;
+                    float        f;
+                    const char * s;
+                } args[MAX_ARGS];
+
+            } event_t;
 
         private:
 
@@ -41,10 +97,236 @@ namespace hf {
 
             static constexpr float _adhoc_period = 1.f / ADHOC_RATE;
 
+            // Formats remembered by the host, so each is sent only once
+            static const uint8_t MAX_FORMATS = 32;
+
+            // Longest string argument sent in binary
+            static const uint8_t MAX_STRING = 32;
+
+            // A FORMAT record is the longest
+            static const uint16_t MAX_RECORD = 3 + 255;
+
+            // Single producer (the loop) and single consumer (the DebugTask), so no
+            // locking: the producer only advances head and the consumer only advances tail
+            typedef struct {
+
+                event_t events[SIZE];
+                volatile uint8_t head;
+                volatile uint8_t tail;
+
+                uint32_t dropped;
+
+            } queue_t;
+
+            // Shared by every caller of the static trace()
+            static queue_t & queue(void)
+            {
+                static queue_t q;
+                return q;
+            }
+
             Board * _board;
 
             float _prevTime;
 
+            // Binary output, if set
+            LogSink * _sink = NULL;
+
+            const char * _formats[MAX_FORMATS] = {NULL};
+            uint8_t _formatCount = 0;
+
+            // The record being written to the sink
+            uint8_t _record[MAX_RECORD] = {0};
+            uint16_t _recordSize = 0;
+            uint16_t _recordSent = 0;
+
+            uint32_t _droppedSent = 0;
+
+            // The event waiting for its format to be sent
+            event_t _event = {};
+            bool _haveEvent = false;
+
+            static void setType(event_t & e, uint8_t type)
+            {
+                e.types[e.count++] = type;
+            }
+
+            static void store(event_t & e, int v)                { e.args[e.count].i = v; setType(e, ARG_INT); }
+            static void store(event_t & e, long v)               { e.args[e.count].i = (int32_t)v; setType(e, ARG_INT); }
+            static void store(event_t & e, long long v)          { e.args[e.count].i = (int32_t)v; setType(e, ARG_INT); }
+            static void store(event_t & e, unsigned v)           { e.args[e.count].u = v; setType(e, ARG_UNSIGNED); }
+            static void store(event_t & e, unsigned long v)      { e.args[e.count].u = (uint32_t)v; setType(e, ARG_UNSIGNED); }
+            static void store(event_t & e, unsigned long long v) { e.args[e.count].u = (uint32_t)v; setType(e, ARG_UNSIGNED); }
+            static void store(event_t & e, double v)             { e.args[e.count].f = (float)v; setType(e, ARG_FLOAT); }
+            static void store(event_t & e, const char * v)       { e.args[e.count].s = v; setType(e, ARG_STRING); }
+
+            static void capture(event_t & e)
+            {
+                (void)e;
+            }
+
+            template <typename T, typename... Rest>
+            static void capture(event_t & e, T first, Rest... rest)
+            {
+                store(e, first);
+                capture(e, rest...);
+            }
+
+            static bool isConversion(char c)
+            {
+                return c && strchr("diouxXcsfFeEgGaA", c);
+            }
+
+            // Formats one argument with its conversion, as printf() would have
+            static int formatArg(char * out, uint16_t size, const char * spec, char conversion,
+                    uint8_t type, const event_t & e, uint8_t index)
+            {
+                float number = type == ARG_FLOAT ? e.args[index].f :
+                               type == ARG_UNSIGNED ? (float)e.args[index].u :
+                               type == ARG_INT ? (float)e.args[index].i : 0;
+
+                switch (conversion) {
+
+                    case 's':
+                        return snprintf(out, size, spec, type == ARG_STRING ? e.args[index].s : "?");
+
+                    case 'f': case 'F': case 'e': case 'E': case 'g': case 'G': case 'a': case 'A':
+                        return snprintf(out, size, spec, (double)number);
+
+                    case 'd': case 'i': case 'c':
+                        return snprintf(out, size, spec, type == ARG_INT ? (int)e.args[index].i : (int)number);
+
+                    default:
+                        return snprintf(out, size, spec, type == ARG_UNSIGNED ? (unsigned)e.args[index].u : (unsigned)number);
+                }
+            }
+
+            void put(uint8_t byte)
+            {
+                _record[_recordSize++] = byte;
+            }
+
+            void put32(uint32_t value)
+            {
+                for (uint8_t k=0; k<4; ++k) {
+                    put((value >> (8*k)) & 0xFF);
+                }
+            }
+
+            // Returns the event's format ID, or -1 after staging the FORMAT record
+            // that must be sent first
+            int16_t formatId(const char * fmt)
+            {
+                for (uint8_t k=0; k<_formatCount; ++k) {
+                    if (_formats[k] == fmt) {
+                        return k;
+                    }
+                }
+
+                // When the table is full, start again; the host takes the new definitions
+                if (_formatCount == MAX_FORMATS) {
+                    _formatCount = 0;
+                }
+
+                uint8_t id = _formatCount++;
+                _formats[id] = fmt;
+
+                uint16_t length = strlen(fmt);
+                if (length > 255) {
+                    length = 255;
+                }
+
+                _recordSize = 0;
+                put(RECORD_FORMAT);
+                put(id);
+                put(length);
+                for (uint16_t k=0; k<length; ++k) {
+                    put(fmt[k]);
+                }
+
+                return -1;
+            }
+
+            void stageEvent(uint8_t id, const event_t & e)
+            {
+                _recordSize = 0;
+                put(RECORD_EVENT);
+                put(id);
+                put(e.count);
+
+                for (uint8_t k=0; k<e.count; ++k) {
+
+                    put(e.types[k]);
+
+                    if (e.types[k] == ARG_STRING) {
+                        const char * str = e.args[k].s ? e.args[k].s : "";
+                        uint8_t length = 0;
+                        while (str[length] && length < MAX_STRING) {
+                            length++;
+                        }
+                        put(length);
+                        for (uint8_t j=0; j<length; ++j) {
+                            put(str[j]);
+                        }
+                    }
+                    else {
+                        put32(e.args[k].u);
+                    }
+                }
+            }
+
+            // Sends what's left of the staged record; true when it's all gone
+            bool sendRecord(void)
+            {
+                while (_recordSent < _recordSize) {
+                    uint16_t written = _sink->write(&_record[_recordSent], _recordSize - _recordSent);
+                    if (written == 0) {
+                        return false;
+                    }
+                    _recordSent += written;
+                }
+
+                _recordSize = 0;
+                _recordSent = 0;
+
+                return true;
+            }
+
+            // Stages the next binary record, if any
+            bool stageNext(void)
+            {
+                if (_haveEvent) {
+                    stageEvent(formatId(_event.fmt), _event);
+                    _haveEvent = false;
+                    return true;
+                }
+
+                uint32_t dropped = queue().dropped;
+                if (dropped != _droppedSent) {
+                    _recordSize = 0;
+                    put(RECORD_DROPPED);
+                    put32(dropped);
+                    _droppedSent = dropped;
+                    return true;
+                }
+
+                if (!read(_event)) {
+                    return false;
+                }
+
+                int16_t id = formatId(_event.fmt);
+
+                // The FORMAT record goes first
+                if (id < 0) {
+                    _haveEvent = true;
+                    return true;
+                }
+
+                stageEvent(id, _event);
+
+                return true;
+            }
+
         protected:
 
             void init(Board * board)
@@ -52,8 +334,135 @@ namespace hf {
                 _board = board;
             }
 
+            // Consumer side, called from the DebugTask: formats or sends up to
+            // maxEvents of the oldest events
+            void drain(uint8_t maxEvents)
+            {
+                for (uint8_t k=0; k<maxEvents; ++k) {
+
+                    if (_sink) {
+                        if (!sendRecord()) return;
+                        if (!stageNext()) return;
+                        if (!sendRecord()) return;
+                        continue;
+                    }
+
+                    char buf[200];
+
+                    uint32_t dropped = queue().dropped;
+                    if (dropped != _droppedSent) {
+                        snprintf(buf, sizeof(buf), "(%u events dropped so far)\n", (unsigned)dropped);
+                        Board::outbuf(buf);
+                        _droppedSent = dropped;
+                        continue;
+                    }
+
+                    event_t event;
+                    if (!read(event)) return;
+
+                    format(event, buf, sizeof(buf));
+                    Board::outbuf(buf);
+                }
+            }
+
         public:
 
+            // Queues the message for the DebugTask to format, without formatting or
+            // writing anything here.  Call from one context only (normally the loop);
+            // string arguments must outlive the queue, as literals do.  The queue
+            // drops new events when full.
+            template <typename... Args>
+            static void trace(const char * fmt, Args... args)
+            {
+                static_assert(sizeof...(Args) <= MAX_ARGS, "too many arguments for Debugger::trace()");
+
+                queue_t & q = queue();
+
+                uint8_t head = q.head;
+                uint8_t next = (head + 1) & (SIZE - 1);
+
+                if (next == q.tail) {
+                    q.dropped++;
+                    return;
+                }
+
+                event_t & e = q.events[head];
+                e.fmt = fmt;
+                e.count = 0;
+                capture(e, args...);
+
+                q.head = next;
+            }
+
+            // Removes and returns the oldest event; false if empty
+            static bool read(event_t & event)
+            {
+                queue_t & q = queue();
+
+                if (q.tail == q.head) {
+                    return false;
+                }
+
+                event = q.events[q.tail];
+
+                q.tail = (q.tail + 1) & (SIZE - 1);
+
+                return true;
+            }
+
+            static uint32_t getDropped(void)
+            {
+                return queue().dropped;
+            }
+
+            // Formats an event as printf() would have.  Length modifiers are ignored,
+            // and a '*' width or precision isn't supported.
+            static void format(const event_t & e, char * out, uint16_t size)
+            {
+                uint16_t n = 0;
+                uint8_t index = 0;
+
+                for (const char * p = e.fmt; *p && n < size-1; ) {
+
+                    if (*p != '%') {
+                        out[n++] = *p++;
+                        continue;
+                    }
+
+                    if (p[1] == '%') {
+                        out[n++] = '%';
+                        p += 2;
+                        continue;
+                    }
+
+                    // Flags, width, and precision, without length modifiers
+                    char spec[16];
+                    uint8_t length = 0;
+                    spec[length++] = *p++;
+                    while (*p && !isConversion(*p)) {
+                        if (!strchr("hlLjzt*", *p) && length < sizeof(spec)-2) {
+                            spec[length++] = *p;
+                        }
+                        p++;
+                    }
+
+                    if (!*p || index >= e.count) break;
+
+                    char conversion = *p++;
+                    spec[length++] = conversion;
+                    spec[length] = 0;
+
+                    int written = formatArg(&out[n], size - n, spec, conversion, e.types[index], e, index);
+                    index++;
+
+                    if (written > 0) {
+                        n = n + written < size-1 ? n + written : size-1;
+                    }
+                }
+
+                out[n] = 0;
+            }
+
             static void printf(const char * fmt, ...)
             {
                 va_list ap;
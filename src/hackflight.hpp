@@ -20,6 +20,8 @@
 
 #pragma once
 
+#include <atomic>
+
 #include "debugger.hpp"
 #include "mspparser.hpp"
 #include "imu.hpp"
@@ -28,15 +30,32 @@
 #include "receiver.hpp"
 #include "datatypes.hpp"
 #include "pidcontroller.hpp"
+#include "stagetimer.hpp"
+#include "tracer.hpp"
+#include "recorder.hpp"
+#include "logsink.hpp"
+#include "scheduler.hpp"
+#include "sensorchain.hpp"
 #include "motor.hpp"
 #include "actuators/mixer.hpp"
 #include "actuators/rxproxy.hpp"
 #include "sensors/surfacemount.hpp"
+#include "sensors/estimator.hpp"
 #include "timertasks/pidtask.hpp"
 #include "timertasks/serialtask.hpp"
+#include "timertasks/recordertask.hpp"
+#include "timertasks/debugtask.hpp"
 #include "sensors/surfacemount/gyrometer.hpp"
 #include "sensors/surfacemount/quaternion.hpp"
 
+// Sketches that use a SensorChain for their optional sensors can define this as
+// 2, leaving room for the mandatory gyrometer and quaternion, or as 3 if they
+// also call Hackflight::setEstimator().  Sensors added beyond it are ignored.
+// At most 255, since the count is a byte.
+#ifndef HACKFLIGHT_MAX_SENSORS
+#define HACKFLIGHT_MAX_SENSORS 255
+#endif
+
 namespace hf {
 
     class Hackflight {
@@ -48,14 +67,24 @@ namespace hf {
             // Supports periodic ad-hoc debugging
             Debugger _debugger;
 
+            // Formats Debugger::trace() messages at low priority
+            DebugTask _debugTask;
+
             // Mixer or receiver proxy
             Actuator * _actuator = NULL;
 
             RXProxy * _proxy = NULL;
 
             // Sensors 
-            Sensor * _sensors[256] = {NULL};
+            Sensor * _sensors[HACKFLIGHT_MAX_SENSORS] = {NULL};
             uint8_t _sensor_count = 0;
+            static_assert(HACKFLIGHT_MAX_SENSORS <= 255, "HACKFLIGHT_MAX_SENSORS too large for the sensor count");
+
+            // Optional compile-time sensor list, checked after the sensors above
+            SensorChainBase * _sensorChain = NULL;
+
+            // Optional inertial estimator, fusing the other sensors' readings
+            StateEstimator * _estimator = NULL;
 
             // Safety
             bool _safeToArm = false;
@@ -73,6 +102,19 @@ namespace hf {
             // Serial timer task for GCS
             SerialTask _serialTask;
 
+            // Optional flight log, drained at low priority
+            Recorder * _recorder = NULL;
+            RecorderTask _recorderTask;
+
+            // Runs the timer tasks by rate
+            Scheduler _scheduler;
+
+            // Optional per-stage timing
+            StageTimer * _stageTimer = NULL;
+
+            // Gyro samples drive the inner loop through gyroInterrupt() rather than being polled
+            bool _gyroSynchronous = false;
+
              // Mandatory sensors on the board
             Gyrometer _gyrometer;
             Quaternion _quaternion; // not really a sensor, but we treat it like one!
@@ -84,27 +126,27 @@ namespace hf {
 
            void checkQuaternion(void)
             {
-                // Some quaternion filters may need to know the current time
-                float time = _board->getTime();
-
                 // If quaternion data ready
-                if (_quaternion.ready(time)) {
+                if (_quaternion.ready(_timing)) {
+
+                    float q[4] = {_quaternion._w, _quaternion._x, _quaternion._y, _quaternion._z};
+                    Recorder::recordInput(_recorder, Recorder::INPUT_QUATERNION, _timing, q);
 
                     // Update state with new quaternion to yield Euler angles
-                    _quaternion.modifyState(_state, time);
+                    _quaternion.modifyState(_state, _timing);
                 }
             }
 
             void checkGyrometer(void)
             {
-                // Some gyrometers may need to know the current time
-                float time = _board->getTime();
-
                 // If gyrometer data ready
-                if (_gyrometer.ready(time)) {
+                if (_gyrometer.ready(_timing)) {
+
+                    float g[3] = {_gyrometer._x, _gyrometer._y, _gyrometer._z};
+                    Recorder::recordInput(_recorder, Recorder::INPUT_GYRO, _timing, g);
 
                     // Update state with gyro rates
-                    _gyrometer.modifyState(_state, time);
+                    _gyrometer.modifyState(_state, _timing);
                 }
             }
 
@@ -115,27 +157,74 @@ namespace hf {
             // Vehicle state
             state_t _state;
 
+            // Time of the current loop iteration, shared by every stage
+            timing_t _timing;
+
+            // Copies of _timing for gyroInterrupt(), double-buffered like the PidTask's
+            // held demands so that an interrupt never sees a half-written 64-bit time
+            timing_t _heldTiming[2] = {};
+            volatile uint8_t _heldTimingIndex = 0;
+
+            void publishTiming(void)
+            {
+                uint8_t next = 1 - _heldTimingIndex;
+                _heldTiming[next] = _timing;
+                std::atomic_signal_fence(std::memory_order_release);
+                _heldTimingIndex = next;
+            }
+
+            // One clock read and one conversion per call.  The unsigned 32-bit difference
+            // is correct across the board counter's wraparound (every 71 minutes for
+            // micros()), so accumulating it gives a 64-bit time that never wraps.
+            void updateTiming(timing_t & timing)
+            {
+                uint32_t usec = _board->getMicros();
+
+                timing.dusec = usec - (uint32_t)timing.usec;
+                timing.usec += timing.dusec;
+                timing.dt    = timing.dusec * 1e-6f;
+            }
+
             void checkOptionalSensors(void)
             {
                 for (uint8_t k=0; k<_sensor_count; ++k) {
+                    StageTimer::begin(_stageTimer, StageTimer::STAGE_SENSOR, k);
                     Sensor * sensor = _sensors[k];
-                    float time = _board->getTime();
-                    if (sensor->ready(time)) {
-                        sensor->modifyState(_state, time);
+                    if (sensor->ready(_timing)) {
+                        sensor->modifyState(_state, _timing);
                     }
+                    StageTimer::end(_stageTimer, StageTimer::STAGE_SENSOR, k);
+                }
+
+                if (_sensorChain) {
+                    StageTimer::begin(_stageTimer, StageTimer::STAGE_SENSOR, _sensor_count);
+                    _sensorChain->check(_state, _timing);
+                    StageTimer::end(_stageTimer, StageTimer::STAGE_SENSOR, _sensor_count);
                 }
             }
 
-            void add_sensor(Sensor * sensor)
+            bool add_sensor(Sensor * sensor)
             {
+                if (_sensor_count >= HACKFLIGHT_MAX_SENSORS) {
+                    Debugger::printf("No room for another sensor: increase HACKFLIGHT_MAX_SENSORS\n");
+                    return false;
+                }
+
                 _sensors[_sensor_count++] = sensor;
+
+                sensor->_recorder = _recorder;
+                sensor->_estimator = _estimator;
+
+                return true;
             }
 
-            void add_sensor(SurfaceMountSensor * sensor, IMU * imu) 
+            bool add_sensor(SurfaceMountSensor * sensor, IMU * imu) 
             {
-                add_sensor(sensor);
+                if (!add_sensor(sensor)) return false;
 
                 sensor->imu = imu;
+
+                return true;
             }
 
             void general_init(Board * board, Receiver * receiver, Actuator * actuator)
@@ -154,6 +243,11 @@ namespace hf {
                 // Initialize state
                 memset(&_state, 0, sizeof(state_t));
 
+                // Initialize timing, so the first delta is from startup
+                memset(&_timing, 0, sizeof(timing_t));
+                _timing.usec = _board->getMicros();
+                publishTiming();
+
                 // Initialize the receiver
                 _receiver->begin();
 
@@ -162,14 +256,26 @@ namespace hf {
 
                 // Initialize timer task for PID controllers
                 _pidTask.init(_board, _receiver, _actuator, &_state);
+
+                // PID task is fastest, so the scheduler gives it highest priority
+                _scheduler = Scheduler();
+                _scheduler.addTask(&_pidTask);
+
+                _debugTask.init(board, &_debugger);
+                _scheduler.addTask(&_debugTask);
             }
 
             void checkReceiver(void)
             {
+                bool lostSignal = _receiver->lostSignal();
+
+                Recorder::recordLostSignal(_recorder, _timing, lostSignal);
+
                 // Sync failsafe to receiver
-                if (_receiver->lostSignal() && _state.armed) {
-                    _actuator->cut();
+                if (lostSignal && _state.armed) {
+                    // Disarm before cutting, so a gyro interrupt in between can't restart the motors
                     _state.armed = false;
+                    _actuator->cut();
                     _state.failsafe = true;
                     _board->showArmedStatus(false);
                     return;
@@ -178,6 +284,8 @@ namespace hf {
                 // Check whether receiver data is available
                 if (!_receiver->getDemands(_state.rotation[AXIS_YAW] - _yawInitial)) return;
 
+                Recorder::recordInput(_recorder, Recorder::INPUT_RECEIVER, _timing, _receiver->rawvals);
+
                 // Disarm
                 if (_state.armed && !_receiver->getAux1State()) {
                     _state.armed = false;
@@ -262,14 +370,18 @@ namespace hf {
             void updateFull(void)
             {
                 // Check mandatory sensors
-                checkGyrometer();
+                if (!_gyroSynchronous) {
+                    StageTimer::begin(_stageTimer, StageTimer::STAGE_GYROMETER);
+                    checkGyrometer();
+                    StageTimer::end(_stageTimer, StageTimer::STAGE_GYROMETER);
+                }
+
+                StageTimer::begin(_stageTimer, StageTimer::STAGE_QUATERNION);
                 checkQuaternion();
+                StageTimer::end(_stageTimer, StageTimer::STAGE_QUATERNION);
 
                 // Check optional sensors
                 checkOptionalSensors();
-
-                // Update serial comms task
-                _serialTask.update();
             }
 
         public:
@@ -285,6 +397,7 @@ namespace hf {
 
                 // Initialize serial timer task
                 _serialTask.init(board, &_state, mixer, receiver);
+                _scheduler.addTask(&_serialTask);
 
                 // Support safety override by simulator
                 _state.armed = armed;
@@ -326,21 +439,186 @@ namespace hf {
                 add_sensor(sensor);
             }
 
-            void addPidController(PidController * pidController, uint8_t auxState=0) 
+            // For surface-mount sensors such as the barometer, which are read through the IMU
+            void addSensor(SurfaceMountSensor * sensor) 
+            {
+                add_sensor(sensor, _imu);
+            }
+
+            // Checks a SensorChain after any sensors added with addSensor().  Call after
+            // init(), which gets the IMU that surface-mount sensors in the chain read.
+            void setSensorChain(SensorChainBase * chain)
+            {
+                _sensorChain = chain;
+
+                chain->setImu(_imu);
+
+                if (_estimator) {
+                    chain->setEstimator(_estimator);
+                }
+            }
+
+            // Runs the estimator on each accelerometer reading, and has the attitude,
+            // rangefinder, barometer, and optical-flow sensors pass their readings to it
+            // instead of setting the state themselves.  Call after init().  The estimator
+            // takes a slot of HACKFLIGHT_MAX_SENSORS; without one, it isn't used.  It
+            // takes the accelerometer readings, which an Accelerometer sensor can't share.
+            void setEstimator(StateEstimator * estimator)
+            {
+                if (!add_sensor(estimator, _imu)) return;
+
+                _estimator = estimator;
+
+                _quaternion._estimator = estimator;
+
+                for (uint8_t k=0; k<_sensor_count; ++k) {
+                    _sensors[k]->_estimator = estimator;
+                }
+
+                if (_sensorChain) {
+                    _sensorChain->setEstimator(estimator);
+                }
+            }
+
+            // For programs on the host, such as the simulator, that check the estimates
+            const state_t & getState(void)
+            {
+                return _state;
+            }
+
+            // A nonzero frequency runs the controller at that rate (if lower than the PID
+            // task's) and holds its output in between; zero runs it on every PID update
+            void addPidController(PidController * pidController, uint8_t auxState=0, float freq=0) 
+            {
+                _pidTask.addPidController(pidController, auxState, freq);
+            }
+
+            // Runs a PidChain ahead of any controllers added with addPidController()
+            void setPidChain(PidChainBase * chain)
+            {
+                _pidTask._chain = chain;
+            }
+
+            // Rate of the PID task, normally the gyro rate for the inner loop.  PID gains
+            // are per update, so changing the rate may require retuning.
+            void setPidFrequency(float freq)
+            {
+                _pidTask.setFrequency(freq);
+                _scheduler.sort();
+            }
+
+            // Runs the given controller (normally RatePid) and the mixer on each new gyro
+            // sample, from gyroInterrupt(), instead of in the PID timer task.  Controllers
+            // added with addPidController() become the outer loop, and their demands are
+            // held between runs of the PID task.  Don't add the inner controller there too.
+            void setGyroSynchronous(PidController * innerController, uint8_t auxState=0)
+            {
+                _pidTask.setInnerController(innerController, auxState);
+
+                // The gyro is no longer polled as a sensor
+                uint8_t count = 0;
+                for (uint8_t k=0; k<_sensor_count; ++k) {
+                    if (_sensors[k] != &_gyrometer) {
+                        _sensors[count++] = _sensors[k];
+                    }
+                }
+                _sensor_count = count;
+
+                _gyroSynchronous = true;
+            }
+
+            // In gyro-synchronous mode, call this from the IMU's data-ready interrupt; or,
+            // if the IMU can't be read from interrupt context, from loop() when a flag set
+            // by the interrupt is found
+            void gyroInterrupt(void)
+            {
+                if (!_gyroSynchronous) return;
+
+                // Interrupts come between loop iterations, so they take their own timestamp,
+                // from the board clock relative to the last published loop time
+                uint8_t index = _heldTimingIndex;
+                std::atomic_signal_fence(std::memory_order_acquire);
+                timing_t timing = _heldTiming[index];
+                updateTiming(timing);
+
+                if (_gyrometer.ready(timing)) {
+                    Recorder::recordGyroInterrupt(_recorder, timing, _gyrometer._x, _gyrometer._y, _gyrometer._z);
+                    _gyrometer.modifyState(_state, timing);
+                    _pidTask.runInner();
+                }
+            }
+
+            void setStageTimer(StageTimer * stageTimer)
             {
-                _pidTask.addPidController(pidController, auxState);
+                _stageTimer = stageTimer;
+                _pidTask._stageTimer = stageTimer;
+                _serialTask._stageTimer = stageTimer;
+            }
+
+            // Records stage timing into the tracer and makes it available to MSP
+            void setTracer(Tracer * tracer)
+            {
+                setStageTimer(tracer);
+                _serialTask._tracer = tracer;
+            }
+
+            // Logs every PID update into the recorder, which a low-priority task drains to
+            // the sink.  Call after init(), and before the first update() if the log is
+            // to be replayed.  A log with inputs needs a faster drain than the default.
+            void setRecorder(Recorder * recorder, LogSink * sink, float freq=0)
+            {
+                recorder->_mixer = _mixer;
+
+                _recorder = recorder;
+                _pidTask._recorder = recorder;
+
+                // Sensors in a SensorChain aren't logged
+                for (uint8_t k=0; k<_sensor_count; ++k) {
+                    _sensors[k]->_recorder = recorder;
+                }
+
+                _recorderTask.init(_board, recorder, sink);
+                if (freq > 0) {
+                    _recorderTask.setFrequency(freq);
+                }
+                _scheduler.addTask(&_recorderTask);
+            }
+
+            // Sends Debugger::trace() messages to the sink in binary, for formatting on
+            // the host, instead of formatting them for Board::outbuf()
+            void setDebugSink(LogSink * sink)
+            {
+                _debugger._sink = sink;
+            }
+
+            // Requested vs. achieved rates and overruns for each timer task
+            Scheduler * getScheduler(void)
+            {
+                return &_scheduler;
             }
 
             void update(void)
             {
+                StageTimer::begin(_stageTimer, StageTimer::STAGE_UPDATE);
+
+                // Every stage below sees the same time
+                updateTiming(_timing);
+                publishTiming();
+
+                Recorder::beginUpdate(_recorder, _timing);
+
                 // Grab control signal if available
+                StageTimer::begin(_stageTimer, StageTimer::STAGE_RECEIVER);
                 checkReceiver();
-
-                // Update PID controllers task
-                _pidTask.update();
+                StageTimer::end(_stageTimer, StageTimer::STAGE_RECEIVER);
 
                 // Run full or lite update function
                 _updater->update();
+
+                // Run the highest-priority timer task that is due
+                _scheduler.update(_timing);
+
+                StageTimer::end(_stageTimer, StageTimer::STAGE_UPDATE);
             }
 
     }; // class Hackflight
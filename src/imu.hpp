@@ -20,6 +20,8 @@
 
 #pragma once
 
+#include <stdint.h>
+
 namespace hf {
 
     class IMU {
@@ -42,10 +44,12 @@ namespace hf {
         friend class Hackflight;
         friend class Quaternion;
         friend class Gyrometer;
+        friend class Barometer;
+        friend class StateEstimator;
 
         protected:
 
-            virtual bool getQuaternion(float & qw, float & qx, float & qy, float & qz, float time) = 0;
+            virtual bool getQuaternion(float & qw, float & qx, float & qy, float & qz, uint64_t usec) = 0;
 
             virtual bool getGyrometer(float & gx, float & gy, float & gz) = 0;
 
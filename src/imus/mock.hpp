@@ -37,9 +37,9 @@ namespace hf {
                 return true;
             }
 
-            virtual bool getQuaternion(float & qw, float & qx, float & qy, float & qz, float time) override
+            virtual bool getQuaternion(float & qw, float & qx, float & qy, float & qz, uint64_t usec) override
             {
-                (void)time;
+                (void)usec;
 
                 qw = 0;
                 qx = 0;
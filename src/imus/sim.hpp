@@ -0,0 +1,147 @@
+/*
+   Simulated IMU for running Hackflight on a host computer
+
+   Readings are pushed in by the simulation; each one is reported ready
+   exactly once, the way a real IMU reports a new sample.
+
+   Copyright (c) 2020 Simon D. Levy
+
+   This file is part of Hackflight.
+
+   Hackflight is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   Hackflight is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+   You should have received a copy of the GNU General Public License
+   along with Hackflight.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "imu.hpp"
+
+namespace hf {
+
+    class SimIMU : public IMU {
+
+        private:
+
+            float _gx = 0;
+            float _gy = 0;
+            float _gz = 0;
+
+            float _qw = 1;
+            float _qx = 0;
+            float _qy = 0;
+            float _qz = 0;
+
+            float _ax = 0;
+            float _ay = 0;
+            float _az = 1;
+
+            bool _gyroReady = false;
+            bool _quatReady = false;
+            float _pressure = 0;
+
+            bool _accelReady = false;
+            bool _baroReady = false;
+
+        protected:
+
+            virtual bool getGyrometer(float & gx, float & gy, float & gz) override
+            {
+                if (!_gyroReady) return false;
+
+                gx = _gx;
+                gy = _gy;
+                gz = _gz;
+
+                _gyroReady = false;
+
+                return true;
+            }
+
+            virtual bool getQuaternion(float & qw, float & qx, float & qy, float & qz, uint64_t usec) override
+            {
+                (void)usec;
+
+                if (!_quatReady) return false;
+
+                qw = _qw;
+                qx = _qx;
+                qy = _qy;
+                qz = _qz;
+
+                _quatReady = false;
+
+                return true;
+            }
+
+            virtual bool getAccelerometer(float & ax, float & ay, float & az) override
+            {
+                if (!_accelReady) return false;
+
+                ax = _ax;
+                ay = _ay;
+                az = _az;
+
+                _accelReady = false;
+
+                return true;
+            }
+
+            virtual bool getBarometer(float & pressure) override
+            {
+                if (!_baroReady) return false;
+
+                pressure = _pressure;
+
+                _baroReady = false;
+
+                return true;
+            }
+
+        public:
+
+            // Values follow the sign conventions documented in imu.hpp
+
+            void setGyrometer(float gx, float gy, float gz)
+            {
+                _gx = gx;
+                _gy = gy;
+                _gz = gz;
+                _gyroReady = true;
+            }
+
+            void setQuaternion(float qw, float qx, float qy, float qz)
+            {
+                _qw = qw;
+                _qx = qx;
+                _qy = qy;
+                _qz = qz;
+                _quatReady = true;
+            }
+
+            void setAccelerometer(float ax, float ay, float az)
+            {
+                _ax = ax;
+                _ay = ay;
+                _az = az;
+                _accelReady = true;
+            }
+
+            // Pascals
+            void setBarometer(float pressure)
+            {
+                _pressure = pressure;
+                _baroReady = true;
+            }
+
+    }; // class SimIMU
+
+} // namespace hf
@@ -41,6 +41,9 @@ namespace hf {
             // Supports computing quaternion after a certain number of IMU readings
             uint8_t _quatCycleCount = 0;
 
+            // Time of the previous filter update
+            uint64_t _quatUsec = 0;
+
             // Params passed to Madgwick quaternion constructor
             const float _beta = sqrtf(3.0f / 4.0f) * Filter::deg2rad(GYRO_MEAS_ERROR_DEG);
             const float _zeta = sqrtf(3.0f / 4.0f) * Filter::deg2rad(GYRO_MEAS_DRIFT_DEG);  
@@ -77,7 +80,7 @@ namespace hf {
                 return false;
             }
 
-            bool getQuaternion(float & qw, float & qx, float & qy, float & qz, float time) override
+            bool getQuaternion(float & qw, float & qx, float & qy, float & qz, uint64_t usec) override
             {
                 // Update quaternion after some number of IMU readings
                 _quatCycleCount = (_quatCycleCount + 1) % QUATERNION_DIVISOR;
@@ -85,9 +88,8 @@ namespace hf {
                 if (_quatCycleCount == 0) {
 
                     // Set integration time by time elapsed since last filter update
-                    static float _time;
-                    float deltat = time - _time;
-                    _time = time;
+                    float deltat = (usec - _quatUsec) * 1e-6f;
+                    _quatUsec = usec;
 
                     // Run the quaternion on the IMU values acquired in imuReadAccelGyro()                   
                     _quaternionFilter.update(_ax, _ay, _az, _gx, _gy, _gz, deltat); 
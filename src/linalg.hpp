@@ -0,0 +1,299 @@
+/*
+   Simple linear algebra support
+
+   Matrices have their dimensions fixed at compile time, so each one takes only
+   the memory its shape needs and the kernels' loops have constant bounds.  A
+   product is built a row at a time as a sum of rows of the right-hand matrix
+   scaled by elements of the left-hand one, four columns at a time with SSE or
+   NEON where the host has them, and with plain floats elsewhere.
+
+   Covariances are kept as a SymmetricMatrix, which stores only the upper
+   triangle, so symmetry holds by construction and updates touch half the
+   elements.
+
+   Copyright (c) 2018 Simon D. Levy
+
+   This file is part of Hackflight.
+
+   Hackflight is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   Hackflight is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+   You should have received a copy of the GNU General Public License
+   along with Hackflight.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+#include <debugger.hpp>
+
+#if defined(__SSE__)
+#include <xmmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+namespace hf {
+
+    // Kernels on rows of N floats
+    template <uint8_t N>
+    class MatrixRow {
+
+        template <uint8_t, uint8_t> friend class Matrix;
+
+        private:
+
+            // Lanes handled by the vector kernels; the rest are done one at a time
+            static const uint8_t VECTOR = (N / 4) * 4;
+
+            static void zero(float * c)
+            {
+                for (uint8_t k=0; k<N; ++k) {
+                    c[k] = 0;
+                }
+            }
+
+            // c += a * b
+            static void madd(float * c, float a, const float * b)
+            {
+                uint8_t k = 0;
+
+#if defined(__SSE__)
+                __m128 av = _mm_set1_ps(a);
+                for (; k<VECTOR; k+=4) {
+                    _mm_storeu_ps(c+k, _mm_add_ps(_mm_loadu_ps(c+k), _mm_mul_ps(av, _mm_loadu_ps(b+k))));
+                }
+#elif defined(__ARM_NEON)
+                float32x4_t av = vdupq_n_f32(a);
+                for (; k<VECTOR; k+=4) {
+                    vst1q_f32(c+k, vmlaq_f32(vld1q_f32(c+k), av, vld1q_f32(b+k)));
+                }
+#endif
+
+                for (; k<N; ++k) {
+                    c[k] += a * b[k];
+                }
+            }
+
+            // a . b
+            static float dot(const float * a, const float * b)
+            {
+                uint8_t k = 0;
+                float sum = 0;
+
+#if defined(__SSE__)
+                if (VECTOR) {
+                    __m128 s = _mm_setzero_ps();
+                    for (; k<VECTOR; k+=4) {
+                        s = _mm_add_ps(s, _mm_mul_ps(_mm_loadu_ps(a+k), _mm_loadu_ps(b+k)));
+                    }
+                    float lanes[4];
+                    _mm_storeu_ps(lanes, s);
+                    sum = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+                }
+#elif defined(__ARM_NEON)
+                if (VECTOR) {
+                    float32x4_t s = vdupq_n_f32(0);
+                    for (; k<VECTOR; k+=4) {
+                        s = vmlaq_f32(s, vld1q_f32(a+k), vld1q_f32(b+k));
+                    }
+                    float lanes[4];
+                    vst1q_f32(lanes, s);
+                    sum = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+                }
+#endif
+
+                for (; k<N; ++k) {
+                    sum += a[k] * b[k];
+                }
+
+                return sum;
+            }
+
+    };  // class MatrixRow
+
+    template <uint8_t R, uint8_t C>
+    class Matrix {
+
+        template <uint8_t, uint8_t> friend class Matrix;
+
+        private:
+
+            float _vals[R][C];
+
+        public:
+
+            Matrix(void)
+            {
+                memset(_vals, 0, sizeof(_vals));
+            }
+
+            float get(uint8_t j, uint8_t k) const
+            {
+                return _vals[j][k];
+            }
+
+            void set(uint8_t j, uint8_t k, float val)
+            {
+                _vals[j][k] = val;
+            }
+
+            void dump(void) const
+            {
+                for (uint8_t j=0; j<R; ++j) {
+                    for (uint8_t k=0; k<C; ++k) {
+                        Debugger::printf("%+2.2f ", _vals[j][k]);
+                    }
+                    Debugger::printf("\n");
+                }
+            }
+
+            static void trans(const Matrix<R,C> & a, Matrix<C,R> & at)
+            {
+                for (uint8_t j=0; j<R; ++j) {
+                    for (uint8_t k=0; k<C; ++k) {
+                        at._vals[k][j] = a._vals[j][k];
+                    }
+                }
+            }
+
+            // c = a * b; c must not be a or b
+            template <uint8_t N>
+            static void mult(const Matrix<R,N> & a, const Matrix<N,C> & b, Matrix<R,C> & c)
+            {
+                for (uint8_t i=0; i<R; ++i) {
+                    MatrixRow<C>::zero(c._vals[i]);
+                    for (uint8_t k=0; k<N; ++k) {
+                        MatrixRow<C>::madd(c._vals[i], a._vals[i][k], b._vals[k]);
+                    }
+                }
+            }
+
+            // c = a * b', without forming b'; c must not be a or b
+            template <uint8_t N>
+            static void multTrans(const Matrix<R,N> & a, const Matrix<C,N> & b, Matrix<R,C> & c)
+            {
+                for (uint8_t i=0; i<R; ++i) {
+                    for (uint8_t j=0; j<C; ++j) {
+                        c._vals[i][j] = MatrixRow<N>::dot(a._vals[i], b._vals[j]);
+                    }
+                }
+            }
+
+    };  // class Matrix
+
+    template <uint8_t N>
+    class SymmetricMatrix {
+
+        private:
+
+            static const uint16_t SIZE = N*(N+1)/2;
+
+            // Upper triangle, row by row
+            float _vals[SIZE];
+
+            static uint16_t index(uint8_t j, uint8_t k)
+            {
+                if (j > k) {
+                    uint8_t t = j;
+                    j = k;
+                    k = t;
+                }
+
+                return j*N - j*(j-1)/2 + k - j;
+            }
+
+        public:
+
+            SymmetricMatrix(void)
+            {
+                memset(_vals, 0, sizeof(_vals));
+            }
+
+            float get(uint8_t j, uint8_t k) const
+            {
+                return _vals[index(j,k)];
+            }
+
+            // Sets both (j,k) and (k,j)
+            void set(uint8_t j, uint8_t k, float val)
+            {
+                _vals[index(j,k)] = val;
+            }
+
+            // y = P h, for a row h whose only nonzero elements are vals at cols
+            void multSparse(const uint8_t * cols, const float * vals, uint8_t count, float * y) const
+            {
+                for (uint8_t i=0; i<N; ++i) {
+                    y[i] = 0;
+                    for (uint8_t m=0; m<count; ++m) {
+                        y[i] += get(i, cols[m]) * vals[m];
+                    }
+                }
+            }
+
+            // P -= v v' / s
+            void downdate(const float * v, float s)
+            {
+                float * p = _vals;
+
+                for (uint8_t j=0; j<N; ++j) {
+                    float vj = v[j] / s;
+                    for (uint8_t k=j; k<N; ++k) {
+                        *p++ -= vj * v[k];
+                    }
+                }
+            }
+
+            // P = A P A'
+            void transform(const Matrix<N,N> & a)
+            {
+                static Matrix<N,N> p;
+                static Matrix<N,N> ap;
+                static Matrix<N,N> apat;
+
+                for (uint8_t j=0; j<N; ++j) {
+                    for (uint8_t k=0; k<N; ++k) {
+                        p.set(j, k, get(j,k));
+                    }
+                }
+
+                Matrix<N,N>::mult(a, p, ap);
+                Matrix<N,N>::multTrans(ap, a, apat);
+
+                float * q = _vals;
+
+                for (uint8_t j=0; j<N; ++j) {
+                    for (uint8_t k=j; k<N; ++k) {
+                        *q++ = apat.get(j,k);
+                    }
+                }
+            }
+
+            // Clamps the elements to max (NaNs too) and the diagonal to at least min
+            void bound(float min, float max)
+            {
+                float * p = _vals;
+
+                for (uint8_t j=0; j<N; ++j) {
+                    for (uint8_t k=j; k<N; ++k, ++p) {
+                        if (*p != *p || *p > max) {
+                            *p = max;
+                        }
+                        else if (k == j && *p < min) {
+                            *p = min;
+                        }
+                    }
+                }
+            }
+
+    };  // class SymmetricMatrix
+
+} // namespace hf
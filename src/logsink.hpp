@@ -0,0 +1,38 @@
+/*
+   Abstract destination for the bytes of a flight log: a serial port, flash,
+   or a file on the host
+
+   Copyright (c) 2020 Simon D. Levy
+
+   This file is part of Hackflight.
+
+   Hackflight is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   Hackflight is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+   You should have received a copy of the GNU General Public License
+   along with Hackflight.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+namespace hf {
+
+    class LogSink {
+
+        public:
+
+            // Must not block: take as many of the bytes as can be written right now
+            // (possibly none) and return that count.  The rest are offered again later.
+            virtual uint16_t write(const uint8_t * data, uint16_t count) = 0;
+
+    }; // class LogSink
+
+} // namespace hf
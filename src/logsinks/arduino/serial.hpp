@@ -0,0 +1,66 @@
+/*
+   Flight-log sink for a spare Arduino hardware serial port, such as
+   Serial2 wired to an OpenLog-style logger
+
+   Only as many bytes as fit in the port's transmit buffer are written
+   on each call, so logging never waits on the UART.
+
+   Copyright (c) 2020 Simon D. Levy
+
+   This file is part of Hackflight.
+
+   Hackflight is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   Hackflight is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+   You should have received a copy of the GNU General Public License
+   along with Hackflight.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <Arduino.h>
+
+#include "logsink.hpp"
+
+namespace hf {
+
+    class SerialLogSink : public LogSink {
+
+        private:
+
+            HardwareSerial * _serial = NULL;
+
+        public:
+
+            virtual uint16_t write(const uint8_t * data, uint16_t count) override
+            {
+                int room = _serial->availableForWrite();
+
+                if (room <= 0) return 0;
+
+                if (count > (uint16_t)room) {
+                    count = room;
+                }
+
+                return _serial->write(data, count);
+            }
+
+            SerialLogSink(HardwareSerial * serial)
+            {
+                _serial = serial;
+            }
+
+            void begin(uint32_t baud)
+            {
+                _serial->begin(baud);
+            }
+
+    }; // class SerialLogSink
+
+} // namespace hf
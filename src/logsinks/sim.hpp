@@ -0,0 +1,66 @@
+/*
+   Flight-log sink that writes to a file, for host builds
+
+   Copyright (c) 2020 Simon D. Levy
+
+   This file is part of Hackflight.
+
+   Hackflight is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   Hackflight is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+   You should have received a copy of the GNU General Public License
+   along with Hackflight.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <stdio.h>
+
+#include "logsink.hpp"
+
+namespace hf {
+
+    class SimLogSink : public LogSink {
+
+        private:
+
+            FILE * _file = NULL;
+
+            uint32_t _bytes = 0;
+
+        public:
+
+            // With no file, bytes are counted and thrown away
+            SimLogSink(FILE * file=NULL)
+            {
+                _file = file;
+            }
+
+            virtual uint16_t write(const uint8_t * data, uint16_t count) override
+            {
+                if (!_file) {
+                    _bytes += count;
+                    return count;
+                }
+
+                uint16_t written = (uint16_t)fwrite(data, 1, count, _file);
+
+                _bytes += written;
+
+                return written;
+            }
+
+            uint32_t getBytes(void)
+            {
+                return _bytes;
+            }
+
+    }; // class SimLogSink
+
+} // namespace hf
@@ -0,0 +1,69 @@
+/*
+   Simulated motor for running Hackflight on a host computer
+
+   Copyright (c) 2020 Simon D. Levy
+
+   This file is part of Hackflight.
+
+   Hackflight is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   Hackflight is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+   You should have received a copy of the GNU General Public License
+   along with Hackflight.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#include "motor.hpp"
+
+namespace hf {
+
+    class SimMotor : public Motor {
+
+        private:
+
+            // Last value written by the mixer, in [0,1]
+            float _value = 0;
+
+            uint32_t _writeCount = 0;
+
+        public:
+
+            SimMotor(void)
+                : Motor(0)
+            {
+            }
+
+            virtual void init(void) override
+            {
+                _value = 0;
+                _writeCount = 0;
+            }
+
+            virtual void write(float value) override
+            {
+                _value = value;
+                _writeCount++;
+            }
+
+            float getValue(void)
+            {
+                return _value;
+            }
+
+            uint32_t getWriteCount(void)
+            {
+                return _writeCount;
+            }
+
+    }; // class SimMotor
+
+} // namespace hf
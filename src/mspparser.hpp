@@ -27,6 +27,12 @@
 #include <stdint.h>
 #include <string.h>
 
+// Size of each of the parser's input and output buffers, bounding the MSPv2
+// payloads it can take and send
+#ifndef HACKFLIGHT_MSP_BUFFER
+#define HACKFLIGHT_MSP_BUFFER 128
+#endif
+
 namespace hf {
 
     class MspParser {
@@ -37,8 +43,16 @@ namespace hf {
 
         private:
 
-            static const int INBUF_SIZE  = 128;
-            static const int OUTBUF_SIZE = 128;
+            static const uint16_t INBUF_SIZE  = HACKFLIGHT_MSP_BUFFER;
+            static const uint16_t OUTBUF_SIZE = HACKFLIGHT_MSP_BUFFER;
+
+            // A reply is built in place in _outBuf, with its payload on a word
+            // boundary after the header: '$', 'M', '>', size, and command for
+            // MSPv1; '$', 'X', '>', flag, and 16-bit command and size for MSPv2.
+            // The checksum follows the payload.
+            static const uint8_t REPLY_PAYLOAD = 8;
+            static const uint8_t REPLY_START_V1 = REPLY_PAYLOAD - 5;
+            static const uint8_t REPLY_START_V2 = REPLY_PAYLOAD - 8;
 
             typedef enum serialState_t {
                 IDLE,
@@ -46,117 +60,148 @@ namespace hf {
                 HEADER_M,
                 HEADER_ARROW,
                 HEADER_SIZE,
-                HEADER_CMD
+                HEADER_CMD,
+                HEADER_X,
+                HEADER_V2_FLAG,
+                HEADER_V2_CMD_LO,
+                HEADER_V2_CMD_HI,
+                HEADER_V2_SIZE_LO,
+                HEADER_V2_SIZE_HI,
+                HEADER_V2_PAYLOAD
             } serialState_t;
 
+            // An entry in the table of messages
+            typedef struct {
+
+                uint16_t id;
+                uint16_t size;  // payload size of a command; zero for a request
+                uint16_t reply; // payload size of the reply to a request; zero for a command
+                void (MspParser::*dispatch)(void);
+
+            } message_t;
+
+            typedef uint32_t __attribute__((may_alias)) word_t;
+
             uint8_t _checksum;
-            uint8_t _inBuf[INBUF_SIZE];
-            uint8_t _inBufIndex;
-            uint8_t _outBuf[OUTBUF_SIZE];
-            uint8_t _outBufIndex;
-            uint8_t _outBufSize;
-            uint8_t _command;
-            uint8_t _offset;
-            uint8_t _dataSize;
+            alignas(4) uint8_t _inBuf[INBUF_SIZE];
+            alignas(4) uint8_t _outBuf[OUTBUF_SIZE];
+            uint16_t _outBufIndex;
+            uint16_t _outBufSize;
+            uint16_t _command;
+            uint16_t _offset;
+            uint16_t _dataSize;
             uint8_t _direction;
+            uint8_t _version;
 
             serialState_t  _state;
 
-            void serialize8(uint8_t a)
+            // Payload of the reply being built, zeroed for the request handler
+            uint8_t * replyPayload(uint16_t size)
             {
-                _outBuf[_outBufSize++] = a;
-                _checksum ^= a;
+                memset(&_outBuf[REPLY_PAYLOAD], 0, size);
+                return &_outBuf[REPLY_PAYLOAD];
             }
 
-            void serialize16(int16_t a)
+            // Adds the header and checksum to the payload at replyPayload(),
+            // replacing any reply not yet read.  The reply is in the version of
+            // the latest message received, except that a payload too large for
+            // MSPv1 goes in MSPv2.
+            void sendReply(uint16_t id, uint16_t size)
             {
-                serialize8(a & 0xFF);
-                serialize8((a >> 8) & 0xFF);
+                if (_version == 1 && size <= MAXMSG) {
+                    sendReplyV1(id, (uint8_t)size);
+                }
+                else {
+                    sendReplyV2(id, size);
+                }
             }
 
-            void serialize32(uint32_t a)
+            void sendReplyV1(uint16_t id, uint8_t size)
             {
-                serialize8(a & 0xFF);
-                serialize8((a >> 8) & 0xFF);
-                serialize8((a >> 16) & 0xFF);
-                serialize8((a >> 24) & 0xFF);
-            }
+                uint8_t * reply = &_outBuf[REPLY_START_V1];
+
+                reply[0] = '$';
+                reply[1] = 'M';
+                reply[2] = '>';
+                reply[3] = size;
+                reply[4] = (uint8_t)id;
+
+                // XOR the payload a word at a time, then fold the word
+                const word_t * words = (const word_t *)&_outBuf[REPLY_PAYLOAD];
+                word_t x = 0;
+                uint8_t k = 0;
+                for (; k<size/4; ++k) {
+                    x ^= words[k];
+                }
+                x ^= x >> 16;
+                x ^= x >> 8;
 
-            void headSerialResponse(uint8_t err, uint8_t s)
-            {
-                serialize8('$');
-                serialize8('M');
-                serialize8(err ? '!' : '>');
-                _checksum = 0;               // start calculating a new _checksum
-                serialize8(s);
-                serialize8(_command);
-            }
+                uint8_t checksum = (uint8_t)x ^ size ^ reply[4];
+                for (k*=4; k<size; ++k) {
+                    checksum ^= _outBuf[REPLY_PAYLOAD+k];
+                }
 
-            void headSerialReply(uint8_t s)
-            {
-                headSerialResponse(0, s);
-            }
+                _outBuf[REPLY_PAYLOAD+size] = checksum;
 
-            void prepareToSend(uint8_t count, uint8_t size)
-            {
-                _outBufSize = 0;
-                _outBufIndex = 0;
-                headSerialReply(count*size);
+                _outBufIndex = REPLY_START_V1;
+                _outBufSize = size + 6;
             }
 
-            void prepareToSendBytes(uint8_t count)
+            void sendReplyV2(uint16_t id, uint16_t size)
             {
-                prepareToSend(count, 1);
-            }
+                uint8_t * reply = &_outBuf[REPLY_START_V2];
+
+                reply[0] = '$';
+                reply[1] = 'X';
+                reply[2] = '>';
+                reply[3] = 0;
+                reply[4] = id & 0xFF;
+                reply[5] = id >> 8;
+                reply[6] = size & 0xFF;
+                reply[7] = size >> 8;
+
+                uint8_t crc = 0;
+                for (uint16_t k=3; k<REPLY_PAYLOAD+size; ++k) {
+                    crc = crc8_dvb_s2(crc, reply[k]);
+                }
 
-            void sendByte(uint8_t src)
-            {
-                serialize8(src);
-            }
+                _outBuf[REPLY_PAYLOAD+size] = crc;
 
-            void prepareToSendShorts(uint8_t count)
-            {
-                prepareToSend(count, 2);
+                _outBufIndex = REPLY_START_V2;
+                _outBufSize = size + 9;
             }
 
-            void sendShort(short src)
+            static uint8_t CRC8(uint8_t * data, int n) 
             {
-                int16_t a;
-                memcpy(&a, &src, 2);
-                serialize16(a);
-            }
+                uint8_t crc = 0x00;
 
-            void prepareToSendInts(uint8_t count)
-            {
-                prepareToSend(count, 4);
-            }
+                for (int k=0; k<n; ++k) {
 
-            void sendInt(int32_t src)
-            {
-                int32_t a;
-                memcpy(&a, &src, 4);
-                serialize32(a);
-            }
+                    crc ^= data[k];
+                }
 
-            void prepareToSendFloats(uint8_t count)
-            {
-                prepareToSend(count, 4);
+                return crc;
             }
 
-            void sendFloat(float src)
+            // MSPv2 checksum, updated with one byte
+            static uint8_t crc8_dvb_s2(uint8_t crc, uint8_t c)
             {
-                uint32_t a;
-                memcpy(&a, &src, 4);
-                serialize32(a);
+                crc ^= c;
+
+                for (uint8_t k=0; k<8; ++k) {
+                    crc = (crc & 0x80) ? (uint8_t)((crc << 1) ^ 0xD5) : (uint8_t)(crc << 1);
+                }
+
+                return crc;
             }
 
-            static uint8_t CRC8(uint8_t * data, int n) 
+            static uint8_t CRC8_DVB_S2(uint8_t * data, int n)
             {
                 uint8_t crc = 0x00;
 
                 for (int k=0; k<n; ++k) {
 
-                    crc ^= data[k];
+                    crc = crc8_dvb_s2(crc, data[k]);
                 }
 
                 return crc;
@@ -172,10 +217,11 @@ namespace hf {
                 _command = 0;
                 _offset = 0;
                 _dataSize = 0;
+                _version = 1;
                 _state = IDLE;
             }
             
-            uint8_t availableBytes(void)
+            uint16_t availableBytes(void)
             {
                 return _outBufSize;
             }
@@ -186,6 +232,54 @@ namespace hf {
                 return _outBuf[_outBufIndex++];
             }
 
+            // Reads all of the available bytes at once, without copying them
+            uint16_t readBytes(const uint8_t ** bytes)
+            {
+                uint16_t count = _outBufSize;
+
+                *bytes = &_outBuf[_outBufIndex];
+                _outBufIndex += count;
+                _outBufSize = 0;
+
+                return count;
+            }
+
+            // Bytes that push() would send for a message; zero if it isn't a request
+            uint16_t pushBytes(uint16_t id)
+            {
+                const message_t * message = lookup(id);
+
+                if (!message || message->reply == 0) {
+                    return 0;
+                }
+
+                return message->reply + ((_version == 1 && message->reply <= MAXMSG) ? 6 : 9);
+            }
+
+            // Sends the reply to a request message as though requested, replacing
+            // any reply not yet read; false if the message isn't a request
+            bool push(uint16_t id)
+            {
+                const message_t * message = lookup(id);
+
+                if (!message || message->reply == 0) {
+                    return false;
+                }
+
+                (this->*message->dispatch)();
+
+                return true;
+            }
+
+            void dispatchMessage(void)
+            {
+                const message_t * message = lookup(_command);
+
+                if (message && _dataSize >= message->size) {
+                    (this->*message->dispatch)();
+                }
+            }
+
             // returns true if reboot request, false otherwise
             bool parse(uint8_t c)
             {
@@ -199,7 +293,7 @@ namespace hf {
                         break;
 
                     case HEADER_START:
-                        _state = (c == 'M') ? HEADER_M : IDLE;
+                        _state = (c == 'M') ? HEADER_M : (c == 'X') ? HEADER_X : IDLE;
                         break;
 
                     case HEADER_M:
@@ -225,7 +319,6 @@ namespace hf {
                         _dataSize = c;
                         _offset = 0;
                         _checksum = 0;
-                        _inBufIndex = 0;
                         _checksum ^= c;
                         _state = HEADER_SIZE;      // the command is to follow
                         break;
@@ -242,6 +335,72 @@ namespace hf {
                             _inBuf[_offset++] = c;
                         } else  {
                             if (_checksum == c) {        // compare calculated and transferred _checksum
+                                _version = 1;
+                                dispatchMessage();
+                            }
+                            _state = IDLE;
+                        }
+                        break;
+
+                    // MSPv2: flag, command, and size, each checksummed, then the payload
+                    // and checksum
+
+                    case HEADER_X:
+                        switch (c) {
+                           case '>':
+                                _direction = 1;
+                                _state = HEADER_V2_FLAG;
+                                break;
+                            case '<':
+                                _direction = 0;
+                                _state = HEADER_V2_FLAG;
+                                break;
+                             default:
+                                _state = IDLE;
+                        }
+                        break;
+
+                    case HEADER_V2_FLAG:
+                        _checksum = crc8_dvb_s2(0, c);
+                        _state = HEADER_V2_CMD_LO;
+                        break;
+
+                    case HEADER_V2_CMD_LO:
+                        _command = c;
+                        _checksum = crc8_dvb_s2(_checksum, c);
+                        _state = HEADER_V2_CMD_HI;
+                        break;
+
+                    case HEADER_V2_CMD_HI:
+                        _command |= c << 8;
+                        _checksum = crc8_dvb_s2(_checksum, c);
+                        _state = HEADER_V2_SIZE_LO;
+                        break;
+
+                    case HEADER_V2_SIZE_LO:
+                        _dataSize = c;
+                        _checksum = crc8_dvb_s2(_checksum, c);
+                        _state = HEADER_V2_SIZE_HI;
+                        break;
+
+                    case HEADER_V2_SIZE_HI:
+                        _dataSize |= c << 8;
+                        if (_dataSize > INBUF_SIZE) {
+                            _state = IDLE;
+                            return false;
+                        }
+                        _offset = 0;
+                        _checksum = crc8_dvb_s2(_checksum, c);
+                        _state = HEADER_V2_PAYLOAD;
+                        break;
+
+                    case HEADER_V2_PAYLOAD:
+                        if (_offset < _dataSize) {
+                            _checksum = crc8_dvb_s2(_checksum, c);
+                            _inBuf[_offset++] = c;
+                        } else  {
+                            if (_checksum == c) {
+                                _version = 2;
                                 dispatchMessage();
                             }
                             _state = IDLE;
@@ -254,131 +413,257 @@ namespace hf {
             } // parse
 
 
-            void dispatchMessage(void)
+        public:
+
+            enum {
+                ID_STATE = 112,
+                ID_RC_NORMAL = 121,
+                ID_ATTITUDE_RADIANS = 122,
+                ID_TRACE = 123,
+                ID_TELEMETRY = 124,
+                ID_SET_VELOCITY_SETPOINTS = 213,
+                ID_SET_MOTOR_NORMAL = 215,
+                ID_SET_RC_NORMAL = 217,
+                ID_SET_ARMED = 216,
+                ID_SET_TELEMETRY_RATE = 218,
+                ID_SET_SUBSCRIPTION = 219,
+            };
+
+            // Message payloads, decoded and encoded in place
+
+            typedef struct __attribute__((may_alias)) {
+
+                float altitude;
+                float variometer;
+                float positionX;
+                float positionY;
+                float heading;
+                float velocityForward;
+                float velocityRightward;
+
+            } STATE_payload_t;
+
+            typedef struct __attribute__((may_alias)) {
+
+                float c1;
+                float c2;
+                float c3;
+                float c4;
+                float c5;
+                float c6;
+
+            } RC_NORMAL_payload_t;
+
+            typedef struct __attribute__((may_alias)) {
+
+                float roll;
+                float pitch;
+                float yaw;
+
+            } ATTITUDE_RADIANS_payload_t;
+
+            typedef struct __attribute__((may_alias)) {
+
+                int32_t count;
+                int32_t s1;
+                int32_t b1;
+                int32_t e1;
+                int32_t s2;
+                int32_t b2;
+                int32_t e2;
+                int32_t s3;
+                int32_t b3;
+                int32_t e3;
+                int32_t s4;
+                int32_t b4;
+                int32_t e4;
+
+            } TRACE_payload_t;
+
+            typedef struct __attribute__((may_alias)) {
+
+                float roll;
+                float pitch;
+                float yaw;
+                float altitude;
+                float variometer;
+                float positionX;
+                float positionY;
+                float heading;
+                float velocityForward;
+                float velocityRightward;
+                float c1;
+                float c2;
+                float c3;
+                float c4;
+                float c5;
+                float c6;
+                float m1;
+                float m2;
+                float m3;
+                float m4;
+
+            } TELEMETRY_payload_t;
+
+            typedef struct __attribute__((may_alias)) {
+
+                float vx;
+                float vy;
+                float vz;
+                float yaw_rate;
+
+            } SET_VELOCITY_SETPOINTS_payload_t;
+
+            typedef struct __attribute__((may_alias)) {
+
+                float m1;
+                float m2;
+                float m3;
+                float m4;
+
+            } SET_MOTOR_NORMAL_payload_t;
+
+            typedef struct __attribute__((may_alias)) {
+
+                float c1;
+                float c2;
+                float c3;
+                float c4;
+                float c5;
+                float c6;
+
+            } SET_RC_NORMAL_payload_t;
+
+            typedef struct __attribute__((may_alias)) {
+
+                uint8_t flag;
+
+            } SET_ARMED_payload_t;
+
+            typedef struct __attribute__((may_alias)) {
+
+                float rate;
+
+            } SET_TELEMETRY_RATE_payload_t;
+
+            typedef struct __attribute__((may_alias)) {
+
+                float rate;
+                int16_t message;
+
+            } SET_SUBSCRIPTION_payload_t;
+
+        private:
+
+            void dispatch_STATE(void)
+            {
+                static_assert(REPLY_PAYLOAD + 28 < OUTBUF_SIZE, "HACKFLIGHT_MSP_BUFFER too small for STATE");
+                STATE_payload_t * payload = (STATE_payload_t *)replyPayload(28);
+                handle_STATE_Request(payload->altitude, payload->variometer, payload->positionX, payload->positionY, payload->heading, payload->velocityForward, payload->velocityRightward);
+                sendReply(112, 28);
+            }
+
+            void dispatch_RC_NORMAL(void)
+            {
+                static_assert(REPLY_PAYLOAD + 24 < OUTBUF_SIZE, "HACKFLIGHT_MSP_BUFFER too small for RC_NORMAL");
+                RC_NORMAL_payload_t * payload = (RC_NORMAL_payload_t *)replyPayload(24);
+                handle_RC_NORMAL_Request(payload->c1, payload->c2, payload->c3, payload->c4, payload->c5, payload->c6);
+                sendReply(121, 24);
+            }
+
+            void dispatch_ATTITUDE_RADIANS(void)
+            {
+                static_assert(REPLY_PAYLOAD + 12 < OUTBUF_SIZE, "HACKFLIGHT_MSP_BUFFER too small for ATTITUDE_RADIANS");
+                ATTITUDE_RADIANS_payload_t * payload = (ATTITUDE_RADIANS_payload_t *)replyPayload(12);
+                handle_ATTITUDE_RADIANS_Request(payload->roll, payload->pitch, payload->yaw);
+                sendReply(122, 12);
+            }
+
+            void dispatch_TRACE(void)
+            {
+                static_assert(REPLY_PAYLOAD + 52 < OUTBUF_SIZE, "HACKFLIGHT_MSP_BUFFER too small for TRACE");
+                TRACE_payload_t * payload = (TRACE_payload_t *)replyPayload(52);
+                handle_TRACE_Request(payload->count, payload->s1, payload->b1, payload->e1, payload->s2, payload->b2, payload->e2, payload->s3, payload->b3, payload->e3, payload->s4, payload->b4, payload->e4);
+                sendReply(123, 52);
+            }
+
+            void dispatch_TELEMETRY(void)
             {
-                switch (_command) {
-
-                    case 112:
-                    {
-                        float altitude = 0;
-                        float variometer = 0;
-                        float positionX = 0;
-                        float positionY = 0;
-                        float heading = 0;
-                        float velocityForward = 0;
-                        float velocityRightward = 0;
-                        handle_STATE_Request(altitude, variometer, positionX, positionY, heading, velocityForward, velocityRightward);
-                        prepareToSendFloats(7);
-                        sendFloat(altitude);
-                        sendFloat(variometer);
-                        sendFloat(positionX);
-                        sendFloat(positionY);
-                        sendFloat(heading);
-                        sendFloat(velocityForward);
-                        sendFloat(velocityRightward);
-                        serialize8(_checksum);
-                        } break;
-
-                    case 121:
-                    {
-                        float c1 = 0;
-                        float c2 = 0;
-                        float c3 = 0;
-                        float c4 = 0;
-                        float c5 = 0;
-                        float c6 = 0;
-                        handle_RC_NORMAL_Request(c1, c2, c3, c4, c5, c6);
-                        prepareToSendFloats(6);
-                        sendFloat(c1);
-                        sendFloat(c2);
-                        sendFloat(c3);
-                        sendFloat(c4);
-                        sendFloat(c5);
-                        sendFloat(c6);
-                        serialize8(_checksum);
-                        } break;
-
-                    case 122:
-                    {
-                        float roll = 0;
-                        float pitch = 0;
-                        float yaw = 0;
-                        handle_ATTITUDE_RADIANS_Request(roll, pitch, yaw);
-                        prepareToSendFloats(3);
-                        sendFloat(roll);
-                        sendFloat(pitch);
-                        sendFloat(yaw);
-                        serialize8(_checksum);
-                        } break;
-
-                    case 213:
-                    {
-                        float vx = 0;
-                        memcpy(&vx,  &_inBuf[0], sizeof(float));
-
-                        float vy = 0;
-                        memcpy(&vy,  &_inBuf[4], sizeof(float));
-
-                        float vz = 0;
-                        memcpy(&vz,  &_inBuf[8], sizeof(float));
-
-                        float yaw_rate = 0;
-                        memcpy(&yaw_rate,  &_inBuf[12], sizeof(float));
-
-                        handle_SET_VELOCITY_SETPOINTS(vx, vy, vz, yaw_rate);
-                        } break;
-
-                    case 215:
-                    {
-                        float m1 = 0;
-                        memcpy(&m1,  &_inBuf[0], sizeof(float));
-
-                        float m2 = 0;
-                        memcpy(&m2,  &_inBuf[4], sizeof(float));
-
-                        float m3 = 0;
-                        memcpy(&m3,  &_inBuf[8], sizeof(float));
-
-                        float m4 = 0;
-                        memcpy(&m4,  &_inBuf[12], sizeof(float));
-
-                        handle_SET_MOTOR_NORMAL(m1, m2, m3, m4);
-                        } break;
-
-                    case 217:
-                    {
-                        float c1 = 0;
-                        memcpy(&c1,  &_inBuf[0], sizeof(float));
-
-                        float c2 = 0;
-                        memcpy(&c2,  &_inBuf[4], sizeof(float));
-
-                        float c3 = 0;
-                        memcpy(&c3,  &_inBuf[8], sizeof(float));
-
-                        float c4 = 0;
-                        memcpy(&c4,  &_inBuf[12], sizeof(float));
-
-                        float c5 = 0;
-                        memcpy(&c5,  &_inBuf[16], sizeof(float));
-
-                        float c6 = 0;
-                        memcpy(&c6,  &_inBuf[20], sizeof(float));
-
-                        handle_SET_RC_NORMAL(c1, c2, c3, c4, c5, c6);
-                        } break;
-
-                    case 216:
-                    {
-                        uint8_t flag = 0;
-                        memcpy(&flag,  &_inBuf[0], sizeof(uint8_t));
-
-                        handle_SET_ARMED(flag);
-                        } break;
+                static_assert(REPLY_PAYLOAD + 80 < OUTBUF_SIZE, "HACKFLIGHT_MSP_BUFFER too small for TELEMETRY");
+                TELEMETRY_payload_t * payload = (TELEMETRY_payload_t *)replyPayload(80);
+                handle_TELEMETRY_Request(payload->roll, payload->pitch, payload->yaw, payload->altitude, payload->variometer, payload->positionX, payload->positionY, payload->heading, payload->velocityForward, payload->velocityRightward, payload->c1, payload->c2, payload->c3, payload->c4, payload->c5, payload->c6, payload->m1, payload->m2, payload->m3, payload->m4);
+                sendReply(124, 80);
+            }
+
+            void dispatch_SET_VELOCITY_SETPOINTS(void)
+            {
+                static_assert(16 <= INBUF_SIZE, "HACKFLIGHT_MSP_BUFFER too small for SET_VELOCITY_SETPOINTS");
+                const SET_VELOCITY_SETPOINTS_payload_t * payload = (const SET_VELOCITY_SETPOINTS_payload_t *)_inBuf;
+                handle_SET_VELOCITY_SETPOINTS(payload->vx, payload->vy, payload->vz, payload->yaw_rate);
+            }
+
+            void dispatch_SET_MOTOR_NORMAL(void)
+            {
+                static_assert(16 <= INBUF_SIZE, "HACKFLIGHT_MSP_BUFFER too small for SET_MOTOR_NORMAL");
+                const SET_MOTOR_NORMAL_payload_t * payload = (const SET_MOTOR_NORMAL_payload_t *)_inBuf;
+                handle_SET_MOTOR_NORMAL(payload->m1, payload->m2, payload->m3, payload->m4);
+            }
+
+            void dispatch_SET_RC_NORMAL(void)
+            {
+                static_assert(24 <= INBUF_SIZE, "HACKFLIGHT_MSP_BUFFER too small for SET_RC_NORMAL");
+                const SET_RC_NORMAL_payload_t * payload = (const SET_RC_NORMAL_payload_t *)_inBuf;
+                handle_SET_RC_NORMAL(payload->c1, payload->c2, payload->c3, payload->c4, payload->c5, payload->c6);
+            }
+
+            void dispatch_SET_ARMED(void)
+            {
+                static_assert(1 <= INBUF_SIZE, "HACKFLIGHT_MSP_BUFFER too small for SET_ARMED");
+                const SET_ARMED_payload_t * payload = (const SET_ARMED_payload_t *)_inBuf;
+                handle_SET_ARMED(payload->flag);
+            }
 
+            void dispatch_SET_TELEMETRY_RATE(void)
+            {
+                static_assert(4 <= INBUF_SIZE, "HACKFLIGHT_MSP_BUFFER too small for SET_TELEMETRY_RATE");
+                const SET_TELEMETRY_RATE_payload_t * payload = (const SET_TELEMETRY_RATE_payload_t *)_inBuf;
+                handle_SET_TELEMETRY_RATE(payload->rate);
+            }
+
+            void dispatch_SET_SUBSCRIPTION(void)
+            {
+                static_assert(6 <= INBUF_SIZE, "HACKFLIGHT_MSP_BUFFER too small for SET_SUBSCRIPTION");
+                const SET_SUBSCRIPTION_payload_t * payload = (const SET_SUBSCRIPTION_payload_t *)_inBuf;
+                handle_SET_SUBSCRIPTION(payload->rate, payload->message);
+            }
+
+            static const message_t * lookup(uint16_t id)
+            {
+                static const message_t messages[] = {
+                    {112, 0, 28, &MspParser::dispatch_STATE},
+                    {121, 0, 24, &MspParser::dispatch_RC_NORMAL},
+                    {122, 0, 12, &MspParser::dispatch_ATTITUDE_RADIANS},
+                    {123, 0, 52, &MspParser::dispatch_TRACE},
+                    {124, 0, 80, &MspParser::dispatch_TELEMETRY},
+                    {213, 16, 0, &MspParser::dispatch_SET_VELOCITY_SETPOINTS},
+                    {215, 16, 0, &MspParser::dispatch_SET_MOTOR_NORMAL},
+                    {217, 24, 0, &MspParser::dispatch_SET_RC_NORMAL},
+                    {216, 1, 0, &MspParser::dispatch_SET_ARMED},
+                    {218, 4, 0, &MspParser::dispatch_SET_TELEMETRY_RATE},
+                    {219, 6, 0, &MspParser::dispatch_SET_SUBSCRIPTION},
+                };
+
+                for (uint8_t k=0; k<sizeof(messages)/sizeof(messages[0]); ++k) {
+                    if (messages[k].id == id) {
+                        return &messages[k];
+                    }
                 }
+
+                return NULL;
             }
 
+        protected:
+
             virtual void handle_STATE_Request(float & altitude, float & variometer, float & positionX, float & positionY, float & heading, float & velocityForward, float & velocityRightward)
             {
                 (void)altitude;
@@ -407,6 +692,47 @@ namespace hf {
                 (void)yaw;
             }
 
+            virtual void handle_TRACE_Request(int32_t & count, int32_t & s1, int32_t & b1, int32_t & e1, int32_t & s2, int32_t & b2, int32_t & e2, int32_t & s3, int32_t & b3, int32_t & e3, int32_t & s4, int32_t & b4, int32_t & e4)
+            {
+                (void)count;
+                (void)s1;
+                (void)b1;
+                (void)e1;
+                (void)s2;
+                (void)b2;
+                (void)e2;
+                (void)s3;
+                (void)b3;
+                (void)e3;
+                (void)s4;
+                (void)b4;
+                (void)e4;
+            }
+
+            virtual void handle_TELEMETRY_Request(float & roll, float & pitch, float & yaw, float & altitude, float & variometer, float & positionX, float & positionY, float & heading, float & velocityForward, float & velocityRightward, float & c1, float & c2, float & c3, float & c4, float & c5, float & c6, float & m1, float & m2, float & m3, float & m4)
+            {
+                (void)roll;
+                (void)pitch;
+                (void)yaw;
+                (void)altitude;
+                (void)variometer;
+                (void)positionX;
+                (void)positionY;
+                (void)heading;
+                (void)velocityForward;
+                (void)velocityRightward;
+                (void)c1;
+                (void)c2;
+                (void)c3;
+                (void)c4;
+                (void)c5;
+                (void)c6;
+                (void)m1;
+                (void)m2;
+                (void)m3;
+                (void)m4;
+            }
+
             virtual void handle_SET_VELOCITY_SETPOINTS(float  vx, float  vy, float  vz, float  yaw_rate)
             {
                 (void)vx;
@@ -438,9 +764,20 @@ namespace hf {
                 (void)flag;
             }
 
+            virtual void handle_SET_TELEMETRY_RATE(float  rate)
+            {
+                (void)rate;
+            }
+
+            virtual void handle_SET_SUBSCRIPTION(float  rate, int16_t  message)
+            {
+                (void)rate;
+                (void)message;
+            }
+
         public:
 
-            static uint8_t serialize_STATE_Request(uint8_t bytes[])
+            static uint16_t serialize_STATE_Request(uint8_t bytes[])
             {
                 bytes[0] = 36;
                 bytes[1] = 77;
@@ -452,7 +789,23 @@ namespace hf {
                 return 6;
             }
 
-            static uint8_t serialize_STATE(uint8_t bytes[], float  altitude, float  variometer, float  positionX, float  positionY, float  heading, float  velocityForward, float  velocityRightward)
+            static uint16_t serialize_STATE_Request_V2(uint8_t bytes[])
+            {
+                bytes[0] = 36;
+                bytes[1] = 88;
+                bytes[2] = 60;
+                bytes[3] = 0;
+                bytes[4] = 112;
+                bytes[5] = 0;
+                bytes[6] = 0;
+                bytes[7] = 0;
+
+                bytes[8] = CRC8_DVB_S2(&bytes[3], 5);
+
+                return 9;
+            }
+
+            static uint16_t serialize_STATE(uint8_t bytes[], float  altitude, float  variometer, float  positionX, float  positionY, float  heading, float  velocityForward, float  velocityRightward)
             {
                 bytes[0] = 36;
                 bytes[1] = 77;
@@ -473,7 +826,31 @@ namespace hf {
                 return 34;
             }
 
-            static uint8_t serialize_RC_NORMAL_Request(uint8_t bytes[])
+            static uint16_t serialize_STATE_V2(uint8_t bytes[], float  altitude, float  variometer, float  positionX, float  positionY, float  heading, float  velocityForward, float  velocityRightward)
+            {
+                bytes[0] = 36;
+                bytes[1] = 88;
+                bytes[2] = 62;
+                bytes[3] = 0;
+                bytes[4] = 112;
+                bytes[5] = 0;
+                bytes[6] = 28;
+                bytes[7] = 0;
+
+                memcpy(&bytes[8], &altitude, sizeof(float));
+                memcpy(&bytes[12], &variometer, sizeof(float));
+                memcpy(&bytes[16], &positionX, sizeof(float));
+                memcpy(&bytes[20], &positionY, sizeof(float));
+                memcpy(&bytes[24], &heading, sizeof(float));
+                memcpy(&bytes[28], &velocityForward, sizeof(float));
+                memcpy(&bytes[32], &velocityRightward, sizeof(float));
+
+                bytes[36] = CRC8_DVB_S2(&bytes[3], 33);
+
+                return 37;
+            }
+
+            static uint16_t serialize_RC_NORMAL_Request(uint8_t bytes[])
             {
                 bytes[0] = 36;
                 bytes[1] = 77;
@@ -485,7 +862,23 @@ namespace hf {
                 return 6;
             }
 
-            static uint8_t serialize_RC_NORMAL(uint8_t bytes[], float  c1, float  c2, float  c3, float  c4, float  c5, float  c6)
+            static uint16_t serialize_RC_NORMAL_Request_V2(uint8_t bytes[])
+            {
+                bytes[0] = 36;
+                bytes[1] = 88;
+                bytes[2] = 60;
+                bytes[3] = 0;
+                bytes[4] = 121;
+                bytes[5] = 0;
+                bytes[6] = 0;
+                bytes[7] = 0;
+
+                bytes[8] = CRC8_DVB_S2(&bytes[3], 5);
+
+                return 9;
+            }
+
+            static uint16_t serialize_RC_NORMAL(uint8_t bytes[], float  c1, float  c2, float  c3, float  c4, float  c5, float  c6)
             {
                 bytes[0] = 36;
                 bytes[1] = 77;
@@ -505,7 +898,30 @@ namespace hf {
                 return 30;
             }
 
-            static uint8_t serialize_ATTITUDE_RADIANS_Request(uint8_t bytes[])
+            static uint16_t serialize_RC_NORMAL_V2(uint8_t bytes[], float  c1, float  c2, float  c3, float  c4, float  c5, float  c6)
+            {
+                bytes[0] = 36;
+                bytes[1] = 88;
+                bytes[2] = 62;
+                bytes[3] = 0;
+                bytes[4] = 121;
+                bytes[5] = 0;
+                bytes[6] = 24;
+                bytes[7] = 0;
+
+                memcpy(&bytes[8], &c1, sizeof(float));
+                memcpy(&bytes[12], &c2, sizeof(float));
+                memcpy(&bytes[16], &c3, sizeof(float));
+                memcpy(&bytes[20], &c4, sizeof(float));
+                memcpy(&bytes[24], &c5, sizeof(float));
+                memcpy(&bytes[28], &c6, sizeof(float));
+
+                bytes[32] = CRC8_DVB_S2(&bytes[3], 29);
+
+                return 33;
+            }
+
+            static uint16_t serialize_ATTITUDE_RADIANS_Request(uint8_t bytes[])
             {
                 bytes[0] = 36;
                 bytes[1] = 77;
@@ -517,7 +933,23 @@ namespace hf {
                 return 6;
             }
 
-            static uint8_t serialize_ATTITUDE_RADIANS(uint8_t bytes[], float  roll, float  pitch, float  yaw)
+            static uint16_t serialize_ATTITUDE_RADIANS_Request_V2(uint8_t bytes[])
+            {
+                bytes[0] = 36;
+                bytes[1] = 88;
+                bytes[2] = 60;
+                bytes[3] = 0;
+                bytes[4] = 122;
+                bytes[5] = 0;
+                bytes[6] = 0;
+                bytes[7] = 0;
+
+                bytes[8] = CRC8_DVB_S2(&bytes[3], 5);
+
+                return 9;
+            }
+
+            static uint16_t serialize_ATTITUDE_RADIANS(uint8_t bytes[], float  roll, float  pitch, float  yaw)
             {
                 bytes[0] = 36;
                 bytes[1] = 77;
@@ -534,7 +966,211 @@ namespace hf {
                 return 18;
             }
 
-            static uint8_t serialize_SET_VELOCITY_SETPOINTS(uint8_t bytes[], float  vx, float  vy, float  vz, float  yaw_rate)
+            static uint16_t serialize_ATTITUDE_RADIANS_V2(uint8_t bytes[], float  roll, float  pitch, float  yaw)
+            {
+                bytes[0] = 36;
+                bytes[1] = 88;
+                bytes[2] = 62;
+                bytes[3] = 0;
+                bytes[4] = 122;
+                bytes[5] = 0;
+                bytes[6] = 12;
+                bytes[7] = 0;
+
+                memcpy(&bytes[8], &roll, sizeof(float));
+                memcpy(&bytes[12], &pitch, sizeof(float));
+                memcpy(&bytes[16], &yaw, sizeof(float));
+
+                bytes[20] = CRC8_DVB_S2(&bytes[3], 17);
+
+                return 21;
+            }
+
+            static uint16_t serialize_TRACE_Request(uint8_t bytes[])
+            {
+                bytes[0] = 36;
+                bytes[1] = 77;
+                bytes[2] = 60;
+                bytes[3] = 0;
+                bytes[4] = 123;
+                bytes[5] = 123;
+
+                return 6;
+            }
+
+            static uint16_t serialize_TRACE_Request_V2(uint8_t bytes[])
+            {
+                bytes[0] = 36;
+                bytes[1] = 88;
+                bytes[2] = 60;
+                bytes[3] = 0;
+                bytes[4] = 123;
+                bytes[5] = 0;
+                bytes[6] = 0;
+                bytes[7] = 0;
+
+                bytes[8] = CRC8_DVB_S2(&bytes[3], 5);
+
+                return 9;
+            }
+
+            static uint16_t serialize_TRACE(uint8_t bytes[], int32_t  count, int32_t  s1, int32_t  b1, int32_t  e1, int32_t  s2, int32_t  b2, int32_t  e2, int32_t  s3, int32_t  b3, int32_t  e3, int32_t  s4, int32_t  b4, int32_t  e4)
+            {
+                bytes[0] = 36;
+                bytes[1] = 77;
+                bytes[2] = 62;
+                bytes[3] = 52;
+                bytes[4] = 123;
+
+                memcpy(&bytes[5], &count, sizeof(int32_t));
+                memcpy(&bytes[9], &s1, sizeof(int32_t));
+                memcpy(&bytes[13], &b1, sizeof(int32_t));
+                memcpy(&bytes[17], &e1, sizeof(int32_t));
+                memcpy(&bytes[21], &s2, sizeof(int32_t));
+                memcpy(&bytes[25], &b2, sizeof(int32_t));
+                memcpy(&bytes[29], &e2, sizeof(int32_t));
+                memcpy(&bytes[33], &s3, sizeof(int32_t));
+                memcpy(&bytes[37], &b3, sizeof(int32_t));
+                memcpy(&bytes[41], &e3, sizeof(int32_t));
+                memcpy(&bytes[45], &s4, sizeof(int32_t));
+                memcpy(&bytes[49], &b4, sizeof(int32_t));
+                memcpy(&bytes[53], &e4, sizeof(int32_t));
+
+                bytes[57] = CRC8(&bytes[3], 54);
+
+                return 58;
+            }
+
+            static uint16_t serialize_TRACE_V2(uint8_t bytes[], int32_t  count, int32_t  s1, int32_t  b1, int32_t  e1, int32_t  s2, int32_t  b2, int32_t  e2, int32_t  s3, int32_t  b3, int32_t  e3, int32_t  s4, int32_t  b4, int32_t  e4)
+            {
+                bytes[0] = 36;
+                bytes[1] = 88;
+                bytes[2] = 62;
+                bytes[3] = 0;
+                bytes[4] = 123;
+                bytes[5] = 0;
+                bytes[6] = 52;
+                bytes[7] = 0;
+
+                memcpy(&bytes[8], &count, sizeof(int32_t));
+                memcpy(&bytes[12], &s1, sizeof(int32_t));
+                memcpy(&bytes[16], &b1, sizeof(int32_t));
+                memcpy(&bytes[20], &e1, sizeof(int32_t));
+                memcpy(&bytes[24], &s2, sizeof(int32_t));
+                memcpy(&bytes[28], &b2, sizeof(int32_t));
+                memcpy(&bytes[32], &e2, sizeof(int32_t));
+                memcpy(&bytes[36], &s3, sizeof(int32_t));
+                memcpy(&bytes[40], &b3, sizeof(int32_t));
+                memcpy(&bytes[44], &e3, sizeof(int32_t));
+                memcpy(&bytes[48], &s4, sizeof(int32_t));
+                memcpy(&bytes[52], &b4, sizeof(int32_t));
+                memcpy(&bytes[56], &e4, sizeof(int32_t));
+
+                bytes[60] = CRC8_DVB_S2(&bytes[3], 57);
+
+                return 61;
+            }
+
+            static uint16_t serialize_TELEMETRY_Request(uint8_t bytes[])
+            {
+                bytes[0] = 36;
+                bytes[1] = 77;
+                bytes[2] = 60;
+                bytes[3] = 0;
+                bytes[4] = 124;
+                bytes[5] = 124;
+
+                return 6;
+            }
+
+            static uint16_t serialize_TELEMETRY_Request_V2(uint8_t bytes[])
+            {
+                bytes[0] = 36;
+                bytes[1] = 88;
+                bytes[2] = 60;
+                bytes[3] = 0;
+                bytes[4] = 124;
+                bytes[5] = 0;
+                bytes[6] = 0;
+                bytes[7] = 0;
+
+                bytes[8] = CRC8_DVB_S2(&bytes[3], 5);
+
+                return 9;
+            }
+
+            static uint16_t serialize_TELEMETRY(uint8_t bytes[], float  roll, float  pitch, float  yaw, float  altitude, float  variometer, float  positionX, float  positionY, float  heading, float  velocityForward, float  velocityRightward, float  c1, float  c2, float  c3, float  c4, float  c5, float  c6, float  m1, float  m2, float  m3, float  m4)
+            {
+                bytes[0] = 36;
+                bytes[1] = 77;
+                bytes[2] = 62;
+                bytes[3] = 80;
+                bytes[4] = 124;
+
+                memcpy(&bytes[5], &roll, sizeof(float));
+                memcpy(&bytes[9], &pitch, sizeof(float));
+                memcpy(&bytes[13], &yaw, sizeof(float));
+                memcpy(&bytes[17], &altitude, sizeof(float));
+                memcpy(&bytes[21], &variometer, sizeof(float));
+                memcpy(&bytes[25], &positionX, sizeof(float));
+                memcpy(&bytes[29], &positionY, sizeof(float));
+                memcpy(&bytes[33], &heading, sizeof(float));
+                memcpy(&bytes[37], &velocityForward, sizeof(float));
+                memcpy(&bytes[41], &velocityRightward, sizeof(float));
+                memcpy(&bytes[45], &c1, sizeof(float));
+                memcpy(&bytes[49], &c2, sizeof(float));
+                memcpy(&bytes[53], &c3, sizeof(float));
+                memcpy(&bytes[57], &c4, sizeof(float));
+                memcpy(&bytes[61], &c5, sizeof(float));
+                memcpy(&bytes[65], &c6, sizeof(float));
+                memcpy(&bytes[69], &m1, sizeof(float));
+                memcpy(&bytes[73], &m2, sizeof(float));
+                memcpy(&bytes[77], &m3, sizeof(float));
+                memcpy(&bytes[81], &m4, sizeof(float));
+
+                bytes[85] = CRC8(&bytes[3], 82);
+
+                return 86;
+            }
+
+            static uint16_t serialize_TELEMETRY_V2(uint8_t bytes[], float  roll, float  pitch, float  yaw, float  altitude, float  variometer, float  positionX, float  positionY, float  heading, float  velocityForward, float  velocityRightward, float  c1, float  c2, float  c3, float  c4, float  c5, float  c6, float  m1, float  m2, float  m3, float  m4)
+            {
+                bytes[0] = 36;
+                bytes[1] = 88;
+                bytes[2] = 62;
+                bytes[3] = 0;
+                bytes[4] = 124;
+                bytes[5] = 0;
+                bytes[6] = 80;
+                bytes[7] = 0;
+
+                memcpy(&bytes[8], &roll, sizeof(float));
+                memcpy(&bytes[12], &pitch, sizeof(float));
+                memcpy(&bytes[16], &yaw, sizeof(float));
+                memcpy(&bytes[20], &altitude, sizeof(float));
+                memcpy(&bytes[24], &variometer, sizeof(float));
+                memcpy(&bytes[28], &positionX, sizeof(float));
+                memcpy(&bytes[32], &positionY, sizeof(float));
+                memcpy(&bytes[36], &heading, sizeof(float));
+                memcpy(&bytes[40], &velocityForward, sizeof(float));
+                memcpy(&bytes[44], &velocityRightward, sizeof(float));
+                memcpy(&bytes[48], &c1, sizeof(float));
+                memcpy(&bytes[52], &c2, sizeof(float));
+                memcpy(&bytes[56], &c3, sizeof(float));
+                memcpy(&bytes[60], &c4, sizeof(float));
+                memcpy(&bytes[64], &c5, sizeof(float));
+                memcpy(&bytes[68], &c6, sizeof(float));
+                memcpy(&bytes[72], &m1, sizeof(float));
+                memcpy(&bytes[76], &m2, sizeof(float));
+                memcpy(&bytes[80], &m3, sizeof(float));
+                memcpy(&bytes[84], &m4, sizeof(float));
+
+                bytes[88] = CRC8_DVB_S2(&bytes[3], 85);
+
+                return 89;
+            }
+
+            static uint16_t serialize_SET_VELOCITY_SETPOINTS(uint8_t bytes[], float  vx, float  vy, float  vz, float  yaw_rate)
             {
                 bytes[0] = 36;
                 bytes[1] = 77;
@@ -552,7 +1188,28 @@ namespace hf {
                 return 22;
             }
 
-            static uint8_t serialize_SET_MOTOR_NORMAL(uint8_t bytes[], float  m1, float  m2, float  m3, float  m4)
+            static uint16_t serialize_SET_VELOCITY_SETPOINTS_V2(uint8_t bytes[], float  vx, float  vy, float  vz, float  yaw_rate)
+            {
+                bytes[0] = 36;
+                bytes[1] = 88;
+                bytes[2] = 60;
+                bytes[3] = 0;
+                bytes[4] = 213;
+                bytes[5] = 0;
+                bytes[6] = 16;
+                bytes[7] = 0;
+
+                memcpy(&bytes[8], &vx, sizeof(float));
+                memcpy(&bytes[12], &vy, sizeof(float));
+                memcpy(&bytes[16], &vz, sizeof(float));
+                memcpy(&bytes[20], &yaw_rate, sizeof(float));
+
+                bytes[24] = CRC8_DVB_S2(&bytes[3], 21);
+
+                return 25;
+            }
+
+            static uint16_t serialize_SET_MOTOR_NORMAL(uint8_t bytes[], float  m1, float  m2, float  m3, float  m4)
             {
                 bytes[0] = 36;
                 bytes[1] = 77;
@@ -570,7 +1227,28 @@ namespace hf {
                 return 22;
             }
 
-            static uint8_t serialize_SET_RC_NORMAL(uint8_t bytes[], float  c1, float  c2, float  c3, float  c4, float  c5, float  c6)
+            static uint16_t serialize_SET_MOTOR_NORMAL_V2(uint8_t bytes[], float  m1, float  m2, float  m3, float  m4)
+            {
+                bytes[0] = 36;
+                bytes[1] = 88;
+                bytes[2] = 60;
+                bytes[3] = 0;
+                bytes[4] = 215;
+                bytes[5] = 0;
+                bytes[6] = 16;
+                bytes[7] = 0;
+
+                memcpy(&bytes[8], &m1, sizeof(float));
+                memcpy(&bytes[12], &m2, sizeof(float));
+                memcpy(&bytes[16], &m3, sizeof(float));
+                memcpy(&bytes[20], &m4, sizeof(float));
+
+                bytes[24] = CRC8_DVB_S2(&bytes[3], 21);
+
+                return 25;
+            }
+
+            static uint16_t serialize_SET_RC_NORMAL(uint8_t bytes[], float  c1, float  c2, float  c3, float  c4, float  c5, float  c6)
             {
                 bytes[0] = 36;
                 bytes[1] = 77;
@@ -590,7 +1268,30 @@ namespace hf {
                 return 30;
             }
 
-            static uint8_t serialize_SET_ARMED(uint8_t bytes[], uint8_t  flag)
+            static uint16_t serialize_SET_RC_NORMAL_V2(uint8_t bytes[], float  c1, float  c2, float  c3, float  c4, float  c5, float  c6)
+            {
+                bytes[0] = 36;
+                bytes[1] = 88;
+                bytes[2] = 60;
+                bytes[3] = 0;
+                bytes[4] = 217;
+                bytes[5] = 0;
+                bytes[6] = 24;
+                bytes[7] = 0;
+
+                memcpy(&bytes[8], &c1, sizeof(float));
+                memcpy(&bytes[12], &c2, sizeof(float));
+                memcpy(&bytes[16], &c3, sizeof(float));
+                memcpy(&bytes[20], &c4, sizeof(float));
+                memcpy(&bytes[24], &c5, sizeof(float));
+                memcpy(&bytes[28], &c6, sizeof(float));
+
+                bytes[32] = CRC8_DVB_S2(&bytes[3], 29);
+
+                return 33;
+            }
+
+            static uint16_t serialize_SET_ARMED(uint8_t bytes[], uint8_t  flag)
             {
                 bytes[0] = 36;
                 bytes[1] = 77;
@@ -605,6 +1306,92 @@ namespace hf {
                 return 7;
             }
 
+            static uint16_t serialize_SET_ARMED_V2(uint8_t bytes[], uint8_t  flag)
+            {
+                bytes[0] = 36;
+                bytes[1] = 88;
+                bytes[2] = 60;
+                bytes[3] = 0;
+                bytes[4] = 216;
+                bytes[5] = 0;
+                bytes[6] = 1;
+                bytes[7] = 0;
+
+                memcpy(&bytes[8], &flag, sizeof(uint8_t));
+
+                bytes[9] = CRC8_DVB_S2(&bytes[3], 6);
+
+                return 10;
+            }
+
+            static uint16_t serialize_SET_TELEMETRY_RATE(uint8_t bytes[], float  rate)
+            {
+                bytes[0] = 36;
+                bytes[1] = 77;
+                bytes[2] = 62;
+                bytes[3] = 4;
+                bytes[4] = 218;
+
+                memcpy(&bytes[5], &rate, sizeof(float));
+
+                bytes[9] = CRC8(&bytes[3], 6);
+
+                return 10;
+            }
+
+            static uint16_t serialize_SET_TELEMETRY_RATE_V2(uint8_t bytes[], float  rate)
+            {
+                bytes[0] = 36;
+                bytes[1] = 88;
+                bytes[2] = 60;
+                bytes[3] = 0;
+                bytes[4] = 218;
+                bytes[5] = 0;
+                bytes[6] = 4;
+                bytes[7] = 0;
+
+                memcpy(&bytes[8], &rate, sizeof(float));
+
+                bytes[12] = CRC8_DVB_S2(&bytes[3], 9);
+
+                return 13;
+            }
+
+            static uint16_t serialize_SET_SUBSCRIPTION(uint8_t bytes[], float  rate, int16_t  message)
+            {
+                bytes[0] = 36;
+                bytes[1] = 77;
+                bytes[2] = 62;
+                bytes[3] = 6;
+                bytes[4] = 219;
+
+                memcpy(&bytes[5], &rate, sizeof(float));
+                memcpy(&bytes[9], &message, sizeof(int16_t));
+
+                bytes[11] = CRC8(&bytes[3], 8);
+
+                return 12;
+            }
+
+            static uint16_t serialize_SET_SUBSCRIPTION_V2(uint8_t bytes[], float  rate, int16_t  message)
+            {
+                bytes[0] = 36;
+                bytes[1] = 88;
+                bytes[2] = 60;
+                bytes[3] = 0;
+                bytes[4] = 219;
+                bytes[5] = 0;
+                bytes[6] = 6;
+                bytes[7] = 0;
+
+                memcpy(&bytes[8], &rate, sizeof(float));
+                memcpy(&bytes[12], &message, sizeof(int16_t));
+
+                bytes[14] = CRC8_DVB_S2(&bytes[3], 11);
+
+                return 15;
+            }
+
     }; // class MspParser
 
 } // namespace hf
@@ -0,0 +1,140 @@
+/*
+   Compile-time chain of PID controllers
+
+   For an airframe whose controllers are known when the sketch is written,
+   a PidChain runs them in the order listed with direct, inlinable calls
+   instead of a virtual call per controller through a pointer table:
+
+       hf::PidChain<hf::LevelPid, hf::RatePid, hf::AltitudeHoldPid> chain(levelPid, ratePid, altholdPid);
+       chain.setAuxState(altholdPid, 1);
+       h.setPidChain(&chain);
+
+   Controllers used in a chain must declare PidChain a friend, as the ones in
+   pidcontrollers/ do.
+
+   Copyright (c) 2020 Simon D. Levy
+
+   This file is part of Hackflight.
+
+   Hackflight is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   Hackflight is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+   You should have received a copy of the GNU General Public License
+   along with Hackflight.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "datatypes.hpp"
+#include "pidcontroller.hpp"
+
+namespace hf {
+
+    // Lets PidTask hold any chain; this is the only virtual call per update
+    class PidChainBase {
+
+        friend class PidTask;
+
+        protected:
+
+            virtual void run(state_t * state, demands_t & demands, uint64_t usec,
+                    uint8_t auxState, bool throttleIsDown, bool & shouldFlash) = 0;
+
+    }; // class PidChainBase
+
+    // Empty chain ends the recursion
+    template <>
+    class PidChain<> : public PidChainBase {
+
+        protected:
+
+            void runChain(state_t * state, demands_t & demands, uint64_t usec,
+                    uint8_t auxState, bool throttleIsDown, bool & shouldFlash)
+            {
+                (void)state; (void)demands; (void)usec; (void)auxState; (void)throttleIsDown; (void)shouldFlash;
+            }
+
+            virtual void run(state_t * state, demands_t & demands, uint64_t usec,
+                    uint8_t auxState, bool throttleIsDown, bool & shouldFlash) override
+            {
+                runChain(state, demands, usec, auxState, throttleIsDown, shouldFlash);
+            }
+
+        public:
+
+            // Same meaning as the arguments to Hackflight::addPidController()
+
+            void setAuxState(PidController & controller, uint8_t auxState)
+            {
+                controller.auxState = auxState;
+            }
+
+            void setFrequency(PidController & controller, float freq)
+            {
+                controller.setFrequency(freq);
+            }
+
+    }; // class PidChain<>
+
+    template <typename Controller, typename... Rest>
+    class PidChain<Controller, Rest...> : public PidChain<Rest...> {
+
+        template <typename... Controllers> friend class PidChain;
+
+        private:
+
+            Controller & _controller;
+
+        protected:
+
+            // Same steps as the loop in PidTask::doTask(), with the calls qualified by
+            // the concrete type so that they bind statically
+            void runChain(state_t * state, demands_t & demands, uint64_t usec,
+                    uint8_t auxState, bool throttleIsDown, bool & shouldFlash)
+            {
+                _controller.Controller::updateReceiver(throttleIsDown);
+
+                if (_controller.auxState <= auxState) {
+
+                    if (_controller.due(usec)) {
+                        _controller.Controller::modifyDemands(state, demands);
+                        _controller._heldDemands = demands;
+                    }
+                    else {
+                        _controller.holdDemands(demands, _controller.Controller::modifiedDemands());
+                    }
+
+                    if (_controller.Controller::shouldFlashLed()) {
+                        shouldFlash = true;
+                    }
+                }
+
+                else {
+                    _controller.restart();
+                }
+
+                PidChain<Rest...>::runChain(state, demands, usec, auxState, throttleIsDown, shouldFlash);
+            }
+
+            virtual void run(state_t * state, demands_t & demands, uint64_t usec,
+                    uint8_t auxState, bool throttleIsDown, bool & shouldFlash) override
+            {
+                runChain(state, demands, usec, auxState, throttleIsDown, shouldFlash);
+            }
+
+        public:
+
+            PidChain(Controller & controller, Rest &... rest)
+                : PidChain<Rest...>(rest...), _controller(controller)
+            {
+            }
+
+    }; // class PidChain
+
+} // namespace hf
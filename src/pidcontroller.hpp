@@ -25,22 +25,82 @@
 
 namespace hf {
 
+    template <typename... Controllers> class PidChain;
+
     class PidController {
 
         friend class PidTask;
+        template <typename... Controllers> friend class PidChain;
+
+        private:
+
+            // Multi-rate support: a zero period runs on every PID task update
+            uint32_t _periodUsec = 0;
+            uint64_t _releaseUsec = 0;
+
+            // Output from the most recent run, reused until the next one
+            demands_t _heldDemands = {};
+
+            bool due(uint64_t usec)
+            {
+                if (_periodUsec == 0) return true;
+
+                if (usec < _releaseUsec) return false;
+
+                // Fixed phase, skipping any releases we've missed entirely
+                _releaseUsec += _periodUsec;
+                if (_releaseUsec <= usec) {
+                    _releaseUsec = usec + _periodUsec;
+                }
+
+                return true;
+            }
+
+            // Run again as soon as the controller becomes active
+            void restart(void)
+            {
+                _releaseUsec = 0;
+            }
+
+            // Modified is the result of modifiedDemands()
+            void holdDemands(demands_t & demands, uint8_t modified)
+            {
+                if (modified & DEMAND_THROTTLE) demands.throttle = _heldDemands.throttle;
+                if (modified & DEMAND_ROLL)     demands.roll     = _heldDemands.roll;
+                if (modified & DEMAND_PITCH)    demands.pitch    = _heldDemands.pitch;
+                if (modified & DEMAND_YAW)      demands.yaw      = _heldDemands.yaw;
+            }
 
         protected:
 
             static constexpr float STICK_DEADBAND = 0.10;
 
+            // Bits for modifiedDemands()
+            enum {
+                DEMAND_THROTTLE = 0x01,
+                DEMAND_ROLL     = 0x02,
+                DEMAND_PITCH    = 0x04,
+                DEMAND_YAW      = 0x08,
+                DEMAND_ALL      = 0x0F
+            };
+
             virtual void modifyDemands(state_t * state, demands_t & demands) = 0;
 
+            // Demands written by modifyDemands(); only these are held between runs
+            // when the controller runs slower than the PID task
+            virtual uint8_t modifiedDemands(void) { return DEMAND_ALL; }
+
             virtual bool shouldFlashLed(void) { return false; }
 
             virtual void updateReceiver(bool throttleIsDown) { (void)throttleIsDown; }
 
             uint8_t auxState = 0;
 
+            void setFrequency(float freq)
+            {
+                _periodUsec = freq > 0 ? (uint32_t)(1e6f / freq + 0.5f) : 0;
+            }
+
     };  // class PidController
 
     // PID controller for a single degree of freedom
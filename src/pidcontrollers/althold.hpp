@@ -28,6 +28,8 @@ namespace hf {
 
     class AltitudeHoldPid : public PidController {
 
+        template <typename... Controllers> friend class PidChain;
+
         private: 
 
             // Arbitrary constants
@@ -58,6 +60,11 @@ namespace hf {
                 }
             }
 
+            virtual uint8_t modifiedDemands(void) override
+            {
+                return DEMAND_THROTTLE;
+            }
+
             virtual bool shouldFlashLed(void) override 
             {
                 return true;
@@ -27,6 +27,8 @@ namespace hf {
 
     class FlowHoldPid : public PidController {
 
+        template <typename... Controllers> friend class PidChain;
+
         private: 
 
             // Helper class
@@ -62,6 +64,11 @@ namespace hf {
                 _rollPid.update(demands.pitch, state->bodyVel[0]);
             }
 
+            virtual uint8_t modifiedDemands(void) override
+            {
+                return DEMAND_ROLL | DEMAND_PITCH;
+            }
+
             virtual bool shouldFlashLed(void) override 
             {
                 return true;
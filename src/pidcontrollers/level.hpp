@@ -27,6 +27,8 @@ namespace hf {
 
     class LevelPid : public PidController {
 
+        template <typename... Controllers> friend class PidChain;
+
         private:
 
             // Helper class
@@ -76,6 +78,11 @@ namespace hf {
                 demands.pitch = _pitchPid.compute(demands.pitch, state->rotation[1]);
             }
 
+            virtual uint8_t modifiedDemands(void) override
+            {
+                return DEMAND_ROLL | DEMAND_PITCH;
+            }
+
     };  // class LevelPid
 
 } // namespace
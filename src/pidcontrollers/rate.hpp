@@ -63,6 +63,8 @@ namespace hf {
 
     class RatePid : public PidController {
 
+        template <typename... Controllers> friend class PidChain;
+
         private: 
 
             // Aribtrary constants
@@ -97,6 +99,11 @@ namespace hf {
                 }
             }
 
+            virtual uint8_t modifiedDemands(void) override
+            {
+                return DEMAND_ROLL | DEMAND_PITCH | DEMAND_YAW;
+            }
+
             virtual void updateReceiver(bool throttleIsDown) override
             {
                 // Check throttle-down for integral reset
@@ -0,0 +1,104 @@
+/*
+   Simulated receiver for running Hackflight on a host computer
+
+   Copyright (c) 2020 Simon D. Levy
+
+   This file is part of Hackflight.
+
+   Hackflight is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   Hackflight is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+   You should have received a copy of the GNU General Public License
+   along with Hackflight.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "receiver.hpp"
+
+namespace hf {
+
+    class SimReceiver : public Receiver {
+
+        private:
+
+            static constexpr uint8_t DEFAULT_CHANNEL_MAP[6] = {0, 1, 2, 3, 4, 5};
+
+            // Stick and switch positions in [-1,+1], set by the simulation
+            float _channels[MAXCHAN] = {0};
+
+            bool _newFrame = false;
+            bool _lostSignal = false;
+
+        protected:
+
+            virtual bool gotNewFrame(void) override
+            {
+                bool result = _newFrame;
+                _newFrame = false;
+                return result;
+            }
+
+            virtual void readRawvals(void) override
+            {
+                for (uint8_t k=0; k<MAXCHAN; ++k) {
+                    rawvals[k] = _channels[k];
+                }
+            }
+
+            virtual bool lostSignal(void) override
+            {
+                return _lostSignal;
+            }
+
+        public:
+
+            SimReceiver(const uint8_t channelMap[6]=DEFAULT_CHANNEL_MAP, float demandScale=1.0)
+                : Receiver(channelMap, demandScale)
+            {
+                // Start with throttle down and switches off
+                for (uint8_t k=0; k<MAXCHAN; ++k) {
+                    _channels[k] = -1;
+                }
+            }
+
+            // Channels are raw (unmapped) indices, as a transmitter would send them
+            void setChannel(uint8_t chan, float value)
+            {
+                _channels[chan] = value;
+                _newFrame = true;
+            }
+
+            void setChannels(const float values[], uint8_t count)
+            {
+                for (uint8_t k=0; k<count && k<MAXCHAN; ++k) {
+                    _channels[k] = values[k];
+                }
+                _newFrame = true;
+            }
+
+            void setLostSignal(bool lost)
+            {
+                _lostSignal = lost;
+            }
+
+            // Demands from the latest frame, shaped and scaled as the PID controllers receive them
+            void getShapedDemands(demands_t & shaped)
+            {
+                shaped.throttle = demands.throttle;
+                shaped.roll     = demands.roll  * _demandScale;
+                shaped.pitch    = demands.pitch * _demandScale;
+                shaped.yaw      = demands.yaw   * _demandScale;
+            }
+
+    }; // class SimReceiver
+
+    constexpr uint8_t SimReceiver::DEFAULT_CHANNEL_MAP[6];
+
+} // namespace hf
@@ -0,0 +1,603 @@
+/*
+   Flight-log recorder: on each PID update, captures the vehicle state, the
+   raw receiver channels, the demands going into and out of each PID
+   controller, and the motor values, as a binary record in a RAM ring buffer.
+   A RecorderTask drains the buffer to a LogSink at low priority.
+
+   Every value is quantized to a 16-bit integer (value = count * scale, with
+   the scales below).  Records come in three fixed-layout types, each starting
+   with a type byte whose upper bits carry the armed and failsafe flags:
+
+     SCHEMA: type, 'H', 'F', 'L', 'G', version, stages, raw channels, motors
+     KEY:    type, uint32 microseconds, int16 per channel
+     DELTA:  type, uint16 microseconds since previous record, int8 per channel
+             (change from the previous record)
+
+   With setInputs(true), the log also gets every sensor and receiver reading
+   as Hackflight consumes it, unquantized, so that the flight can be replayed
+   through Hackflight::update() on the host (extras/sim/replay.cpp):
+
+     INPUT:  type | input << 2, uint32 microseconds, float32 per value
+
+   The number of values is fixed for each input (INPUT_VALUES below).  Input
+   records may come before the first SCHEMA record.
+
+   Multi-byte values are little-endian.  Channels are in the order: state
+   (location, rotation, angularVel, bodyAccel, bodyVel, inertialVel), demands
+   for each stage (throttle, roll, pitch, yaw; the first stage is the
+   receiver, followed by the output of a PidChain if there is one, then of
+   each controller in the order added), raw receiver channels, and motors.
+
+   A KEY record is written when a change doesn't fit in a byte, every
+   KEY_INTERVAL records, and after records have been dropped because the
+   buffer was full, so a decoder can always resynchronize.  A SCHEMA record
+   precedes the first record and any change in the number of channels.
+
+   extras/debug/python/decodelog.py converts a log to CSV.
+
+   Copyright (c) 2020 Simon D. Levy
+
+   This file is part of Hackflight.
+
+   Hackflight is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   Hackflight is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+   You should have received a copy of the GNU General Public License
+   along with Hackflight.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <stdint.h>
+#include <string.h>
+
+#include "datatypes.hpp"
+#include "actuators/mixer.hpp"
+
+// Ring-buffer RAM for the recorder; must be a power of two
+#ifndef HACKFLIGHT_RECORDER_BYTES
+#define HACKFLIGHT_RECORDER_BYTES 4096
+#endif
+
+namespace hf {
+
+    class Recorder {
+
+        friend class Hackflight;
+        friend class PidTask;
+
+        public:
+
+            static const uint8_t VERSION = 2;
+
+            typedef enum {
+                RECORD_DELTA,
+                RECORD_KEY,
+                RECORD_SCHEMA,
+                RECORD_INPUT
+            } record_t;
+
+            typedef enum {
+                INPUT_START,            // first update() after setRecorder()
+                INPUT_UPDATE,           // an update() whose PID run wasn't recorded
+                INPUT_RECEIVER,         // raw channels of a new frame
+                INPUT_LOST_SIGNAL,      // 1 or 0, on each change
+                INPUT_GYRO,             // as read from the IMU, before negation
+                INPUT_GYRO_INTERRUPT,   // same, read in gyroInterrupt()
+                INPUT_QUATERNION,       // w, x, y, z
+                INPUT_RANGE,            // m, whether or not the rangefinder accepts it
+                INPUT_FLOW,             // motion counts x, y
+                INPUT_COUNT
+            } input_t;
+
+            static const uint8_t INPUT_SHIFT = 2;
+
+            static const uint8_t RECORD_MASK   = 0x03;
+            static const uint8_t FLAG_ARMED    = 0x04;
+            static const uint8_t FLAG_FAILSAFE = 0x08;
+
+            static constexpr float SCALE_STATE    = 1e-3f;  // m, m/s, rad/s, Gs
+            static constexpr float SCALE_ROTATION = 2e-4f;  // rad
+            static constexpr float SCALE_DEMAND   = 1e-3f;
+            static constexpr float SCALE_RAW      = 1e-3f;
+            static constexpr float SCALE_MOTOR    = 1e-4f;
+
+            static const uint8_t STATE_CHANNELS = 18;
+            static const uint8_t RAW_CHANNELS   = 6;
+            static const uint8_t MAX_STAGES     = 8;
+            static const uint8_t MAX_MOTORS     = 8;
+            static const uint8_t MAX_CHANNELS   = STATE_CHANNELS + 4*MAX_STAGES + RAW_CHANNELS + MAX_MOTORS;
+
+            static const uint8_t RECEIVER_CHANNELS = 8; // Receiver::MAXCHAN
+            static const uint8_t MAX_INPUT_VALUES  = RECEIVER_CHANNELS;
+
+            static const uint8_t KEY_INTERVAL = 64;
+
+            static const uint16_t SIZE = HACKFLIGHT_RECORDER_BYTES;
+
+        private:
+
+            // Single producer (PidTask) and single consumer (RecorderTask), so no locking:
+            // the producer only advances _head and the consumer only advances _tail.
+            uint8_t _buffer[SIZE];
+            volatile uint16_t _head = 0;
+            volatile uint16_t _tail = 0;
+
+            // Motor values come from here
+            Mixer * _mixer = NULL;
+
+            // Layout of the current records
+            uint8_t _nstages = 0;
+            uint8_t _nmotors = 0;
+            uint8_t _nchannels = 0;
+
+            // This cycle's values and the previous record's
+            int16_t _current[MAX_CHANNELS] = {0};
+            int16_t _previous[MAX_CHANNELS] = {0};
+            uint32_t _usec = 0;
+            uint32_t _previousUsec = 0;
+            uint8_t _flags = 0;
+
+            uint8_t _stage = 0;
+
+            bool _needSchema = true;
+            bool _needKey = true;
+            uint8_t _sinceKey = 0;
+
+            // Record every _divisor'th PID update
+            uint8_t _divisor = 1;
+            uint8_t _cycle = 0;
+            bool _recording = false;
+
+            uint32_t _records = 0;
+            uint32_t _dropped = 0;
+
+            // Input capture for replay
+            bool _inputs = false;
+            bool _started = false;
+            bool _lostSignal = false;
+
+            // gyroInterrupt() may run in an interrupt, so its samples wait here (single
+            // producer, single consumer again) until the next update() copies them into
+            // the buffer, keeping the buffer single-producer
+            static const uint8_t PENDING_SIZE = 4;
+            float _pendingGyro[PENDING_SIZE][3] = {};
+            uint32_t _pendingUsec[PENDING_SIZE] = {0};
+            volatile uint8_t _pendingHead = 0;
+            volatile uint8_t _pendingTail = 0;
+
+            // Gyro samples lost because the queue was full; only the interrupt writes it
+            volatile uint32_t _pendingDropped = 0;
+
+            static int16_t quantize(float value, float scale)
+            {
+                float count = value / scale;
+
+                if (count > INT16_MAX) return INT16_MAX;
+                if (count < INT16_MIN) return INT16_MIN;
+
+                return (int16_t)(count < 0 ? count - 0.5f : count + 0.5f);
+            }
+
+            void quantize3(const float values[3], float scale, uint8_t & channel)
+            {
+                for (uint8_t k=0; k<3; ++k) {
+                    _current[channel++] = quantize(values[k], scale);
+                }
+            }
+
+            uint16_t space(void)
+            {
+                return SIZE - 1 - ((_head - _tail) & (SIZE - 1));
+            }
+
+            void put(uint16_t & head, uint8_t byte)
+            {
+                _buffer[head] = byte;
+                head = (head + 1) & (SIZE - 1);
+            }
+
+            void put16(uint16_t & head, uint16_t value)
+            {
+                put(head, value & 0xFF);
+                put(head, value >> 8);
+            }
+
+            void put32(uint16_t & head, uint32_t value)
+            {
+                put16(head, value & 0xFFFF);
+                put16(head, value >> 16);
+            }
+
+            bool deltasFit(void)
+            {
+                for (uint8_t k=0; k<_nchannels; ++k) {
+                    int32_t delta = (int32_t)_current[k] - _previous[k];
+                    if (delta < INT8_MIN || delta > INT8_MAX) {
+                        return false;
+                    }
+                }
+
+                return true;
+            }
+
+            void setLayout(uint8_t nstages)
+            {
+                uint8_t nmotors = _mixer ? _mixer->_nmotors : 0;
+
+                if (nmotors > MAX_MOTORS) {
+                    nmotors = MAX_MOTORS;
+                }
+
+                if (nstages != _nstages || nmotors != _nmotors) {
+                    _nstages = nstages;
+                    _nmotors = nmotors;
+                    _nchannels = STATE_CHANNELS + 4*nstages + RAW_CHANNELS + nmotors;
+                    _needSchema = true;
+                }
+            }
+
+            void write(void)
+            {
+                uint32_t dusec = _usec - _previousUsec;
+
+                bool key = _needSchema || _needKey || _sinceKey >= KEY_INTERVAL || dusec > UINT16_MAX || !deltasFit();
+
+                uint16_t size = key ? 1 + 4 + 2*_nchannels : 1 + 2 + _nchannels;
+                if (_needSchema) {
+                    size += 9;
+                }
+
+                // Keep what's already there rather than stall the loop
+                if (space() < size) {
+                    _dropped++;
+                    _needKey = true;
+                    return;
+                }
+
+                uint16_t head = _head;
+
+                if (_needSchema) {
+                    put(head, RECORD_SCHEMA);
+                    put(head, 'H');
+                    put(head, 'F');
+                    put(head, 'L');
+                    put(head, 'G');
+                    put(head, VERSION);
+                    put(head, _nstages);
+                    put(head, RAW_CHANNELS);
+                    put(head, _nmotors);
+                }
+
+                if (key) {
+                    put(head, RECORD_KEY | _flags);
+                    put32(head, _usec);
+                    for (uint8_t k=0; k<_nchannels; ++k) {
+                        put16(head, (uint16_t)_current[k]);
+                    }
+                    _sinceKey = 0;
+                }
+                else {
+                    put(head, RECORD_DELTA | _flags);
+                    put16(head, (uint16_t)dusec);
+                    for (uint8_t k=0; k<_nchannels; ++k) {
+                        put(head, (uint8_t)(int8_t)(_current[k] - _previous[k]));
+                    }
+                    _sinceKey++;
+                }
+
+                // Publish the whole record at once
+                _head = head;
+
+                for (uint8_t k=0; k<_nchannels; ++k) {
+                    _previous[k] = _current[k];
+                }
+                _previousUsec = _usec;
+
+                _needSchema = false;
+                _needKey = false;
+                _records++;
+            }
+
+            void writeInput(uint8_t input, uint32_t usec, const float values[])
+            {
+                uint8_t count = inputValues(input);
+
+                if (space() < 1 + 4 + 4*count) {
+                    _dropped++;
+                    _needKey = true;
+                    return;
+                }
+
+                uint16_t head = _head;
+
+                put(head, RECORD_INPUT | (input << INPUT_SHIFT));
+                put32(head, usec);
+
+                for (uint8_t k=0; k<count; ++k) {
+                    uint32_t bits = 0;
+                    memcpy(&bits, &values[k], 4);
+                    put32(head, bits);
+                }
+
+                _head = head;
+            }
+
+            // Producer side, called from Hackflight::update() and the sensors --------
+
+            void beginUpdate(const timing_t & timing)
+            {
+                if (!_inputs) return;
+
+                // These came before this update
+                uint8_t tail = _pendingTail;
+
+                while (tail != _pendingHead) {
+
+                    // Read the entry only after seeing the head that published it
+                    std::atomic_signal_fence(std::memory_order_acquire);
+
+                    writeInput(INPUT_GYRO_INTERRUPT, _pendingUsec[tail], _pendingGyro[tail]);
+
+                    // Free the entry only after reading it
+                    std::atomic_signal_fence(std::memory_order_release);
+                    tail = (tail + 1) % PENDING_SIZE;
+                    _pendingTail = tail;
+                }
+
+                if (!_started) {
+                    writeInput(INPUT_START, (uint32_t)timing.usec, NULL);
+                    _started = true;
+                }
+            }
+
+            void recordInput(uint8_t input, const timing_t & timing, const float values[])
+            {
+                if (_inputs) {
+                    writeInput(input, (uint32_t)timing.usec, values);
+                }
+            }
+
+            void recordLostSignal(const timing_t & timing, bool lost)
+            {
+                if (_inputs && lost != _lostSignal) {
+                    float value = lost ? 1 : 0;
+                    writeInput(INPUT_LOST_SIGNAL, (uint32_t)timing.usec, &value);
+                    _lostSignal = lost;
+                }
+            }
+
+            void recordGyroInterrupt(const timing_t & timing, float x, float y, float z)
+            {
+                if (!_inputs) return;
+
+                uint8_t head = _pendingHead;
+                uint8_t next = (head + 1) % PENDING_SIZE;
+
+                if (next == _pendingTail) {
+                    _pendingDropped = _pendingDropped + 1;
+                    return;
+                }
+
+                // Write the entry only after seeing the tail that freed it
+                std::atomic_signal_fence(std::memory_order_acquire);
+
+                _pendingGyro[head][0] = x;
+                _pendingGyro[head][1] = y;
+                _pendingGyro[head][2] = z;
+                _pendingUsec[head] = (uint32_t)timing.usec;
+
+                // Publish the entry only after it's written
+                std::atomic_signal_fence(std::memory_order_release);
+                _pendingHead = next;
+            }
+
+            // Producer side, called from PidTask::doTask() -------------------------------
+
+            void beginCycle(const timing_t & timing, const state_t & state, const float rawvals[], uint8_t nstages)
+            {
+                _recording = ++_cycle >= _divisor;
+
+                // A replay still has to run update() at this time
+                if (!_recording) {
+                    recordInput(INPUT_UPDATE, timing, NULL);
+                    return;
+                }
+
+                _cycle = 0;
+
+                setLayout(nstages > MAX_STAGES ? MAX_STAGES : nstages);
+
+                _usec = (uint32_t)timing.usec;
+
+                _flags = (state.armed ? FLAG_ARMED : 0) | (state.failsafe ? FLAG_FAILSAFE : 0);
+
+                uint8_t channel = 0;
+                quantize3(state.location,    SCALE_STATE,    channel);
+                quantize3(state.rotation,    SCALE_ROTATION, channel);
+                quantize3(state.angularVel,  SCALE_STATE,    channel);
+                quantize3(state.bodyAccel,   SCALE_STATE,    channel);
+                quantize3(state.bodyVel,     SCALE_STATE,    channel);
+                quantize3(state.inertialVel, SCALE_STATE,    channel);
+
+                channel = STATE_CHANNELS + 4*_nstages;
+                for (uint8_t k=0; k<RAW_CHANNELS; ++k) {
+                    _current[channel++] = quantize(rawvals[k], SCALE_RAW);
+                }
+
+                _stage = 0;
+            }
+
+            void addDemands(const demands_t & demands)
+            {
+                if (!_recording || _stage >= _nstages) return;
+
+                uint8_t channel = STATE_CHANNELS + 4*_stage;
+
+                _current[channel++] = quantize(demands.throttle, SCALE_DEMAND);
+                _current[channel++] = quantize(demands.roll,     SCALE_DEMAND);
+                _current[channel++] = quantize(demands.pitch,    SCALE_DEMAND);
+                _current[channel++] = quantize(demands.yaw,      SCALE_DEMAND);
+
+                _stage++;
+            }
+
+            void endCycle(void)
+            {
+                if (!_recording) return;
+
+                uint8_t channel = STATE_CHANNELS + 4*_nstages + RAW_CHANNELS;
+                for (uint8_t k=0; k<_nmotors; ++k) {
+                    _current[channel++] = quantize(_mixer->_motorsPrev[k], SCALE_MOTOR);
+                }
+
+                write();
+            }
+
+            // Null-safe helpers for the call sites
+
+            static void beginUpdate(Recorder * recorder, const timing_t & timing)
+            {
+                if (recorder) {
+                    recorder->beginUpdate(timing);
+                }
+            }
+
+            static void recordLostSignal(Recorder * recorder, const timing_t & timing, bool lost)
+            {
+                if (recorder) {
+                    recorder->recordLostSignal(timing, lost);
+                }
+            }
+
+            static void recordGyroInterrupt(Recorder * recorder, const timing_t & timing, float x, float y, float z)
+            {
+                if (recorder) {
+                    recorder->recordGyroInterrupt(timing, x, y, z);
+                }
+            }
+
+            static void beginCycle(Recorder * recorder, const timing_t & timing, const state_t & state,
+                    const float rawvals[], uint8_t nstages)
+            {
+                if (recorder) {
+                    recorder->beginCycle(timing, state, rawvals, nstages);
+                }
+            }
+
+            static void addDemands(Recorder * recorder, const demands_t & demands)
+            {
+                if (recorder) {
+                    recorder->addDemands(demands);
+                }
+            }
+
+            static void endCycle(Recorder * recorder)
+            {
+                if (recorder) {
+                    recorder->endCycle();
+                }
+            }
+
+        public:
+
+            static uint8_t inputValues(uint8_t input)
+            {
+                static const uint8_t counts[INPUT_COUNT] = {0, 0, RECEIVER_CHANNELS, 1, 3, 3, 4, 1, 2};
+
+                return input < INPUT_COUNT ? counts[input] : 0;
+            }
+
+            // For sensors outside Hackflight
+            static void recordInput(Recorder * recorder, uint8_t input, const timing_t & timing, const float values[])
+            {
+                if (recorder) {
+                    recorder->recordInput(input, timing, values);
+                }
+            }
+
+            // Records one PID update in every divisor, to fit a slow sink
+            void setDivisor(uint8_t divisor)
+            {
+                _divisor = divisor ? divisor : 1;
+            }
+
+            // Also records the sensor and receiver inputs for replay.  This takes
+            // several times the bandwidth of the PID records, so the sink has to keep
+            // up with the recorder task at a higher rate (see Hackflight::setRecorder()).
+            void setInputs(bool enabled)
+            {
+                _inputs = enabled;
+            }
+
+            // Consumer side ----------------------------------------------------------
+
+            uint16_t available(void)
+            {
+                return (_head - _tail) & (SIZE - 1);
+            }
+
+            // Points data at the oldest bytes and returns how many can be read there
+            // without wrapping; call consume() with the number actually used
+            uint16_t peek(const uint8_t * & data)
+            {
+                uint16_t head = _head;
+
+                data = &_buffer[_tail];
+
+                return head >= _tail ? head - _tail : SIZE - _tail;
+            }
+
+            void consume(uint16_t count)
+            {
+                _tail = (_tail + count) & (SIZE - 1);
+            }
+
+            // Copies out up to count of the oldest bytes; returns the number copied
+            uint16_t read(uint8_t * data, uint16_t count)
+            {
+                uint16_t total = 0;
+
+                while (total < count) {
+
+                    const uint8_t * chunk = NULL;
+                    uint16_t n = peek(chunk);
+
+                    if (n == 0) break;
+
+                    if (n > count - total) {
+                        n = count - total;
+                    }
+
+                    for (uint16_t k=0; k<n; ++k) {
+                        data[total+k] = chunk[k];
+                    }
+
+                    consume(n);
+                    total += n;
+                }
+
+                return total;
+            }
+
+            uint32_t getRecords(void)
+            {
+                return _records;
+            }
+
+            // Records lost because the buffer, or the queue of gyro interrupts, was full
+            uint32_t getDropped(void)
+            {
+                return _dropped + _pendingDropped;
+            }
+
+    }; // class Recorder
+
+} // namespace hf
@@ -0,0 +1,112 @@
+/*
+   Rate-monotonic scheduler for timer tasks
+
+   Tasks are prioritized by rate, fastest first.  On each call to update(),
+   the highest-priority task whose release time has come is run, and only
+   that one, so a slow task can never delay a faster one by sharing its loop
+   iteration.
+
+   Copyright (c) 2020 Simon D. Levy
+
+   This file is part of Hackflight.
+
+   Hackflight is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   Hackflight is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+   You should have received a copy of the GNU General Public License
+   along with Hackflight.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#include "timertask.hpp"
+#include "debugger.hpp"
+
+namespace hf {
+
+    class Scheduler {
+
+        friend class Hackflight;
+
+        private:
+
+            static const uint8_t MAXTASKS = 8;
+
+            // Sorted by period, shortest first
+            TimerTask * _tasks[MAXTASKS] = {NULL};
+            uint8_t _taskCount = 0;
+
+        protected:
+
+            // Insertion sort by rate; equal rates keep the order in which they were added
+            void sort(void)
+            {
+                for (uint8_t j=1; j<_taskCount; ++j) {
+                    TimerTask * task = _tasks[j];
+                    uint8_t k = j;
+                    while (k > 0 && _tasks[k-1]->_periodUsec > task->_periodUsec) {
+                        _tasks[k] = _tasks[k-1];
+                        k--;
+                    }
+                    _tasks[k] = task;
+                }
+            }
+
+            void update(const timing_t & timing)
+            {
+                for (uint8_t k=0; k<_taskCount; ++k) {
+
+                    TimerTask * task = _tasks[k];
+
+                    if (task->ready(timing)) {
+                        task->run(timing);
+                        return;
+                    }
+                }
+            }
+
+        public:
+
+            void addTask(TimerTask * task)
+            {
+                if (_taskCount == MAXTASKS) return;
+
+                _tasks[_taskCount++] = task;
+
+                sort();
+            }
+
+            uint8_t getTaskCount(void)
+            {
+                return _taskCount;
+            }
+
+            // Tasks in priority order
+            TimerTask * getTask(uint8_t index)
+            {
+                return index < _taskCount ? _tasks[index] : NULL;
+            }
+
+            void printStats(void)
+            {
+                for (uint8_t k=0; k<_taskCount; ++k) {
+
+                    TimerTask * task = _tasks[k];
+
+                    Debugger::printf("%-8s requested %6.1f Hz  achieved %6.1f Hz  runs %7u  overruns %5u  max late %6.3f ms\n",
+                            task->getName(), task->getRequestedRate(), task->getAchievedRate(),
+                            (unsigned)task->getRuns(), (unsigned)task->getOverruns(), 1000 * task->getMaxLateness());
+                }
+            }
+
+    }; // class Scheduler
+
+} // namespace hf
@@ -24,15 +24,28 @@
 
 namespace hf {
 
+    template <typename... Sensors> class SensorChain;
+
+    class Recorder;
+
+    class StateEstimator;
+
     class Sensor {
 
         friend class Hackflight;
+        template <typename... Sensors> friend class SensorChain;
 
         protected:
 
-            virtual void modifyState(state_t & state, float time) = 0;
+            // Set by Hackflight::setRecorder(), for sensors that log their readings
+            Recorder * _recorder = NULL;
+
+            // Set by Hackflight::setEstimator(), for sensors whose readings it fuses
+            StateEstimator * _estimator = NULL;
+
+            virtual void modifyState(state_t & state, const timing_t & timing) = 0;
 
-            virtual bool ready(float time) = 0;
+            virtual bool ready(const timing_t & timing) = 0;
 
     };  // class Sensor
 
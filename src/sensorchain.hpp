@@ -0,0 +1,164 @@
+/*
+   Compile-time list of optional sensors
+
+   For a vehicle whose sensors are known when the sketch is written, a
+   SensorChain checks them with direct, inlinable calls instead of two
+   virtual calls per sensor through the runtime sensor table:
+
+       hf::SensorChain<hf::VL53L1X_Rangefinder, hf::OpticalFlow> sensors(rangefinder, flow);
+       h.setSensorChain(&sensors);
+
+   Sensors used in a chain must declare SensorChain a friend, as the ones in
+   sensors/ do.  Surface-mount sensors, such as the barometer, get the IMU
+   when the chain is set, so set it after Hackflight::init().
+
+   Copyright (c) 2020 Simon D. Levy
+
+   This file is part of Hackflight.
+
+   Hackflight is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   Hackflight is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+   You should have received a copy of the GNU General Public License
+   along with Hackflight.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "datatypes.hpp"
+#include "sensor.hpp"
+#include "imu.hpp"
+#include "sensors/surfacemount.hpp"
+
+namespace hf {
+
+    // Lets Hackflight hold any chain; this is the only virtual call per update
+    class SensorChainBase {
+
+        friend class Hackflight;
+
+        protected:
+
+            virtual void check(state_t & state, const timing_t & timing) = 0;
+
+            virtual void setEstimator(StateEstimator * estimator) = 0;
+
+            virtual void setImu(IMU * imu) = 0;
+
+    }; // class SensorChainBase
+
+    // Empty chain ends the recursion
+    template <>
+    class SensorChain<> : public SensorChainBase {
+
+        protected:
+
+            void checkChain(state_t & state, const timing_t & timing)
+            {
+                (void)state; (void)timing;
+            }
+
+            virtual void check(state_t & state, const timing_t & timing) override
+            {
+                checkChain(state, timing);
+            }
+
+            void setEstimatorChain(StateEstimator * estimator)
+            {
+                (void)estimator;
+            }
+
+            virtual void setEstimator(StateEstimator * estimator) override
+            {
+                setEstimatorChain(estimator);
+            }
+
+            void setImuChain(IMU * imu)
+            {
+                (void)imu;
+            }
+
+            virtual void setImu(IMU * imu) override
+            {
+                setImuChain(imu);
+            }
+
+            // Overloads that give the IMU to surface-mount sensors only
+            static void setSensorImu(Sensor & sensor, IMU * imu)
+            {
+                (void)sensor; (void)imu;
+            }
+
+            static void setSensorImu(SurfaceMountSensor & sensor, IMU * imu)
+            {
+                sensor.imu = imu;
+            }
+
+    }; // class SensorChain<>
+
+    template <typename S, typename... Rest>
+    class SensorChain<S, Rest...> : public SensorChain<Rest...> {
+
+        template <typename... Sensors> friend class SensorChain;
+
+        private:
+
+            S & _sensor;
+
+        protected:
+
+            // Calls are qualified by the concrete type so that they bind statically
+            void checkChain(state_t & state, const timing_t & timing)
+            {
+                if (_sensor.S::ready(timing)) {
+                    _sensor.S::modifyState(state, timing);
+                }
+
+                SensorChain<Rest...>::checkChain(state, timing);
+            }
+
+            virtual void check(state_t & state, const timing_t & timing) override
+            {
+                checkChain(state, timing);
+            }
+
+            void setEstimatorChain(StateEstimator * estimator)
+            {
+                _sensor._estimator = estimator;
+
+                SensorChain<Rest...>::setEstimatorChain(estimator);
+            }
+
+            virtual void setEstimator(StateEstimator * estimator) override
+            {
+                setEstimatorChain(estimator);
+            }
+
+            void setImuChain(IMU * imu)
+            {
+                SensorChain<>::setSensorImu(_sensor, imu);
+
+                SensorChain<Rest...>::setImuChain(imu);
+            }
+
+            virtual void setImu(IMU * imu) override
+            {
+                setImuChain(imu);
+            }
+
+        public:
+
+            SensorChain(S & sensor, Rest &... rest)
+                : SensorChain<Rest...>(rest...), _sensor(sensor)
+            {
+            }
+
+    }; // class SensorChain
+
+} // namespace hf
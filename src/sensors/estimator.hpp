@@ -0,0 +1,828 @@
+/*
+   Strapdown inertial state estimator
+
+   An error-state extended Kalman filter that predicts position, velocity,
+   and attitude from the accelerometer and gyrometer at the IMU rate, and
+   corrects them with the IMU's quaternion, the rangefinder, the barometer,
+   and optical flow as each reading arrives.  Its nine states, attitude
+   reset, and flow model are adapted from:
+
+    https://github.com/bitcraze/crazyflie-firmware/blob/master/src/modules/src/estimator_kalman.c
+
+   As there, the filter works in a body frame with x forward, y left, and z
+   up, and a world frame with x north, y west, and z up.  The estimates are
+   published in Hackflight's state with y negated: location and inertialVel
+   are north, east, and up; bodyVel is forward, right, and up.
+
+   Add the estimator with Hackflight::setEstimator().  The rangefinder,
+   barometer, and optical-flow sensors then pass their readings to it instead
+   of writing the state themselves.  The estimator takes each accelerometer
+   reading from the IMU, which gives it only once, so don't also add an
+   Accelerometer sensor.
+
+   The IMU samples are averaged between predictions, which run at a fixed
+   rate, and the filter as it stood after each of the last few predictions is
+   kept with the readings fused since.  A reading is stamped with the time it
+   describes, which for the rangefinder and optical flow is well before it is
+   read; a late reading is fused into the prediction it belongs to, and the
+   later predictions and readings are then run again from there.
+
+   Copyright (c) 2020 Simon D. Levy
+
+   This file is part of Hackflight.
+
+   Hackflight is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   Hackflight is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+   You should have received a copy of the GNU General Public License
+   along with Hackflight.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <cmath>
+#include <math.h>
+#include <string.h>
+
+#include "sensors/surfacemount.hpp"
+#include "linalg.hpp"
+
+// Predictions kept for fusing late readings, about 400 bytes each; at the
+// prediction rate, the default covers delays of up to 60 msec
+#ifndef HACKFLIGHT_ESTIMATOR_HISTORY
+#define HACKFLIGHT_ESTIMATOR_HISTORY 16
+#endif
+
+namespace hf {
+
+    class StateEstimator : public SurfaceMountSensor {
+
+        friend class Hackflight;
+
+        private:
+
+            static constexpr float GRAVITY = 9.80665f;
+
+            // Longer than this between IMU samples, and the filter starts over
+            static constexpr float MAX_DT = 0.1f;
+
+            // 250 Hz predictions
+            static const uint32_t PREDICT_PERIOD_USEC = 4000;
+
+            // Process noise
+            static constexpr float PROC_NOISE_ACC_XY   = 0.5f;  // m/s^2
+            static constexpr float PROC_NOISE_ACC_Z    = 1.0f;  // m/s^2
+            static constexpr float PROC_NOISE_GYRO_RP  = 0.1f;  // rad/s
+            static constexpr float PROC_NOISE_GYRO_YAW = 0.1f;  // rad/s
+
+            // Initial standard deviations
+            static constexpr float INITIAL_POSITION_XY = 0.01f; // m
+            static constexpr float INITIAL_POSITION_Z  = 1.0f;  // m
+            static constexpr float INITIAL_VELOCITY    = 0.01f; // m/s
+            static constexpr float INITIAL_ATTITUDE    = 0.01f; // rad
+
+            // Measurement noise
+            static constexpr float ATTITUDE_STDDEV = 0.02f; // rad
+            static constexpr float RANGE_STDDEV    = 0.05f; // m
+            static constexpr float BARO_STDDEV     = 0.5f;  // m
+            static constexpr float FLOW_STDDEV     = 2.0f;  // pixels
+
+            // Rangefinder readings at or beyond this, or steeper than 60 degrees, are ignored
+            static constexpr float MAX_RANGE = 4.0f;  // m
+            static constexpr float MIN_RANGE_COS = 0.5f;
+
+            // Optical-flow camera: pixels across the field of view, and the angle per pixel
+            static constexpr float FLOW_NPIX     = 30.0f;
+            static constexpr float FLOW_THETAPIX = 4.2f * M_PI / 180;
+
+            // Flow is predicted as if from at least this high
+            static constexpr float MIN_FLOW_HEIGHT = 0.1f; // m
+
+            // The bounds on the covariance, these shouldn't be hit, but sometimes are... why?
+            static constexpr float MAX_COVARIANCE = 100.f;
+            static constexpr float MIN_COVARIANCE = 1e-6f;
+            static constexpr float MAX_POSITION   = 100.f; //meters
+            static constexpr float MAX_VELOCITY   = 10.f;  //meters per second
+
+            // The quad's state, stored as a column vector
+            typedef enum
+            {
+                STATE_X,  // Position
+                STATE_Y,
+                STATE_Z,
+                STATE_PX, // Body-frame velocity
+                STATE_PY,
+                STATE_PZ,
+                STATE_D0, // Attitude error
+                STATE_D1,
+                STATE_D2,
+                STATE_DIM
+            } stateIdx_t;
+
+            typedef SymmetricMatrix<STATE_DIM> covariance_t;
+
+            // A measurement row H, which depends on only a few states: their
+            // indices and the derivatives with respect to them
+            static const uint8_t MAX_MEASUREMENT_STATES = 2;
+            typedef struct {
+                uint8_t count;
+                uint8_t states[MAX_MEASUREMENT_STATES];
+                float derivs[MAX_MEASUREMENT_STATES];
+            } measurement_t;
+
+            // A sensor reading, kept for fusing again when an earlier one comes in late
+            typedef enum {
+                READING_ATTITUDE,   // roll, pitch, yaw as in the state
+                READING_RANGE,      // m
+                READING_BAROMETER,  // Pa
+                READING_FLOW        // pixel counts x, y, and seconds over which they accumulated
+            } readingKind_t;
+
+            typedef struct {
+                uint8_t kind;
+                float values[3];
+            } reading_t;
+
+            // Enough for each sensor at the most its rate allows, plus a late one from each
+            static const uint8_t MAX_SLOT_READINGS = 6;
+
+            // A prediction, with its inputs, the filter as it left it, and the readings fused since
+            typedef struct {
+                uint64_t usec;
+                float dt;
+                float accel[3];
+                float gyro[3];
+                float S[STATE_DIM];
+                float q[4];
+                covariance_t P;
+                uint8_t count;
+                reading_t readings[MAX_SLOT_READINGS];
+            } slot_t;
+
+            float S[STATE_DIM] = {0.f};
+
+            covariance_t Pm;
+
+            // The quad's attitude as a quaternion and a rotation matrix (body to world)
+            float q[4] = {1,0,0,0};
+            float R[3][3] = {{1,0,0},{0,1,0},{0,0,1}};
+
+            // Mean accelerometer (m/s^2) and gyrometer (rad/s) readings over the
+            // current prediction, in the body frame
+            float _accel[3] = {0};
+            float _gyro[3] = {0};
+
+            // Sums of the readings since the last prediction
+            float _accelSum[3] = {0};
+            float _gyroSum[3] = {0};
+            uint16_t _samples = 0;
+
+            bool _initialized = false;
+            uint64_t _predictUsec = 0;
+
+            // Ring buffer of recent predictions
+            slot_t _history[HACKFLIGHT_ESTIMATOR_HISTORY];
+            uint8_t _newest = 0;
+            uint8_t _slots = 0;
+
+            // Pressure at the first barometer reading, taken as zero altitude
+            float _groundPressure = 0;
+
+            void reset(const state_t & state, uint64_t usec)
+            {
+                // Start from the IMU's attitude, at rest at the origin
+                attitudeQuaternion(state.rotation, q);
+
+                for (uint8_t j=0; j<STATE_DIM; ++j) {
+                    S[j] = 0;
+                    for (uint8_t k=j; k<STATE_DIM; ++k) {
+                        Pm.set(j,k,0);
+                    }
+                }
+
+                Pm.set(STATE_X, STATE_X, INITIAL_POSITION_XY*INITIAL_POSITION_XY);
+                Pm.set(STATE_Y, STATE_Y, INITIAL_POSITION_XY*INITIAL_POSITION_XY);
+                Pm.set(STATE_Z, STATE_Z, INITIAL_POSITION_Z*INITIAL_POSITION_Z);
+
+                for (uint8_t j=0; j<3; ++j) {
+                    Pm.set(STATE_PX+j, STATE_PX+j, INITIAL_VELOCITY*INITIAL_VELOCITY);
+                    Pm.set(STATE_D0+j, STATE_D0+j, INITIAL_ATTITUDE*INITIAL_ATTITUDE);
+                }
+
+                finalize();
+
+                _slots = 0;
+                push(usec, 0);
+
+                _initialized = true;
+            }
+
+            // The prediction the given number back from the newest
+            slot_t & slot(uint8_t back)
+            {
+                return _history[(_newest + HACKFLIGHT_ESTIMATOR_HISTORY - back) % HACKFLIGHT_ESTIMATOR_HISTORY];
+            }
+
+            void save(slot_t & s)
+            {
+                memcpy(s.S, S, sizeof(S));
+                memcpy(s.q, q, sizeof(q));
+                s.P = Pm;
+            }
+
+            void restore(const slot_t & s)
+            {
+                memcpy(S, s.S, sizeof(S));
+                memcpy(q, s.q, sizeof(q));
+                Pm = s.P;
+
+                finalize();
+            }
+
+            // Keeps the prediction just made, overwriting the oldest
+            void push(uint64_t usec, float dt)
+            {
+                _newest = (_newest + 1) % HACKFLIGHT_ESTIMATOR_HISTORY;
+
+                if (_slots < HACKFLIGHT_ESTIMATOR_HISTORY) {
+                    _slots++;
+                }
+
+                slot_t & s = slot(0);
+
+                s.usec = usec;
+                s.dt = dt;
+                memcpy(s.accel, _accel, sizeof(_accel));
+                memcpy(s.gyro, _gyro, sizeof(_gyro));
+                s.count = 0;
+
+                save(s);
+            }
+
+            void apply(const reading_t & reading)
+            {
+                switch (reading.kind) {
+                    case READING_ATTITUDE:
+                        updateWithAttitude(reading.values);
+                        break;
+                    case READING_RANGE:
+                        updateWithRange(reading.values[0]);
+                        break;
+                    case READING_BAROMETER:
+                        updateWithBarometer(reading.values[0]);
+                        break;
+                    default:
+                        updateWithFlow(reading.values[0], reading.values[1], reading.values[2]);
+                }
+
+                finalize();
+            }
+
+            // Runs the filter again from the given prediction, with its readings and those since
+            void replay(uint8_t back)
+            {
+                slot_t & first = slot(back);
+
+                restore(first);
+
+                for (uint8_t k=0; k<first.count; ++k) {
+                    apply(first.readings[k]);
+                }
+
+                while (back > 0) {
+
+                    slot_t & s = slot(--back);
+
+                    memcpy(_accel, s.accel, sizeof(_accel));
+                    memcpy(_gyro, s.gyro, sizeof(_gyro));
+
+                    predict(s.dt);
+                    finalize();
+                    save(s);
+
+                    for (uint8_t k=0; k<s.count; ++k) {
+                        apply(s.readings[k]);
+                    }
+                }
+            }
+
+            // Fuses a reading that describes the given time
+            void fuse(state_t & state, const reading_t & reading, uint64_t usec)
+            {
+                // The latest prediction no later than the reading, or the oldest kept
+                uint8_t back = 0;
+                while (back < _slots-1 && slot(back).usec > usec) {
+                    back++;
+                }
+
+                // If there's no room, it's fused as if current
+                if (slot(back).count == MAX_SLOT_READINGS) {
+                    back = 0;
+                }
+
+                slot_t & s = slot(back);
+
+                // Kept with the prediction it's fused after, so that a replay fuses it
+                // in the same place; if even the newest is full, it's dropped
+                if (s.count == MAX_SLOT_READINGS) return;
+
+                s.readings[s.count++] = reading;
+
+                if (back == 0) {
+                    apply(reading);
+                }
+                else {
+                    replay(back);
+                }
+
+                publish(state);
+            }
+
+            // The IMU's attitude, from Euler angles as in the state
+            static void attitudeQuaternion(const float rotation[3], float quat[4])
+            {
+                // Roll right, nose down, and yaw left are positive in the filter's frame
+                float cr = cosf(rotation[0]/2), sr = sinf(rotation[0]/2);
+                float cp = cosf(rotation[1]/2), sp = sinf(rotation[1]/2);
+                float cy = cosf(-rotation[2]/2), sy = sinf(-rotation[2]/2);
+
+                quat[0] = cr*cp*cy + sr*sp*sy;
+                quat[1] = sr*cp*cy - cr*sp*sy;
+                quat[2] = cr*sp*cy + sr*cp*sy;
+                quat[3] = cr*cp*sy - sr*sp*cy;
+            }
+
+            void stateEstimatorAssertNotNaN(void)
+            {
+                for(int i=0; i<STATE_DIM; i++) {
+                    if (std::isnan(S[i])) {
+                        _initialized = false;
+                        return;
+                    }
+                    for(int j=i; j<STATE_DIM; j++) {
+                        if (std::isnan(Pm.get(i,j))) {
+                            _initialized = false;
+                            return;
+                        }
+                    }
+                }
+            }
+
+            void predict(float dt)
+            {
+                static Matrix<STATE_DIM, STATE_DIM> Am;
+
+                float dt2 = dt*dt;
+
+                // ====== DYNAMICS LINEARIZATION ======
+
+                for (uint8_t i=0; i<STATE_D0; i++) {
+                    Am.set(i,i, 1);
+                }
+
+                // position from body-frame velocity
+                for (uint8_t i=0; i<3; i++) {
+                    for (uint8_t j=0; j<3; j++) {
+                        Am.set(STATE_X+i, STATE_PX+j, R[i][j]*dt);
+                    }
+                }
+
+                // position from attitude error
+                for (uint8_t i=0; i<3; i++) {
+                    Am.set(STATE_X+i, STATE_D0, (S[STATE_PY]*R[i][2] - S[STATE_PZ]*R[i][1])*dt);
+                    Am.set(STATE_X+i, STATE_D1, (S[STATE_PZ]*R[i][0] - S[STATE_PX]*R[i][2])*dt);
+                    Am.set(STATE_X+i, STATE_D2, (S[STATE_PX]*R[i][1] - S[STATE_PY]*R[i][0])*dt);
+                }
+
+                // body-frame velocity from body-frame velocity
+                Am.set(STATE_PX,STATE_PY,  _gyro[2]*dt);
+                Am.set(STATE_PX,STATE_PZ, -_gyro[1]*dt);
+                Am.set(STATE_PY,STATE_PX, -_gyro[2]*dt);
+                Am.set(STATE_PY,STATE_PZ,  _gyro[0]*dt);
+                Am.set(STATE_PZ,STATE_PX,  _gyro[1]*dt);
+                Am.set(STATE_PZ,STATE_PY, -_gyro[0]*dt);
+
+                // body-frame velocity from attitude error
+                Am.set(STATE_PX,STATE_D1,  GRAVITY*R[2][2]*dt);
+                Am.set(STATE_PX,STATE_D2, -GRAVITY*R[2][1]*dt);
+                Am.set(STATE_PY,STATE_D0, -GRAVITY*R[2][2]*dt);
+                Am.set(STATE_PY,STATE_D2,  GRAVITY*R[2][0]*dt);
+                Am.set(STATE_PZ,STATE_D0,  GRAVITY*R[2][1]*dt);
+                Am.set(STATE_PZ,STATE_D1, -GRAVITY*R[2][0]*dt);
+
+                // attitude error from attitude error
+                float d0 = _gyro[0]*dt/2;
+                float d1 = _gyro[1]*dt/2;
+                float d2 = _gyro[2]*dt/2;
+
+                Am.set(STATE_D0,STATE_D0,  1 - d1*d1/2 - d2*d2/2);
+                Am.set(STATE_D0,STATE_D1,  d2 + d0*d1/2);
+                Am.set(STATE_D0,STATE_D2, -d1 + d0*d2/2);
+
+                Am.set(STATE_D1,STATE_D0, -d2 + d0*d1/2);
+                Am.set(STATE_D1,STATE_D1,  1 - d0*d0/2 - d2*d2/2);
+                Am.set(STATE_D1,STATE_D2,  d0 + d1*d2/2);
+
+                Am.set(STATE_D2,STATE_D0,  d1 + d0*d2/2);
+                Am.set(STATE_D2,STATE_D1, -d0 + d1*d2/2);
+                Am.set(STATE_D2,STATE_D2,  1 - d0*d0/2 - d1*d1/2);
+
+                // ====== COVARIANCE UPDATE ======
+
+                Pm.transform(Am); // APA'
+
+                // ====== PREDICTION STEP ======
+
+                // position updates in the body frame (will be rotated to inertial frame)
+                float dx = S[STATE_PX]*dt + _accel[0]*dt2/2;
+                float dy = S[STATE_PY]*dt + _accel[1]*dt2/2;
+                float dz = S[STATE_PZ]*dt + _accel[2]*dt2/2;
+
+                // position update
+                S[STATE_X] += R[0][0]*dx + R[0][1]*dy + R[0][2]*dz;
+                S[STATE_Y] += R[1][0]*dx + R[1][1]*dy + R[1][2]*dz;
+                S[STATE_Z] += R[2][0]*dx + R[2][1]*dy + R[2][2]*dz - GRAVITY*dt2/2;
+
+                // body-velocity update: accelerometers - gyros cross velocity - gravity in body frame
+                float px = S[STATE_PX];
+                float py = S[STATE_PY];
+                float pz = S[STATE_PZ];
+
+                S[STATE_PX] += dt*(_accel[0] + _gyro[2]*py - _gyro[1]*pz - GRAVITY*R[2][0]);
+                S[STATE_PY] += dt*(_accel[1] - _gyro[2]*px + _gyro[0]*pz - GRAVITY*R[2][1]);
+                S[STATE_PZ] += dt*(_accel[2] + _gyro[1]*px - _gyro[0]*py - GRAVITY*R[2][2]);
+
+                // attitude update (rotate by gyroscope), done in quaternion
+                rotate(_gyro[0]*dt, _gyro[1]*dt, _gyro[2]*dt);
+
+                // ====== PROCESS NOISE ======
+
+                addProcessNoise(Pm, STATE_X,  PROC_NOISE_ACC_XY*dt2);
+                addProcessNoise(Pm, STATE_Y,  PROC_NOISE_ACC_XY*dt2);
+                addProcessNoise(Pm, STATE_Z,  PROC_NOISE_ACC_Z*dt2);
+                addProcessNoise(Pm, STATE_PX, PROC_NOISE_ACC_XY*dt);
+                addProcessNoise(Pm, STATE_PY, PROC_NOISE_ACC_XY*dt);
+                addProcessNoise(Pm, STATE_PZ, PROC_NOISE_ACC_Z*dt);
+                addProcessNoise(Pm, STATE_D0, PROC_NOISE_GYRO_RP*dt);
+                addProcessNoise(Pm, STATE_D1, PROC_NOISE_GYRO_RP*dt);
+                addProcessNoise(Pm, STATE_D2, PROC_NOISE_GYRO_YAW*dt);
+            }
+
+            static void addProcessNoise(covariance_t & P, uint8_t i, float stddev)
+            {
+                P.set(i, i, P.get(i,i) + stddev*stddev);
+            }
+
+            // Rotates the quad's attitude by the body-frame rotation vector (v0,v1,v2)
+            void rotate(float v0, float v1, float v2)
+            {
+                float angle = sqrt(v0*v0 + v1*v1 + v2*v2);
+
+                if (angle == 0) return;
+
+                float ca = cos(angle / 2.0f);
+                float sa = sin(angle / 2.0f);
+                float dq[4] = {ca, sa * v0 / angle, sa * v1 / angle, sa * v2 / angle};
+
+                // rotate the quad's attitude by the delta quaternion vector computed above
+                float tmpq0 = dq[0] * q[0] - dq[1] * q[1] - dq[2] * q[2] - dq[3] * q[3];
+                float tmpq1 = dq[1] * q[0] + dq[0] * q[1] + dq[3] * q[2] - dq[2] * q[3];
+                float tmpq2 = dq[2] * q[0] - dq[3] * q[1] + dq[0] * q[2] + dq[1] * q[3];
+                float tmpq3 = dq[3] * q[0] + dq[2] * q[1] - dq[1] * q[2] + dq[0] * q[3];
+
+                // normalize and store the result
+                float norm = sqrt(tmpq0 * tmpq0 + tmpq1 * tmpq1 + tmpq2 * tmpq2 + tmpq3 * tmpq3);
+                q[0] = tmpq0 / norm;
+                q[1] = tmpq1 / norm;
+                q[2] = tmpq2 / norm;
+                q[3] = tmpq3 / norm;
+            }
+
+            // The IMU's attitude, as the body-frame rotation from the filter's
+            void updateWithAttitude(const float rotation[3])
+            {
+                float qm[4];
+                attitudeQuaternion(rotation, qm);
+
+                // conj(q) * qm, taking the shorter way round
+                float ew =  q[0]*qm[0] + q[1]*qm[1] + q[2]*qm[2] + q[3]*qm[3];
+                float ex =  q[0]*qm[1] - q[1]*qm[0] - q[2]*qm[3] + q[3]*qm[2];
+                float ey =  q[0]*qm[2] + q[1]*qm[3] - q[2]*qm[0] - q[3]*qm[1];
+                float ez =  q[0]*qm[3] - q[1]*qm[2] + q[2]*qm[1] - q[3]*qm[0];
+
+                float sign = ew < 0 ? -2 : +2;
+                float error[3] = {sign*ex, sign*ey, sign*ez};
+
+                for (uint8_t k=0; k<3; ++k) {
+                    measurement_t H = {1, {(uint8_t)(STATE_D0+k)}, {1}};
+                    stateEstimatorScalarUpdate(H, error[k] - S[STATE_D0+k], ATTITUDE_STDDEV);
+                }
+            }
+
+            void finalize(void)
+            {
+                // Attitude block of the matrix to rotate the covariances once
+                // updated; the rest of it is the identity
+                static Matrix<3,3> Am;
+
+                // Temporary matrices for the covariance update
+                static Matrix<3,3> tmp1m;
+                static Matrix<3,3> tmp2m;
+
+                // Incorporate the attitude error (Kalman filter state) with the attitude
+                float v0 = S[STATE_D0];
+                float v1 = S[STATE_D1];
+                float v2 = S[STATE_D2];
+
+                // Move attitude error into attitude if any of the angle errors are large enough
+                if ((fabsf(v0) > 0.1e-3f || fabsf(v1) > 0.1e-3f || fabsf(v2) > 0.1e-3f) && (fabsf(v0) < 10 && fabsf(v1) < 10 && fabsf(v2) < 10)) {
+
+                    rotate(v0, v1, v2);
+
+                    /** Rotate the covariance, since we've rotated the body
+                     *
+                     * This comes from a second order approximation to:
+                     * Sigma_post = exps(-d) Sigma_pre exps(-d)'
+                     *            ~ (I + [[-d]] + [[-d]]^2 / 2) Sigma_pre (I + [[-d]] + [[-d]]^2 / 2)'
+                     * where d is the attitude error expressed as Rodriges parameters, ie. d = tan(|v|/2)*v/|v|
+                     *
+                     * As derived in "Covariance Correction Step for Kalman Filtering with an Attitude"
+                     * http://arc.aiaa.org/doi/abs/10.2514/1.G000848
+                     */
+
+                    float d0 = v0/2; // the attitude error vector (v0,v1,v2) is small,
+                    float d1 = v1/2; // so we use a first order approximation to d0 = tan(|v0|/2)*v0/|v0|
+                    float d2 = v2/2;
+
+                    Am.set(0,0,  1 - d1*d1/2 - d2*d2/2);
+                    Am.set(0,1,  d2 + d0*d1/2);
+                    Am.set(0,2, -d1 + d0*d2/2);
+
+                    Am.set(1,0, -d2 + d0*d1/2);
+                    Am.set(1,1,  1 - d0*d0/2 - d2*d2/2);
+                    Am.set(1,2,  d0 + d1*d2/2);
+
+                    Am.set(2,0,  d1 + d0*d2/2);
+                    Am.set(2,1, -d0 + d1*d2/2);
+                    Am.set(2,2,  1 - d0*d0/2 - d1*d1/2);
+
+                    // APA' leaves the position and velocity covariances alone,
+                    // rotates their covariances with the attitude ...
+                    for (uint8_t i=0; i<STATE_D0; i++) {
+                        float p[3] = {Pm.get(i,STATE_D0), Pm.get(i,STATE_D1), Pm.get(i,STATE_D2)};
+                        for (uint8_t j=0; j<3; j++) {
+                            Pm.set(i, STATE_D0+j, Am.get(j,0)*p[0] + Am.get(j,1)*p[1] + Am.get(j,2)*p[2]);
+                        }
+                    }
+
+                    // ... and rotates the attitude covariances on both sides
+                    for (uint8_t j=0; j<3; j++) {
+                        for (uint8_t k=0; k<3; k++) {
+                            tmp1m.set(j, k, Pm.get(STATE_D0+j, STATE_D0+k));
+                        }
+                    }
+                    Matrix<3,3>::mult(Am, tmp1m, tmp2m); // AP
+                    Matrix<3,3>::multTrans(tmp2m, Am, tmp1m); // APA'
+                    for (uint8_t j=0; j<3; j++) {
+                        for (uint8_t k=j; k<3; k++) {
+                            Pm.set(STATE_D0+j, STATE_D0+k, tmp1m.get(j,k));
+                        }
+                    }
+                }
+
+                // convert the new attitude to a rotation matrix, such that we can rotate body-frame velocity and acc
+                R[0][0] = q[0] * q[0] + q[1] * q[1] - q[2] * q[2] - q[3] * q[3];
+                R[0][1] = 2 * q[1] * q[2] - 2 * q[0] * q[3];
+                R[0][2] = 2 * q[1] * q[3] + 2 * q[0] * q[2];
+
+                R[1][0] = 2 * q[1] * q[2] + 2 * q[0] * q[3];
+                R[1][1] = q[0] * q[0] - q[1] * q[1] + q[2] * q[2] - q[3] * q[3];
+                R[1][2] = 2 * q[2] * q[3] - 2 * q[0] * q[1];
+
+                R[2][0] = 2 * q[1] * q[3] - 2 * q[0] * q[2];
+                R[2][1] = 2 * q[2] * q[3] + 2 * q[0] * q[1];
+                R[2][2] = q[0] * q[0] - q[1] * q[1] - q[2] * q[2] + q[3] * q[3];
+
+                // reset the attitude error
+                S[STATE_D0] = 0;
+                S[STATE_D1] = 0;
+                S[STATE_D2] = 0;
+
+                // constrain the states
+                for (int i=0; i<3; i++)
+                {
+                    if (S[STATE_X+i] < -MAX_POSITION) { S[STATE_X+i] = -MAX_POSITION; }
+                    else if (S[STATE_X+i] > MAX_POSITION) { S[STATE_X+i] = MAX_POSITION; }
+
+                    if (S[STATE_PX+i] < -MAX_VELOCITY) { S[STATE_PX+i] = -MAX_VELOCITY; }
+                    else if (S[STATE_PX+i] > MAX_VELOCITY) { S[STATE_PX+i] = MAX_VELOCITY; }
+                }
+
+                // ensure the covariances stay bounded; they're symmetric by construction
+                Pm.bound(MIN_COVARIANCE, MAX_COVARIANCE);
+            }
+
+            void stateEstimatorScalarUpdate(const measurement_t & H, float error, float stdMeasNoise)
+            {
+                // ====== INNOVATION COVARIANCE ======
+
+                float PHT[STATE_DIM];
+                Pm.multSparse(H.states, H.derivs, H.count, PHT); // PH'
+
+                float R = stdMeasNoise*stdMeasNoise;
+                float HPHR = R; // HPH' + R
+
+                for (uint8_t m=0; m<H.count; m++) { // Add the element of HPH' to the above
+                    HPHR += H.derivs[m]*PHT[H.states[m]]; // this obviously only works if the update is scalar (as in this function)
+                }
+
+                // ====== MEASUREMENT UPDATE ======
+                // Calculate the Kalman gain and perform the state update
+                for (int i=0; i<STATE_DIM; i++) {
+                    S[i] += PHT[i]/HPHR * error; // kalman gain = (PH' (HPH' + R )^-1)
+                }
+
+                // ====== COVARIANCE UPDATE ======
+                // With the Kalman gain K = PH'/(HPH' + R), the Joseph form
+                // (KH - I)P(KH - I)' + KRK' reduces to P - PH'HP/(HPH' + R)
+                Pm.downdate(PHT, HPHR);
+
+                // ensure boundedness
+                Pm.bound(MIN_COVARIANCE, MAX_COVARIANCE);
+
+                stateEstimatorAssertNotNaN();
+            }
+
+            // Finishes a set of updates and writes the estimates
+            void publish(state_t & state)
+            {
+                finalize();
+
+                state.location[0] =  S[STATE_X];
+                state.location[1] = -S[STATE_Y];
+                state.location[2] =  S[STATE_Z];
+
+                for (uint8_t i=0; i<3; i++) {
+                    float v = R[i][0]*S[STATE_PX] + R[i][1]*S[STATE_PY] + R[i][2]*S[STATE_PZ];
+                    state.inertialVel[i] = i == 1 ? -v : v;
+                }
+
+                state.bodyVel[0] =  S[STATE_PX];
+                state.bodyVel[1] = -S[STATE_PY];
+                state.bodyVel[2] =  S[STATE_PZ];
+            }
+
+            void updateWithRange(float distance)
+            {
+                if (R[2][2] < MIN_RANGE_COS || distance >= MAX_RANGE) return;
+
+                measurement_t H = {1, {STATE_Z}, {1 / R[2][2]}};
+
+                stateEstimatorScalarUpdate(H, distance - S[STATE_Z] / R[2][2], RANGE_STDDEV);
+            }
+
+            void updateWithBarometer(float pressure)
+            {
+                float altitude = 44330 * (1 - powf(pressure / _groundPressure, 0.190295f));
+
+                measurement_t H = {1, {STATE_Z}, {1}};
+
+                stateEstimatorScalarUpdate(H, altitude - S[STATE_Z], BARO_STDDEV);
+            }
+
+            void updateWithFlow(float dpixelx, float dpixely, float dt)
+            {
+                float scale = dt * FLOW_NPIX / FLOW_THETAPIX;
+
+                // Saturate elevation in prediction and correction to avoid singularities
+                float z = S[STATE_Z] < MIN_FLOW_HEIGHT ? MIN_FLOW_HEIGHT : S[STATE_Z];
+
+                // ~~~ X: leftward velocity and roll ~~~
+                float predictedNX = scale * (S[STATE_PY] * R[2][2] / z - _gyro[0]);
+
+                measurement_t Hx = {2, {STATE_Z, STATE_PY}, {
+                    scale * (-S[STATE_PY] * R[2][2] / (z * z)),
+                    scale * (R[2][2] / z)}};
+
+                stateEstimatorScalarUpdate(Hx, dpixelx - predictedNX, FLOW_STDDEV);
+
+                // ~~~ Y: forward velocity and pitch ~~~
+                float predictedNY = scale * (S[STATE_PX] * R[2][2] / z + _gyro[1]);
+
+                measurement_t Hy = {2, {STATE_Z, STATE_PX}, {
+                    scale * (-S[STATE_PX] * R[2][2] / (z * z)),
+                    scale * (R[2][2] / z)}};
+
+                stateEstimatorScalarUpdate(Hy, dpixely - predictedNY, FLOW_STDDEV);
+            }
+
+        protected:
+
+            virtual bool ready(const timing_t & timing) override
+            {
+                (void)timing;
+
+                float ax=0, ay=0, az=0;
+
+                if (!imu->getAccelerometer(ax, ay, az)) return false;
+
+                // Gs in the IMU's frame to specific force in the filter's
+                _accelSum[0] += -ax * GRAVITY;
+                _accelSum[1] +=  ay * GRAVITY;
+                _accelSum[2] +=  az * GRAVITY;
+
+                return true;
+            }
+
+            virtual void modifyState(state_t & state, const timing_t & timing) override
+            {
+                // Gyrometer::modifyState() has already put the rates in the filter's frame
+                for (uint8_t k=0; k<3; ++k) {
+                    _gyroSum[k] += state.angularVel[k];
+                }
+                _samples++;
+
+                uint64_t dusec = timing.usec - _predictUsec;
+
+                if (_initialized && dusec < PREDICT_PERIOD_USEC) return;
+
+                for (uint8_t k=0; k<3; ++k) {
+                    _accel[k] = _accelSum[k] / _samples;
+                    _gyro[k] = _gyroSum[k] / _samples;
+                    _accelSum[k] = 0;
+                    _gyroSum[k] = 0;
+                }
+                _samples = 0;
+
+                _predictUsec = timing.usec;
+
+                float dt = dusec * 1e-6f;
+
+                if (!_initialized || dt > MAX_DT) {
+                    reset(state, timing.usec);
+                }
+                else {
+                    predict(dt);
+                    finalize();
+                    push(timing.usec, dt);
+                }
+
+                publish(state);
+            }
+
+        public:
+
+            // The IMU's own attitude estimate, in the Euler angles just computed from its quaternion
+            void fuseAttitude(state_t & state, uint64_t usec)
+            {
+                if (!_initialized) return;
+
+                reading_t reading = {READING_ATTITUDE, {state.rotation[0], state.rotation[1], state.rotation[2]}};
+
+                fuse(state, reading, usec);
+            }
+
+            // Meters along the body z axis to the ground, measured at the given time
+            void fuseRange(state_t & state, float distance, uint64_t usec)
+            {
+                if (!_initialized) return;
+
+                reading_t reading = {READING_RANGE, {distance}};
+
+                fuse(state, reading, usec);
+            }
+
+            // Pascals, measured at the given time; the first reading is taken to be at zero altitude
+            void fuseBarometer(state_t & state, float pressure, uint64_t usec)
+            {
+                if (!_initialized || pressure <= 0) return;
+
+                if (_groundPressure == 0) {
+                    _groundPressure = pressure;
+                }
+
+                reading_t reading = {READING_BAROMETER, {pressure}};
+
+                fuse(state, reading, usec);
+            }
+
+            // Pixel counts over the dt seconds centered on the given time, with dpixelx growing
+            // when flying left or rolling left and dpixely growing when flying forward or pitching down
+            void fuseFlow(state_t & state, int16_t dpixelx, int16_t dpixely, float dt, uint64_t usec)
+            {
+                if (!_initialized) return;
+
+                reading_t reading = {READING_FLOW, {(float)dpixelx, (float)dpixely, dt}};
+
+                fuse(state, reading, usec);
+            }
+
+    };  // class StateEstimator
+
+} // namespace hf
@@ -28,15 +28,19 @@
 
 #include "sensor.hpp"
 #include "filters.hpp"
+#include "recorder.hpp"
+#include "sensors/estimator.hpp"
 
 namespace hf {
 
     class OpticalFlow : public Sensor {
 
+        template <typename... Sensors> friend class SensorChain;
+
         private:
 
-            static constexpr float   UPDATE_PERIOD = .01f;
-            static const     uint8_t LPF_SIZE      = 64;
+            static const uint32_t UPDATE_PERIOD_USEC = 10000;
+            static const uint8_t  LPF_SIZE           = 64;
 
             // Use digital pin 10 for chip select
             PMW3901 _flowSensor = PMW3901(10);
@@ -46,12 +50,12 @@ namespace hf {
             LowPassFilter _lpf_y = LowPassFilter(LPF_SIZE);
 
             // Track elapsed time for periodic readiness
-            float _previousTime = 0;
+            uint64_t _previousUsec = 0;
             float _deltaTime = 0;
 
         protected:
 
-            virtual void modifyState(state_t & state, float time) override
+            virtual void modifyState(state_t & state, const timing_t & timing) override
             {
                 // Avoid time blips
                 if (_deltaTime > 0.02) return;
@@ -60,6 +64,16 @@ namespace hf {
                 int16_t dpixelx=0, dpixely=0;
                 _flowSensor.readMotionCount(&dpixelx, &dpixely);
 
+                float counts[2] = {(float)dpixelx, (float)dpixely};
+                Recorder::recordInput(_recorder, Recorder::INPUT_FLOW, timing, counts);
+
+                if (_estimator) {
+                    // The counts accumulated over the last _deltaTime, so they describe its middle
+                    uint64_t usec = timing.usec - (uint64_t)(_deltaTime * 5e5f);
+                    _estimator->fuseFlow(state, dpixelx, dpixely, _deltaTime, usec);
+                    return;
+                }
+
                 // Scale readings by altitude, then low-pass filter them to get velocity
                 state.inertialVel[0] = _lpf_y.update(dpixely  * state.location[2] * _deltaTime);
                 state.inertialVel[1] = _lpf_x.update(-dpixelx * state.location[2] * _deltaTime);
@@ -69,15 +83,17 @@ namespace hf {
                 state.location[1] += state.inertialVel[1];
             }
 
-            virtual bool ready(float time) override
+            virtual bool ready(const timing_t & timing) override
             {
-                _deltaTime = time - _previousTime; 
+                uint64_t deltaUsec = timing.usec - _previousUsec;
+
+                _deltaTime = deltaUsec * 1e-6f;
 
-                bool result = _deltaTime > UPDATE_PERIOD;
+                bool result = deltaUsec > UPDATE_PERIOD_USEC;
 
                 if (result) {
 
-                    _previousTime = time;
+                    _previousUsec = timing.usec;
                 }
 
                 return result;
@@ -97,7 +113,7 @@ namespace hf {
                 _lpf_x.init();
                 _lpf_y.init();
 
-                _previousTime = 0;
+                _previousUsec = 0;
 
             }
 
@@ -0,0 +1,115 @@
+/*
+   Simulated optical-flow sensor, with the same low-pass filtering as the
+   PMW3901 support in lpf_opticalflow.hpp
+
+   Copyright (c) 2020 Simon D. Levy
+
+   This file is part of Hackflight.
+
+   Hackflight is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   Hackflight is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+   You should have received a copy of the GNU General Public License
+   along with Hackflight.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "sensor.hpp"
+#include "filters.hpp"
+#include "recorder.hpp"
+#include "sensors/estimator.hpp"
+
+namespace hf {
+
+    class SimOpticalFlow : public Sensor {
+
+        template <typename... Sensors> friend class SensorChain;
+
+        private:
+
+            static const uint32_t UPDATE_PERIOD_USEC = 10000;
+            static const uint8_t  LPF_SIZE           = 64;
+
+            LowPassFilter _lpf_x = LowPassFilter(LPF_SIZE);
+            LowPassFilter _lpf_y = LowPassFilter(LPF_SIZE);
+
+            // Pixel counts accumulated since the last read, as the sensor's motion registers hold them
+            int16_t _dpixelx = 0;
+            int16_t _dpixely = 0;
+
+            uint64_t _previousUsec = 0;
+            float _deltaTime = 0;
+
+        protected:
+
+            virtual void modifyState(state_t & state, const timing_t & timing) override
+            {
+                // Reading clears the counts
+                int16_t dpixelx = _dpixelx;
+                int16_t dpixely = _dpixely;
+                _dpixelx = 0;
+                _dpixely = 0;
+
+                float counts[2] = {(float)dpixelx, (float)dpixely};
+                Recorder::recordInput(_recorder, Recorder::INPUT_FLOW, timing, counts);
+
+                // Avoid time blips
+                if (_deltaTime > 0.02) return;
+
+                if (_estimator) {
+                    // The counts accumulated over the last _deltaTime, so they describe its middle
+                    uint64_t usec = timing.usec - (uint64_t)(_deltaTime * 5e5f);
+                    _estimator->fuseFlow(state, dpixelx, dpixely, _deltaTime, usec);
+                    return;
+                }
+
+                // Scale readings by altitude, then low-pass filter them to get velocity
+                state.inertialVel[0] = _lpf_y.update(dpixely  * state.location[2] * _deltaTime);
+                state.inertialVel[1] = _lpf_x.update(-dpixelx * state.location[2] * _deltaTime);
+
+                // Integrate velocity to get position
+                state.location[0] += state.inertialVel[0];
+                state.location[1] += state.inertialVel[1];
+            }
+
+            virtual bool ready(const timing_t & timing) override
+            {
+                uint64_t deltaUsec = timing.usec - _previousUsec;
+
+                _deltaTime = deltaUsec * 1e-6f;
+
+                bool result = deltaUsec > UPDATE_PERIOD_USEC;
+
+                if (result) {
+
+                    _previousUsec = timing.usec;
+                }
+
+                return result;
+            }
+
+        public:
+
+            SimOpticalFlow(void)
+            {
+                _lpf_x.init();
+                _lpf_y.init();
+            }
+
+            // Adds to the counts returned by the next read
+            void addMotionCount(int16_t dpixelx, int16_t dpixely)
+            {
+                _dpixelx += dpixelx;
+                _dpixely += dpixely;
+            }
+
+    };  // class SimOpticalFlow
+
+} // namespace hf
@@ -1,6 +1,15 @@
 /*
    Support for rangefinder sensors (sonar, time-of-flight)
 
+   By default the rangefinder is polled on each loop iteration and a reading
+   is taken at most 25 times a second.  A rangefinder with a data-ready
+   interrupt can instead be read in the interrupt: call useInterrupt(), then
+   interrupt() on each data-ready signal.  The readings wait, with the time of
+   the interrupt, in a queue that modifyState() drains, so each one reaches
+   the state at the sensor's own rate and the loop no longer polls the sensor.
+   Readings are logged when they're drained, not at the time of the
+   interrupt, so a log made in interrupt mode doesn't replay exactly.
+
    Copyright (c) 2018 Simon D. Levy
 
    This file is part of Hackflight.
@@ -20,58 +29,129 @@
 
 #pragma once
 
+#include <atomic>
 #include <cmath>
 #include <math.h>
 
 #include "sensor.hpp"
 #include "filters.hpp"
+#include "recorder.hpp"
+#include "sensors/estimator.hpp"
 
 namespace hf {
 
     class Rangefinder : public Sensor {
 
+        template <typename... Sensors> friend class SensorChain;
+
         private:
 
-            static constexpr float UPDATE_HZ = 25; // XXX should be using interrupt!
+            // When polling
+            static const uint32_t UPDATE_HZ = 25;
 
-            static constexpr float UPDATE_PERIOD = 1/UPDATE_HZ;
+            static const uint32_t UPDATE_PERIOD_USEC = 1000000 / UPDATE_HZ;
 
             float _distance = 0;
 
+            // Time of the previous accepted reading
+            uint64_t _readyUsec = 0;
+
+            // Previous values to support first-differencing
+            uint64_t _stateUsec = 0;
+            float _altitude = 0;
+
             LowPassFilter _lpf = LowPassFilter(20);
 
-        protected:
+            // From the time a reading describes to the time it's read
+            uint32_t _latencyUsec = 0;
 
-            virtual void modifyState(state_t & state, float time) override
+            // Readings from interrupt(), with the board's microseconds at each; the
+            // interrupt is the only producer and modifyState() the only consumer
+            static const uint8_t QUEUE_SIZE = 4;
+            float _queueDistance[QUEUE_SIZE] = {0};
+            uint32_t _queueMicros[QUEUE_SIZE] = {0};
+            volatile uint8_t _queueHead = 0;
+            volatile uint8_t _queueTail = 0;
+
+            bool _interrupt = false;
+
+            // A reading taken at the given time
+            void update(state_t & state, float distance, uint64_t usec)
             {
-                // Previous values to support first-differencing
-                static float _time;
-                static float _altitude;
+                if (_estimator) {
+                    // Just after boot, a reading can't describe a time before zero
+                    _estimator->fuseRange(state, distance, usec > _latencyUsec ? usec - _latencyUsec : 0);
+                    return;
+                }
 
                 // Compensate for effect of pitch, roll on rangefinder reading
-                state.location[2] =  _distance * cos(state.rotation[0]) * cos(state.rotation[1]);
+                state.location[2] =  distance * cos(state.rotation[0]) * cos(state.rotation[1]);
+
+                // Readings clamped to the same loop time have no derivative between them
+                if (usec <= _stateUsec) return;
 
                 // Use first-differenced, low-pass-filtered altitude as variometer
-                state.inertialVel[2] = _lpf.update((state.location[2]-_altitude) / (time-_time));
+                float dt = (usec - _stateUsec) * 1e-6f;
+                state.inertialVel[2] = _lpf.update((state.location[2]-_altitude) / dt);
 
                 // Update first-difference values
-                _time = time;
+                _stateUsec = usec;
                 _altitude = state.location[2];
             }
 
-            virtual bool ready(float time) override
+        protected:
+
+            virtual void modifyState(state_t & state, const timing_t & timing) override
+            {
+                if (!_interrupt) {
+                    update(state, _distance, timing.usec);
+                    return;
+                }
+
+                // Oldest first
+                uint8_t tail = _queueTail;
+
+                while (tail != _queueHead) {
+
+                    // Read the entry only after seeing the head that published it
+                    std::atomic_signal_fence(std::memory_order_acquire);
+
+                    _distance = _queueDistance[tail];
+
+                    // The signed 32-bit difference puts the interrupt on the loop's 64-bit
+                    // timeline; an interrupt that came after the loop read the clock is
+                    // taken as being at the loop's time
+                    int32_t delta = (int32_t)((uint32_t)timing.usec - _queueMicros[tail]);
+                    uint64_t usec = timing.usec - (delta > 0 ? delta : 0);
+
+                    // Free the entry only after reading it
+                    std::atomic_signal_fence(std::memory_order_release);
+                    tail = (tail + 1) % QUEUE_SIZE;
+                    _queueTail = tail;
+
+                    Recorder::recordInput(_recorder, Recorder::INPUT_RANGE, timing, &_distance);
+
+                    update(state, _distance, usec);
+                }
+            }
+
+            virtual bool ready(const timing_t & timing) override
             {
+                if (_interrupt) {
+                    return _queueTail != _queueHead;
+                }
+
                 float newDistance;
 
                 if (distanceAvailable(newDistance)) {
 
-                    static float _time;
+                    Recorder::recordInput(_recorder, Recorder::INPUT_RANGE, timing, &newDistance);
 
-                    if (time-_time > UPDATE_PERIOD) {
+                    if (timing.usec - _readyUsec > UPDATE_PERIOD_USEC) {
 
                         _distance = newDistance;
 
-                        _time = time; 
+                        _readyUsec = timing.usec; 
 
                         return true;
                     }
@@ -85,11 +165,47 @@ namespace hf {
 
         public:
 
-            Rangefinder(void) 
+            Rangefinder(uint32_t latencyUsec=0) 
             {
+                _latencyUsec = latencyUsec;
+
                 _lpf.init();
             }
 
+            // Stops polling the rangefinder in the loop
+            void useInterrupt(void)
+            {
+                _interrupt = true;
+            }
+
+            // After useInterrupt(), call this from the rangefinder's data-ready interrupt
+            // with the board's microseconds; or, if the rangefinder can't be read from
+            // interrupt context, from loop() when a flag set by the interrupt is found.
+            // A reading that finds the queue full is dropped.
+            void interrupt(uint32_t usec)
+            {
+                if (!_interrupt) return;
+
+                float distance = 0;
+
+                if (!distanceAvailable(distance)) return;
+
+                uint8_t head = _queueHead;
+                uint8_t next = (head + 1) % QUEUE_SIZE;
+
+                if (next == _queueTail) return;
+
+                // Write the entry only after seeing the tail that freed it
+                std::atomic_signal_fence(std::memory_order_acquire);
+
+                _queueDistance[head] = distance;
+                _queueMicros[head] = usec;
+
+                // Publish the entry only after it's written
+                std::atomic_signal_fence(std::memory_order_release);
+                _queueHead = next;
+            }
+
     };  // class Rangefinder
 
 } // namespace
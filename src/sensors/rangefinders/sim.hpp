@@ -0,0 +1,63 @@
+/*
+   Simulated rangefinder for running Hackflight on a host computer
+
+   Copyright (c) 2020 Simon D. Levy
+
+   This file is part of Hackflight.
+
+   Hackflight is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   Hackflight is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+   You should have received a copy of the GNU General Public License
+   along with Hackflight.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "sensors/rangefinder.hpp"
+
+namespace hf {
+
+    class SimRangefinder : public Rangefinder {
+
+        private:
+
+            float _distance = 0;
+            bool _ready = false;
+
+        protected:
+
+            virtual bool distanceAvailable(float & distance) override
+            {
+                if (!_ready) return false;
+
+                distance = _distance;
+                _ready = false;
+
+                return true;
+            }
+
+        public:
+
+            // Readings are set latencyUsec after the time they describe
+            SimRangefinder(uint32_t latencyUsec=0)
+                : Rangefinder(latencyUsec)
+            {
+            }
+
+            // Meters
+            void setDistance(float distance)
+            {
+                _distance = distance;
+                _ready = true;
+            }
+
+    }; // class SimRangefinder
+
+} // namespace hf
@@ -29,6 +29,9 @@ namespace hf {
 
         private:
 
+            // A reading describes the middle of the ranging that produced it
+            static const uint32_t LATENCY_USEC = 20000;
+
             VL53L1X _distanceSensor;
 
         protected:
@@ -44,6 +47,11 @@ namespace hf {
 
         public:
 
+            VL53L1X_Rangefinder(void)
+                : Rangefinder(LATENCY_USEC)
+            {
+            }
+
             void begin(void)
             {
                 _distanceSensor.begin();
@@ -28,6 +28,7 @@ namespace hf {
     class SurfaceMountSensor : public Sensor {
 
         friend class Hackflight;
+        template <typename... Sensors> friend class SensorChain;
 
         protected:
 
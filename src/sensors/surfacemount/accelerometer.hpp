@@ -35,6 +35,8 @@ namespace hf {
 
     class Accelerometer : public SurfaceMountSensor {
 
+        template <typename... Sensors> friend class SensorChain;
+
         private:
 
             float _ax = 0;
@@ -43,16 +45,16 @@ namespace hf {
 
         protected:
 
-            virtual void modifyState(state_t & state, float time) override
+            virtual void modifyState(state_t & state, const timing_t & timing) override
             {
                 // Here is where you'd do sensor fusion
                 (void)state;
-                (void)time;
+                (void)timing;
             }
 
-            virtual bool ready(float time) override
+            virtual bool ready(const timing_t & timing) override
             {
-                (void)time;
+                (void)timing;
 
                 return imu->getAccelerometer(_ax, _ay, _az);
             }
@@ -24,12 +24,15 @@
 #include <math.h>
 
 #include "sensor.hpp"
-#include "surfacemount.hpp"
+#include "sensors/surfacemount.hpp"
+#include "sensors/estimator.hpp"
 
 namespace hf {
 
     class Barometer : public SurfaceMountSensor {
 
+        template <typename... Sensors> friend class SensorChain;
+
         private:
 
             // pascals
@@ -37,16 +40,17 @@ namespace hf {
 
         protected:
 
-            virtual void modifyState(state_t & state, float time) override
+            virtual void modifyState(state_t & state, const timing_t & timing) override
             {
-                // Here is where you'd do sensor fusion
-                (void)state;
-                (void)time;
+                // Only the estimator uses the pressure
+                if (_estimator) {
+                    _estimator->fuseBarometer(state, _pressure, timing.usec);
+                }
             }
 
-            virtual bool ready(float time) override
+            virtual bool ready(const timing_t & timing) override
             {
-                (void)time;
+                (void)timing;
 
                 return imu->getBarometer(_pressure);
             }
@@ -29,6 +29,7 @@ namespace hf {
     class Gyrometer : public SurfaceMountSensor {
 
         friend class Hackflight;
+        template <typename... Sensors> friend class SensorChain;
 
         private:
 
@@ -38,9 +39,9 @@ namespace hf {
 
         protected:
 
-            virtual void modifyState(state_t & state, float time) override
+            virtual void modifyState(state_t & state, const timing_t & timing) override
             {
-                (void)time;
+                (void)timing;
 
                 // NB: We negate gyro X, Y to simplify PID controller
                 state.angularVel[0] =  _x;
@@ -48,9 +49,9 @@ namespace hf {
                 state.angularVel[2] = -_z;
             }
 
-            virtual bool ready(float time) override
+            virtual bool ready(const timing_t & timing) override
             {
-                (void)time;
+                (void)timing;
 
                 bool result = imu->getGyrometer(_x, _y, _z);
 
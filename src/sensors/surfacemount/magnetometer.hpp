@@ -34,6 +34,8 @@ namespace hf {
 
     class Magnetometer : public SurfaceMountSensor {
 
+        template <typename... Sensors> friend class SensorChain;
+
         private:
 
             float _mx = 0;
@@ -42,16 +44,16 @@ namespace hf {
 
         protected:
 
-            virtual void modifyState(state_t & state, float time) override
+            virtual void modifyState(state_t & state, const timing_t & timing) override
             {
                 // Here is where you'd do sensor fusion
                 (void)state;
-                (void)time;
+                (void)timing;
             }
 
-            virtual bool ready(float time) override
+            virtual bool ready(const timing_t & timing) override
             {
-                (void)time;
+                (void)timing;
 
                 return imu->getMagnetometer(_uTs);
             }
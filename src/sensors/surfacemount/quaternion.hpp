@@ -28,12 +28,14 @@
 #include <math.h>
 
 #include "sensors/surfacemount.hpp"
+#include "sensors/estimator.hpp"
 
 namespace hf {
 
     class Quaternion : public SurfaceMountSensor {
 
         friend class Hackflight;
+        template <typename... Sensors> friend class SensorChain;
 
         private:
 
@@ -52,21 +54,23 @@ namespace hf {
                 _z = 0;
             }
 
-            virtual void modifyState(state_t & state, float time) override
+            virtual void modifyState(state_t & state, const timing_t & timing) override
             {
-                (void)time;
-
                 computeEulerAngles(_w, _x, _y, _z, state.rotation);
 
                 // Convert heading from [-pi,+pi] to [0,2*pi]
                 if (state.rotation[2] < 0) {
                     state.rotation[2] += 2*M_PI;
                 }
+
+                if (_estimator) {
+                    _estimator->fuseAttitude(state, timing.usec);
+                }
             }
 
-            virtual bool ready(float time) override
+            virtual bool ready(const timing_t & timing) override
             {
-                return imu->getQuaternion(_w, _x, _y, _z, time);
+                return imu->getQuaternion(_w, _x, _y, _z, timing.usec);
             }
 
         public:
@@ -0,0 +1,75 @@
+/*
+   Abstract class for timing the stages of Hackflight::update()
+
+   Copyright (c) 2020 Simon D. Levy
+
+   This file is part of Hackflight.
+
+   Hackflight is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   Hackflight is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+   You should have received a copy of the GNU General Public License
+   along with Hackflight.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+namespace hf {
+
+    class StageTimer {
+
+        public:
+
+            // Stages bracketed in the flight loop
+            typedef enum {
+                STAGE_UPDATE,       // all of Hackflight::update()
+                STAGE_RECEIVER,     // Hackflight::checkReceiver()
+                STAGE_PIDTASK,      // PidTask::doTask()
+                STAGE_MIXER,        // Actuator::run() inside PidTask
+                STAGE_GYROMETER,    // Hackflight::checkGyrometer()
+                STAGE_QUATERNION,   // Hackflight::checkQuaternion()
+                STAGE_SENSOR,       // one sensor; index is its position in the sensor list, a SensorChain is last
+                STAGE_SERIALTASK,   // SerialTask::doTask()
+                STAGE_COUNT
+            } stage_t;
+
+            // Null-safe helpers for the call sites
+            static void begin(StageTimer * timer, uint8_t stage, uint8_t index=0)
+            {
+#ifndef HACKFLIGHT_NO_TRACE
+                if (timer) {
+                    timer->beginStage(stage, index);
+                }
+#else
+                (void)timer; (void)stage; (void)index;
+#endif
+            }
+
+            static void end(StageTimer * timer, uint8_t stage, uint8_t index=0)
+            {
+#ifndef HACKFLIGHT_NO_TRACE
+                if (timer) {
+                    timer->endStage(stage, index);
+                }
+#else
+                (void)timer; (void)stage; (void)index;
+#endif
+            }
+
+        protected:
+
+            virtual void beginStage(uint8_t stage, uint8_t index) = 0;
+
+            virtual void endStage(uint8_t stage, uint8_t index) = 0;
+
+    }; // class StageTimer
+
+} // namespace hf
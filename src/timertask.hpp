@@ -21,25 +21,84 @@
 #pragma once
 
 #include "board.hpp"
+#include "datatypes.hpp"
 #include "debugger.hpp"
+#include "stagetimer.hpp"
 
 namespace hf {
 
     class TimerTask {
 
+        friend class Scheduler;
+
         private:
 
-            float _period = 0;
-            float _time = 0;
+            const char * _name = NULL;
+
+            uint32_t _periodUsec = 0;
+
+            // Releases are on a fixed phase: each one is a period after the previous
+            // release, not after the time the task happened to run
+            uint64_t _releaseUsec = 0;
+            bool     _started = false;
+
+            // Statistics
+            uint64_t _startUsec = 0;
+            uint64_t _lastRunUsec = 0;
+            uint32_t _maxLatenessUsec = 0;
+            uint32_t _runs = 0;
+            uint32_t _overruns = 0;
+
+            void start(uint64_t usec)
+            {
+                _startUsec = usec;
+                _releaseUsec = usec;
+                _started = true;
+            }
+
+            bool ready(const timing_t & timing)
+            {
+                if (!_started) {
+                    start(timing.usec);
+                }
+
+                return timing.usec >= _releaseUsec;
+            }
+
+            void run(const timing_t & timing)
+            {
+                uint64_t lateness = timing.usec - _releaseUsec;
+
+                if (lateness > _maxLatenessUsec) {
+                    _maxLatenessUsec = lateness > UINT32_MAX ? UINT32_MAX : (uint32_t)lateness;
+                }
+
+                doTask(timing);
+
+                _runs++;
+                _lastRunUsec = timing.usec;
+
+                // A task that is a full period or more late has missed releases; skip
+                // them rather than running back-to-back to catch up.  The usual case
+                // avoids a 64-bit divide.
+                uint32_t missed = lateness < _periodUsec ? 0 : (uint32_t)(lateness / _periodUsec);
+
+                _overruns += missed;
+
+                _releaseUsec += (uint64_t)(missed + 1) * _periodUsec;
+            }
 
         protected:
 
             Board * _board = NULL;
 
-            TimerTask(float freq)
+            // Optional timing of doTask()
+            StageTimer * _stageTimer = NULL;
+
+            TimerTask(const char * name, float freq)
             {
-                _period = 1 / freq;
-                _time = 0;
+                _name = name;
+                setFrequency(freq);
             }
 
             void init(Board * board)
@@ -47,19 +106,47 @@ namespace hf {
                 _board = board;
             }
 
-            virtual void doTask(void) = 0;
+            void setFrequency(float freq)
+            {
+                _periodUsec = (uint32_t)(1e6f / freq + 0.5f);
+            }
+
+            virtual void doTask(const timing_t & timing) = 0;
 
         public:
 
-            void update(void)
+            const char * getName(void)
             {
-                float time = _board->getTime();
+                return _name;
+            }
 
-                if ((time - _time) > _period)
-                {
-                    doTask();
-                    _time = time;
-                }
+            float getRequestedRate(void)
+            {
+                return 1e6f / _periodUsec;
+            }
+
+            float getAchievedRate(void)
+            {
+                uint64_t elapsed = _lastRunUsec - _startUsec;
+
+                return (_runs > 1 && elapsed > 0) ? (_runs - 1) / (elapsed * 1e-6f) : 0;
+            }
+
+            uint32_t getRuns(void)
+            {
+                return _runs;
+            }
+
+            // Number of releases skipped because the task ran a full period late
+            uint32_t getOverruns(void)
+            {
+                return _overruns;
+            }
+
+            // Seconds between a release and the start of the corresponding run
+            float getMaxLateness(void)
+            {
+                return _maxLatenessUsec * 1e-6f;
             }
 
     };  // TimerTask
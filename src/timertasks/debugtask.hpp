@@ -0,0 +1,64 @@
+/*
+   Timer task for formatting or sending the messages queued by Debugger::trace()
+
+   Copyright (c) 2020 Simon D. Levy
+
+   This file is part of Hackflight.
+
+   Hackflight is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   Hackflight is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+   You should have received a copy of the GNU General Public License
+   along with Hackflight.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "timertask.hpp"
+#include "debugger.hpp"
+
+namespace hf {
+
+    class DebugTask : public TimerTask {
+
+        friend class Hackflight;
+
+        private:
+
+            static constexpr float FREQ = 50;
+
+            // Bounds the time spent in one run
+            static const uint8_t MAX_EVENTS_PER_RUN = 4;
+
+            Debugger * _debugger = NULL;
+
+        protected:
+
+            DebugTask(void)
+                : TimerTask("debug", FREQ)
+            {
+            }
+
+            void init(Board * board, Debugger * debugger)
+            {
+                TimerTask::init(board);
+
+                _debugger = debugger;
+            }
+
+            virtual void doTask(const timing_t & timing) override
+            {
+                (void)timing;
+
+                _debugger->drain(MAX_EVENTS_PER_RUN);
+            }
+
+    };  // DebugTask
+
+} // namespace hf
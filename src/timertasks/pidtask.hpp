@@ -20,7 +20,16 @@
 
 #pragma once
 
+#include <atomic>
+
 #include "timertask.hpp"
+#include "pidchain.hpp"
+#include "recorder.hpp"
+
+// Sketches that use only a PidChain can define this as 1 to save RAM
+#ifndef HACKFLIGHT_MAX_PID_CONTROLLERS
+#define HACKFLIGHT_MAX_PID_CONTROLLERS 256
+#endif
 
 namespace hf {
 
@@ -33,18 +42,31 @@ namespace hf {
             static constexpr float FREQ = 300;
 
             // PID controllers
-            PidController * _pid_controllers[256] = {NULL};
+            PidController * _pid_controllers[HACKFLIGHT_MAX_PID_CONTROLLERS] = {NULL};
             uint8_t _pid_controller_count = 0;
 
+            // Optional compile-time chain, run ahead of the controllers above
+            PidChainBase * _chain = NULL;
+
             // Other stuff we need
             Receiver * _receiver = NULL;
             Actuator * _actuator = NULL;
             state_t  * _state    = NULL;
 
+            // In gyro-synchronous mode, the inner controller runs on each gyro sample
+            // instead of in doTask(), using the latest demands from the outer controllers.
+            // Those are double-buffered so that an interrupt never sees a half-written copy.
+            PidController * _innerController = NULL;
+            demands_t _heldDemands[2] = {};
+            volatile uint8_t _heldIndex = 0;
+
+            // Optional flight log
+            Recorder * _recorder = NULL;
+
         protected:
 
             PidTask(void)
-                : TimerTask(FREQ)
+                : TimerTask("pid", FREQ)
             {
                 _pid_controller_count = 0;
             }
@@ -58,15 +80,18 @@ namespace hf {
                 _state = state;
             }
 
-            void addPidController(PidController * pidController, uint8_t auxState) 
+            void addPidController(PidController * pidController, uint8_t auxState, float freq) 
             {
                 pidController->auxState = auxState;
+                pidController->setFrequency(freq);
 
                 _pid_controllers[_pid_controller_count++] = pidController;
             }
 
-            virtual void doTask(void) override
+            virtual void doTask(const timing_t & timing) override
             {
+                StageTimer::begin(_stageTimer, StageTimer::STAGE_PIDTASK);
+
                 // Start with demands from receiver, scaling roll/pitch/yaw by constant
                 demands_t demands = {};
                 demands.throttle = _receiver->demands.throttle;
@@ -80,6 +105,18 @@ namespace hf {
                 // Some PID controllers should cause LED to flash when they're active
                 bool shouldFlash = false;
 
+                // Controllers running slower than this task hold their output in between
+                uint64_t usec = timing.usec;
+
+                // Receiver demands, then the output of the chain and of each controller
+                Recorder::beginCycle(_recorder, timing, *_state, _receiver->rawvals, 1 + (_chain ? 1 : 0) + _pid_controller_count);
+                Recorder::addDemands(_recorder, demands);
+
+                if (_chain) {
+                    _chain->run(_state, demands, usec, auxState, _receiver->throttleIsDown(), shouldFlash);
+                    Recorder::addDemands(_recorder, demands);
+                }
+
                 for (uint8_t k=0; k<_pid_controller_count; ++k) {
 
                     PidController * pidController = _pid_controllers[k];
@@ -89,23 +126,83 @@ namespace hf {
 
                     if (pidController->auxState <= auxState) {
 
-                        pidController->modifyDemands(_state, demands); 
+                        if (pidController->due(usec)) {
+                            pidController->modifyDemands(_state, demands); 
+                            pidController->_heldDemands = demands;
+                        }
+                        else {
+                            pidController->holdDemands(demands, pidController->modifiedDemands());
+                        }
 
                         if (pidController->shouldFlashLed()) {
                             shouldFlash = true;
                         }
                     }
+
+                    else {
+                        pidController->restart();
+                    }
+
+                    Recorder::addDemands(_recorder, demands);
                 }
 
                 // Flash LED for certain PID controllers
                 _board->flashLed(shouldFlash);
 
+                // Hand off to the inner loop, which runs the motors; the log gets the
+                // motor values from its latest run
+                if (_innerController) {
+                    uint8_t next = 1 - _heldIndex;
+                    _heldDemands[next] = demands;
+                    // Publish the index only after the demands it points to are written
+                    std::atomic_signal_fence(std::memory_order_release);
+                    _heldIndex = next;
+                    Recorder::endCycle(_recorder);
+                    StageTimer::end(_stageTimer, StageTimer::STAGE_PIDTASK);
+                    return;
+                }
+
                 // Use updated demands to run motors
                 if (_state->armed && !_state->failsafe && !_receiver->throttleIsDown()) {
+                    StageTimer::begin(_stageTimer, StageTimer::STAGE_MIXER);
                     _actuator->run(demands);
+                    StageTimer::end(_stageTimer, StageTimer::STAGE_MIXER);
                 }
+
+                Recorder::endCycle(_recorder);
+
+                StageTimer::end(_stageTimer, StageTimer::STAGE_PIDTASK);
              }
 
+            void setInnerController(PidController * pidController, uint8_t auxState)
+            {
+                pidController->auxState = auxState;
+                pidController->setFrequency(0);
+
+                _innerController = pidController;
+            }
+
+            // Called for each new gyro sample in gyro-synchronous mode, possibly from an
+            // interrupt; not traced, since the tracer has a single producer
+            void runInner(void)
+            {
+                uint8_t index = _heldIndex;
+                std::atomic_signal_fence(std::memory_order_acquire);
+                demands_t demands = _heldDemands[index];
+
+                bool throttleIsDown = _receiver->throttleIsDown();
+
+                _innerController->updateReceiver(throttleIsDown);
+
+                if (_innerController->auxState <= _receiver->getAux2State()) {
+                    _innerController->modifyDemands(_state, demands);
+                }
+
+                if (_state->armed && !_state->failsafe && !throttleIsDown) {
+                    _actuator->run(demands);
+                }
+            }
+
     };  // PidTask
 
 } // namespace hf
@@ -0,0 +1,87 @@
+/*
+   Timer task for draining the flight-log recorder to its sink
+
+   Copyright (c) 2020 Simon D. Levy
+
+   This file is part of Hackflight.
+
+   Hackflight is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   Hackflight is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+   You should have received a copy of the GNU General Public License
+   along with Hackflight.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "timertask.hpp"
+#include "recorder.hpp"
+#include "logsink.hpp"
+
+namespace hf {
+
+    class RecorderTask : public TimerTask {
+
+        friend class Hackflight;
+
+        private:
+
+            static constexpr float FREQ = 100;
+
+            // Bounds the time spent in one run however fast the sink is
+            static const uint16_t MAX_BYTES_PER_RUN = 512;
+
+            Recorder * _recorder = NULL;
+            LogSink  * _sink = NULL;
+
+        protected:
+
+            RecorderTask(void)
+                : TimerTask("recorder", FREQ)
+            {
+            }
+
+            void init(Board * board, Recorder * recorder, LogSink * sink)
+            {
+                TimerTask::init(board);
+
+                _recorder = recorder;
+                _sink = sink;
+            }
+
+            virtual void doTask(const timing_t & timing) override
+            {
+                (void)timing;
+
+                uint16_t total = 0;
+
+                while (total < MAX_BYTES_PER_RUN) {
+
+                    const uint8_t * data = NULL;
+                    uint16_t count = _recorder->peek(data);
+
+                    if (count > MAX_BYTES_PER_RUN - total) {
+                        count = MAX_BYTES_PER_RUN - total;
+                    }
+
+                    if (count == 0) break;
+
+                    uint16_t written = _sink->write(data, count);
+
+                    _recorder->consume(written);
+                    total += written;
+
+                    // Sink is full for now
+                    if (written < count) break;
+                }
+            }
+
+    };  // RecorderTask
+
+} // namespace hf
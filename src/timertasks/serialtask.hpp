@@ -25,6 +25,7 @@
 #include "mspparser.hpp"
 #include "debugger.hpp"
 #include "actuators/mixer.hpp"
+#include "tracer.hpp"
 
 namespace hf {
 
@@ -36,29 +37,156 @@ namespace hf {
 
             static constexpr float FREQ = 66;
 
+            // Bytes that subscriptions can add to the replies of one run: what a
+            // 115200-baud link, at ten bits a byte, carries in a period
+            static constexpr uint16_t BYTES_PER_RUN = (uint16_t)(115200 / 10 / FREQ);
+
+            static const uint8_t MAX_SUBSCRIPTIONS = 8;
+
+            // Longest subscription period, a little over an hour, so that it fits
+            // in 32 bits however slow the requested rate
+            static constexpr float MAX_PERIOD_USEC = 4e9f;
+
+            // Bytes read from the board at a time
+            static const uint8_t READ_CHUNK = 32;
+
+            // Request messages pushed on a fixed phase, as TimerTask releases are
+            typedef struct {
+
+                uint16_t id;
+                uint32_t periodUsec;
+                uint64_t usec;      // next release
+
+            } subscription_t;
+
             Mixer    * _mixer = NULL;
             Receiver * _receiver = NULL;
             state_t  * _state = NULL;
+            Tracer   * _tracer = NULL;
+
+            subscription_t _subscriptions[MAX_SUBSCRIPTIONS] = {};
+            uint8_t _nsubscriptions = 0;
+
+            // Where each run starts through the subscriptions, rotating so that
+            // those deferred by the budget get their turn
+            uint8_t _firstSubscription = 0;
+
+            static void readTraceEvent(Tracer * tracer, int32_t & count, int32_t & s, int32_t & b, int32_t & e)
+            {
+                Tracer::event_t event;
+
+                if (tracer && tracer->read(event)) {
+                    s = (event.stage << 8) | event.index;
+                    b = (int32_t)event.begin;
+                    e = (int32_t)event.end;
+                    count++;
+                }
+            }
+
+            uint16_t writeReply(void)
+            {
+                const uint8_t * bytes = NULL;
+                uint16_t count = MspParser::readBytes(&bytes);
+
+                if (count > 0) {
+                    _board->serialWrite(bytes, count);
+                }
+
+                return count;
+            }
+
+            // Replaces any subscription to the message; a zero rate, or a message
+            // that isn't a request, unsubscribes.  Ignored if there are already
+            // MAX_SUBSCRIPTIONS others.
+            void subscribe(uint16_t id, float rate)
+            {
+                uint8_t k = 0;
+                while (k < _nsubscriptions && _subscriptions[k].id != id) {
+                    k++;
+                }
+
+                if (rate <= 0 || MspParser::pushBytes(id) == 0) {
+                    if (k < _nsubscriptions) {
+                        _subscriptions[k] = _subscriptions[--_nsubscriptions];
+                    }
+                    return;
+                }
+
+                if (k == _nsubscriptions) {
+                    if (k == MAX_SUBSCRIPTIONS) {
+                        return;
+                    }
+                    _nsubscriptions++;
+                }
+
+                // At most one message per run
+                _subscriptions[k].id = id;
+                float periodUsec = 1e6f / (rate < FREQ ? rate : FREQ) + 0.5f;
+                _subscriptions[k].periodUsec = (uint32_t)(periodUsec < MAX_PERIOD_USEC ? periodUsec : MAX_PERIOD_USEC);
+                _subscriptions[k].usec = 0; // right away
+            }
+
+            // Pushes the subscriptions that are due, in the budget left after the
+            // bytes already sent.  One that doesn't fit stays due for the next run,
+            // unless it's the first message of this one.
+            void pushSubscriptions(const timing_t & timing, uint16_t sent)
+            {
+                uint8_t n = _nsubscriptions;
+
+                for (uint8_t j=0; j<n; ++j) {
+
+                    subscription_t & subscription = _subscriptions[(_firstSubscription + j) % n];
+
+                    if (timing.usec < subscription.usec) continue;
+
+                    if (sent > 0 && sent + MspParser::pushBytes(subscription.id) > BYTES_PER_RUN) continue;
+
+                    MspParser::push(subscription.id);
+                    sent += writeReply();
+
+                    subscription.usec += subscription.periodUsec;
+
+                    // Behind by a period or more: skip the missed messages
+                    if (subscription.usec <= timing.usec) {
+                        subscription.usec = timing.usec + subscription.periodUsec;
+                    }
+                }
+
+                if (n > 0) {
+                    _firstSubscription = (_firstSubscription + 1) % n;
+                }
+            }
 
         protected:
 
             // TimerTask overrides -------------------------------------------------------
 
-            virtual void doTask(void) override
+            virtual void doTask(const timing_t & timing) override
             {
-                while (_board->serialAvailableBytes() > 0) {
+                StageTimer::begin(_stageTimer, StageTimer::STAGE_SERIALTASK);
 
-                    MspParser::parse(_board->serialReadByte());
-                }
+                uint16_t sent = 0;
+
+                uint8_t bytes[READ_CHUNK];
 
-                while (MspParser::availableBytes() > 0) {
-                    _board->serialWriteByte(MspParser::readByte());
+                for (uint16_t count=_board->serialRead(bytes, READ_CHUNK); count>0;
+                        count=_board->serialRead(bytes, READ_CHUNK)) {
+
+                    // Send each reply before parsing on, so that one doesn't replace another
+                    for (uint16_t k=0; k<count; ++k) {
+                        MspParser::parse(bytes[k]);
+                        sent += writeReply();
+                    }
                 }
 
+                pushSubscriptions(timing, sent);
+
                 // Support motor testing from GCS
                 if (!_state->armed) {
                     _mixer->runDisarmed();
                 }
+
+                StageTimer::end(_stageTimer, StageTimer::STAGE_SERIALTASK);
             }
 
             // MspParser overrides -------------------------------------------------------
@@ -66,14 +194,15 @@ namespace hf {
             virtual void handle_STATE_Request(float & altitude, float & variometer, float & positionX, float & positionY, 
                     float & heading, float & velocityForward, float & velocityRightward) override
             {
-                // XXX Use only heading for now
-                altitude = 0;
-                variometer = 0;
-                positionX = 0;
-                positionY = 0;
+                // Location and inertial velocity are north, east, and up; body velocity is
+                // forward, right, and up.  Fields that no sensor estimates stay zero.
+                altitude = _state->location[2];
+                variometer = _state->inertialVel[2];
+                positionX = _state->location[0];
+                positionY = _state->location[1];
                 heading = -_state->rotation[AXIS_YAW]; // NB: Angle negated for remote visualization
-                velocityForward = 0;
-                velocityRightward = 0;
+                velocityForward = _state->bodyVel[0];
+                velocityRightward = _state->bodyVel[1];
             }
  
             virtual void handle_SET_ARMED(uint8_t  flag) override
@@ -105,6 +234,43 @@ namespace hf {
                 yaw   = _state->rotation[AXIS_YAW];
             }
 
+            virtual void handle_TRACE_Request(int32_t & count, int32_t & s1, int32_t & b1, int32_t & e1,
+                    int32_t & s2, int32_t & b2, int32_t & e2, int32_t & s3, int32_t & b3, int32_t & e3,
+                    int32_t & s4, int32_t & b4, int32_t & e4) override
+            {
+                count = 0;
+                readTraceEvent(_tracer, count, s1, b1, e1);
+                readTraceEvent(_tracer, count, s2, b2, e2);
+                readTraceEvent(_tracer, count, s3, b3, e3);
+                readTraceEvent(_tracer, count, s4, b4, e4);
+            }
+
+            virtual void handle_TELEMETRY_Request(float & roll, float & pitch, float & yaw,
+                    float & altitude, float & variometer, float & positionX, float & positionY,
+                    float & heading, float & velocityForward, float & velocityRightward,
+                    float & c1, float & c2, float & c3, float & c4, float & c5, float & c6,
+                    float & m1, float & m2, float & m3, float & m4) override
+            {
+                handle_ATTITUDE_RADIANS_Request(roll, pitch, yaw);
+                handle_STATE_Request(altitude, variometer, positionX, positionY, heading, velocityForward, velocityRightward);
+                handle_RC_NORMAL_Request(c1, c2, c3, c4, c5, c6);
+
+                float * motors[4] = {&m1, &m2, &m3, &m4};
+                for (uint8_t k=0; k<4 && k<_mixer->_nmotors; ++k) {
+                    *motors[k] = _mixer->_motorsPrev[k];
+                }
+            }
+
+            virtual void handle_SET_TELEMETRY_RATE(float rate) override
+            {
+                subscribe(MspParser::ID_TELEMETRY, rate);
+            }
+
+            virtual void handle_SET_SUBSCRIPTION(float rate, int16_t message) override
+            {
+                subscribe((uint16_t)message, rate);
+            }
+
             virtual void handle_SET_MOTOR_NORMAL(float  m1, float  m2, float  m3, float  m4) override
             {
                 _mixer->motorsDisarmed[0] = m1;
@@ -114,7 +280,7 @@ namespace hf {
             }
 
             SerialTask(void)
-                : TimerTask(FREQ)
+                : TimerTask("serial", FREQ)
             {
             }
 
@@ -0,0 +1,156 @@
+/*
+   Records begin/end cycle counts for each stage of the flight loop into a
+   fixed-size ring buffer, for draining over MSP or dumping on the host
+
+   Tracing adds a null check per stage when no tracer is installed; define
+   HACKFLIGHT_NO_TRACE before including hackflight.hpp to compile the stage
+   hooks out altogether.
+
+   Copyright (c) 2020 Simon D. Levy
+
+   This file is part of Hackflight.
+
+   Hackflight is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   Hackflight is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+   You should have received a copy of the GNU General Public License
+   along with Hackflight.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#include "board.hpp"
+#include "debugger.hpp"
+#include "stagetimer.hpp"
+
+namespace hf {
+
+    class Tracer : public StageTimer {
+
+        public:
+
+            // Power of two, so that index wrapping is a mask
+            static const uint8_t SIZE = 64;
+
+            typedef struct {
+
+                uint32_t begin;  // Board::getCycleCount() at stage entry
+                uint32_t end;    // Board::getCycleCount() at stage exit
+                uint8_t  stage;  // StageTimer::stage_t
+                uint8_t  index;  // sensor index for STAGE_SENSOR, else 0
+
+            } event_t;
+
+        private:
+
+            Board * _board = NULL;
+
+            // Stages don't overlap with themselves, so one start time per stage is enough
+            uint32_t _begin[STAGE_COUNT] = {0};
+
+            // Single producer (the loop) and single consumer (the drain), so no locking:
+            // the producer only advances _head and the consumer only advances _tail.
+            event_t _events[SIZE];
+            volatile uint8_t _head = 0;
+            volatile uint8_t _tail = 0;
+
+            // Events lost because the buffer was full when a stage ended
+            uint32_t _dropped = 0;
+
+        protected:
+
+            virtual void beginStage(uint8_t stage, uint8_t index) override
+            {
+                (void)index;
+
+                _begin[stage] = _board->getCycleCount();
+            }
+
+            virtual void endStage(uint8_t stage, uint8_t index) override
+            {
+                uint32_t end = _board->getCycleCount();
+
+                uint8_t next = (_head + 1) & (SIZE - 1);
+
+                // Keep what's already there rather than stall the loop
+                if (next == _tail) {
+                    _dropped++;
+                    return;
+                }
+
+                event_t & event = _events[_head];
+                event.begin = _begin[stage];
+                event.end   = end;
+                event.stage = stage;
+                event.index = index;
+
+                _head = next;
+            }
+
+        public:
+
+            Tracer(Board * board)
+            {
+                _board = board;
+            }
+
+            uint8_t available(void)
+            {
+                return (_head - _tail) & (SIZE - 1);
+            }
+
+            // Removes and returns the oldest event; false if empty
+            bool read(event_t & event)
+            {
+                if (_tail == _head) {
+                    return false;
+                }
+
+                event = _events[_tail];
+
+                _tail = (_tail + 1) & (SIZE - 1);
+
+                return true;
+            }
+
+            uint32_t getDropped(void)
+            {
+                return _dropped;
+            }
+
+            void clear(void)
+            {
+                _tail = _head;
+                _dropped = 0;
+            }
+
+            // Drains the buffer through Debugger::printf, one line per event
+            void dump(void)
+            {
+                static const char * NAMES[STAGE_COUNT] = {
+                    "update", "receiver", "pidtask", "mixer", "gyrometer", "quaternion", "sensor", "serialtask"
+                };
+
+                event_t event;
+
+                while (read(event)) {
+                    Debugger::printf("%-10s %2d %10u %10u %8u\n", NAMES[event.stage], event.index,
+                            (unsigned)event.begin, (unsigned)event.end, (unsigned)(event.end - event.begin));
+                }
+
+                if (_dropped) {
+                    Debugger::printf("(%u events dropped)\n", (unsigned)_dropped);
+                }
+            }
+
+    }; // class Tracer
+
+} // namespace hf